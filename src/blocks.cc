@@ -0,0 +1,77 @@
+#include <algorithm>
+#include "blocks.hh"
+
+/* Calls f(row, col) for every sample of a block, padding included, in order */
+template <typename F> static void each_sample(int block, int bx, F f){
+	int x0 = block / bx * BLOCK_SIZE, y0 = block % bx * BLOCK_SIZE;
+
+	for (int x = x0; x < x0 + BLOCK_SIZE; x++)
+		for (int y = y0; y < y0 + BLOCK_SIZE; y++)
+			f(x, y);
+}
+
+/*
+ * blocks_pack
+ * Packs the size x size samples of data, rows of which are indexed as a
+ * dem page's are.
+ */
+void blocks_pack(dem_blocks_t *b, short *const *data, int size){
+	b->size = size;
+	b->bx = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	b->index.assign(b->bx * b->bx, packed_block_t());
+	b->words.clear();
+
+	for (int i = 0; i < b->bx * b->bx; i++) {
+		packed_block_t *block = &b->index[i];
+		int lo = 32767, hi = -32768;
+
+		each_sample(i, b->bx, [&](int x, int y) {
+			if (x < size && y < size) {
+				lo = std::min(lo, (int)data[x][y]);
+				hi = std::max(hi, (int)data[x][y]);
+			}
+		});
+
+		int bits = 0;
+		while (bits < 16 && (hi - lo) >> bits != 0)
+			bits++;
+
+		block->offset = b->words.size();
+		block->base = lo;
+		block->bits = bits;
+		if (bits == 0)
+			continue;
+
+		/* Padding packs as the base */
+		uint64_t word = 0;
+		int used = 0;
+		each_sample(i, b->bx, [&](int x, int y) {
+			uint64_t v = x < size && y < size ? data[x][y] - lo : 0;
+
+			word |= v << used;
+			if (used + bits >= 64) {
+				b->words.push_back(word);
+				word = used + bits > 64 ? v >> (64 - used) : 0;
+			}
+			used = (used + bits) & 63;
+		});
+		if (used != 0)
+			b->words.push_back(word);
+	}
+
+	/* blocks_get() may read a word past the last */
+	b->words.push_back(0);
+	b->words.shrink_to_fit();
+}
+
+/* Unpacks every sample into data, rows of which are indexed as a dem page's are */
+void blocks_unpack(const dem_blocks_t *b, short **data){
+	for (int x = 0; x < b->size; x++)
+		for (int y = 0; y < b->size; y++)
+			data[x][y] = blocks_get(b, x, y);
+}
+
+/* Memory the packed terrain takes */
+size_t blocks_bytes(const dem_blocks_t *b){
+	return sizeof(*b) + b->index.size() * sizeof(packed_block_t) + b->words.size() * sizeof(uint64_t);
+}
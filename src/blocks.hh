@@ -0,0 +1,52 @@
+#ifndef _BLOCKS_HH_
+#define _BLOCKS_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Packed DEM terrain. A page of terrain is cut into BLOCK_SIZE square
+ * blocks, each kept as its lowest sample and the offsets of the others
+ * from it, in as few bits as the largest offset needs. Smooth terrain
+ * packs several times smaller than 16 bit samples. Every sample can be
+ * read on its own with a few shifts, which is faster for the paths of a
+ * plot, crossing a block in a few dozen samples, than decoding the blocks
+ * they cross.
+ */
+
+#define BLOCK_SIZE	16
+
+typedef struct _packed_block_t{
+	uint32_t	offset;		/* of the first sample in words */
+	short	base;
+	unsigned char	bits;		/* per sample, 0 if all equal the base */
+} packed_block_t;
+
+typedef struct _dem_blocks_t{
+	int	size;		/* samples across and down */
+	int	bx;		/* blocks across and down */
+	std::vector<packed_block_t>	index;
+	std::vector<uint64_t>	words;
+} dem_blocks_t;
+
+void blocks_pack(dem_blocks_t *b, short *const *data, int size);
+void blocks_unpack(const dem_blocks_t *b, short **data);
+size_t blocks_bytes(const dem_blocks_t *b);
+
+/* The sample at row x, column y */
+static inline short blocks_get(const dem_blocks_t *b, int x, int y){
+	const packed_block_t *block = &b->index[(x / BLOCK_SIZE) * b->bx + y / BLOCK_SIZE];
+	unsigned pos = ((x % BLOCK_SIZE) * BLOCK_SIZE + y % BLOCK_SIZE) * block->bits;
+	const uint64_t *word = &b->words[block->offset + (pos >> 6)];
+	unsigned shift = pos & 63;
+	uint64_t v = word[0] >> shift;
+
+	/* The words end with a spare, so word[1] is always there */
+	if (shift + block->bits > 64)
+		v |= word[1] << (64 - shift);
+
+	return (short)(block->base + (v & ((1ull << block->bits) - 1)));
+}
+
+#endif
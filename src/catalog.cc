@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include "catalog.hh"
+#include "geotiff.hh"
+#include "pyramid.hh"
+
+static const char *format_names[CAT_FORMATS] = {"sdp", "hgt", "sdb", "sdf", "sdf.bz2", "sdf.gz", "tif", "asc"};
+
+/* The format a file name says it holds, or -1 */
+static int format_of(const char *name){
+	static const struct { const char *suffix; int format; } suffixes[] = {
+		{".sdp", CAT_SDP}, {".hgt", CAT_HGT}, {".sdb", CAT_SDB}, {".sdf", CAT_SDF}, {".sdf.bz2", CAT_SDF_BZ},
+		{".sdf.gz", CAT_SDF_GZ}, {".tif", CAT_TIF}, {".tiff", CAT_TIF}, {".asc", CAT_ASC}};
+	size_t len = strlen(name);
+
+	for (auto &s : suffixes) {
+		size_t n = strlen(s.suffix);
+		if (len > n && strcasecmp(name + len - n, s.suffix) == 0)
+			return s.format;
+	}
+	return -1;
+}
+
+/* Positive westing, as DEM pages and the plot bounds use, to WGS84 */
+static double east_of(double west){
+	return west <= 180 ? 0.0 - west : 360 - west;
+}
+
+/* Reads the extent and resolution of a tile. Returns 0 or an errno */
+static int index_file(const char *path, catalog_entry_t *e){
+	int minlat, maxlat, minlon, maxlon;
+
+	switch (e->format) {
+	case CAT_SDP: {
+		pyramid_t pyr;
+		int success;
+
+		if ((success = pyramid_open(&pyr, path)) != 0)
+			return success;
+		pyramid_close(&pyr);
+
+		e->xll = east_of(pyr.header.max_west);
+		e->xur = east_of(pyr.header.min_west);
+		e->yll = pyr.header.min_north;
+		e->yur = pyr.header.max_north;
+		e->cellsize = (pyr.header.max_north - pyr.header.min_north) / pyr.header.height;
+		return 0;
+	}
+
+	case CAT_HGT: {
+		char ns, ew;
+		int lat, lon;
+
+		/* Named after the south west corner, eg. N51W001.hgt */
+		if (sscanf(e->name.c_str(), "%c%d%c%d", &ns, &lat, &ew, &lon) != 4 || strchr("NnSs", ns) == NULL ||
+				strchr("EeWw", ew) == NULL)
+			return EINVAL;
+		if (e->size != 1201 * 1201 * 2 && e->size != 3601 * 3601 * 2)
+			return EINVAL;
+
+		e->yll = strchr("Ss", ns) ? -lat : lat;
+		e->xll = strchr("Ww", ew) ? -lon : lon;
+		e->yur = e->yll + 1;
+		e->xur = e->xll + 1;
+		e->cellsize = e->size == 1201 * 1201 * 2 ? 1.0 / 1200 : 1.0 / 3600;
+		return 0;
+	}
+
+	case CAT_SDB: {
+		FILE *fd;
+		struct {
+			char magic[4];
+			int ippd, max_west, min_north, min_west, max_north;
+		} header;
+
+		if ((fd = fopen(path, "rb")) == NULL)
+			return errno;
+		if (fread(&header, sizeof(header), 1, fd) != 1 || memcmp(header.magic, "SDB1", 4) != 0 || header.ippd <= 0) {
+			fclose(fd);
+			return EINVAL;
+		}
+		fclose(fd);
+
+		e->xll = east_of(header.max_west);
+		e->xur = east_of(header.min_west);
+		e->yll = header.min_north;
+		e->yur = header.max_north;
+		e->cellsize = 1.0 / header.ippd;
+		return 0;
+	}
+
+	case CAT_SDF:
+	case CAT_SDF_BZ:
+	case CAT_SDF_GZ:
+		/* Named after the region they hold, eg. 51_52_0_1-hd.sdf */
+		if (sscanf(e->name.c_str(), "%d_%d_%d_%d", &minlat, &maxlat, &minlon, &maxlon) != 4)
+			return EINVAL;
+
+		e->xll = east_of(maxlon);
+		e->xur = east_of(minlon);
+		e->yll = minlat;
+		e->yur = maxlat;
+		e->cellsize = strstr(e->name.c_str(), "-hd.") != NULL ? 1.0 / 3600 : 1.0 / 1200;
+		return 0;
+
+	case CAT_TIF:
+		return geotiff_bounds(path, &e->xll, &e->yll, &e->xur, &e->yur, &e->cellsize);
+
+	case CAT_ASC: {
+		FILE *fd;
+		char key[32];
+		double value;
+		int ncols = 0, nrows = 0;
+
+		if ((fd = fopen(path, "r")) == NULL)
+			return errno;
+
+		e->xll = e->yll = e->cellsize = 0;
+		while (fscanf(fd, "%31s %lf", key, &value) == 2 && isalpha(key[0])) {
+			if (strcasecmp(key, "ncols") == 0) ncols = (int)value;
+			if (strcasecmp(key, "nrows") == 0) nrows = (int)value;
+			if (strcasecmp(key, "xllcorner") == 0 || strcasecmp(key, "xllcenter") == 0) e->xll = value;
+			if (strcasecmp(key, "yllcorner") == 0 || strcasecmp(key, "yllcenter") == 0) e->yll = value;
+			if (strcasecmp(key, "cellsize") == 0) e->cellsize = value;
+		}
+		fclose(fd);
+
+		if (ncols <= 0 || nrows <= 0 || e->cellsize <= 0)
+			return EINVAL;
+
+		e->xur = e->xll + ncols * e->cellsize;
+		e->yur = e->yll + nrows * e->cellsize;
+		return 0;
+	}
+	}
+
+	return EINVAL;
+}
+
+/* Reads a catalog written by write_catalog(), keyed by name */
+static void read_catalog(const std::string &filename, std::unordered_map<std::string, catalog_entry_t> &old){
+	FILE *fd;
+	char line[PATH_MAX + 256], name[NAME_MAX + 1], format[16];
+
+	if ((fd = fopen(filename.c_str(), "r")) == NULL)
+		return;
+
+	if (fgets(line, sizeof(line), fd) == NULL || strncmp(line, CATALOG_MAGIC, strlen(CATALOG_MAGIC)) != 0) {
+		fclose(fd);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fd) != NULL) {
+		catalog_entry_t e;
+
+		if (sscanf(line, "%255[^\t]\t%15s %lld %lld %lf %lf %lf %lf %lf", name, format, &e.size, &e.mtime, &e.xll, &e.yll,
+					&e.xur, &e.yur, &e.cellsize) != 9)
+			continue;
+
+		e.name = name;
+		e.format = -1;
+		for (int f = 0; f < CAT_FORMATS; f++)
+			if (strcmp(format, format_names[f]) == 0)
+				e.format = f;
+		if (e.format >= 0)
+			old[e.name] = e;
+	}
+
+	fclose(fd);
+}
+
+static int write_catalog(const catalog_t *cat, const std::string &filename){
+	std::string tmpfile = filename + "." + std::to_string(getpid());
+	FILE *fd;
+
+	if ((fd = fopen(tmpfile.c_str(), "w")) == NULL)
+		return errno;
+
+	fprintf(fd, "%s\n", CATALOG_MAGIC);
+	for (auto &e : cat->entries)
+		fprintf(fd, "%s\t%s\t%lld\t%lld\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\n", e.name.c_str(), format_names[e.format], e.size,
+				e.mtime, e.xll, e.yll, e.xur, e.yur, e.cellsize);
+
+	if (fclose(fd) != 0 || rename(tmpfile.c_str(), filename.c_str()) != 0) {
+		int err = errno;
+		unlink(tmpfile.c_str());
+		return err;
+	}
+	return 0;
+}
+
+/*
+ * catalog_open
+ * Lists the tiles in dir (empty for the working directory), from its
+ * catalog file where the files have not changed, and rewrites the catalog
+ * if anything was indexed or has gone. Returns 0 or an errno.
+ */
+int catalog_open(catalog_t *cat, const char *dir){
+	std::unordered_map<std::string, catalog_entry_t> old;
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+	size_t kept = 0, indexed = 0;
+
+	cat->dir = dir;
+	if (!cat->dir.empty() && cat->dir.back() != '/')
+		cat->dir += '/';
+	cat->entries.clear();
+	cat->index.clear();
+
+	if ((dp = opendir(cat->dir.empty() ? "." : cat->dir.c_str())) == NULL)
+		return errno;
+
+	read_catalog(cat->dir + CATALOG_FILE, old);
+
+	while ((de = readdir(dp)) != NULL) {
+		catalog_entry_t e;
+		std::string path = cat->dir + de->d_name;
+
+		if ((e.format = format_of(de->d_name)) < 0 || strpbrk(de->d_name, "\t\n") != NULL)
+			continue;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		e.name = de->d_name;
+		e.size = st.st_size;
+		e.mtime = st.st_mtime;
+
+		auto o = old.find(e.name);
+		if (o != old.end() && o->second.size == e.size && o->second.mtime == e.mtime && o->second.format == e.format) {
+			cat->entries.push_back(o->second);
+			kept++;
+		}
+		else if (index_file(path.c_str(), &e) == 0) {
+			cat->entries.push_back(e);
+			indexed++;
+		}
+	}
+	closedir(dp);
+
+	std::sort(cat->entries.begin(), cat->entries.end(),
+			[](const catalog_entry_t &a, const catalog_entry_t &b) { return a.name < b.name; });
+	for (size_t i = 0; i < cat->entries.size(); i++)
+		cat->index[cat->entries[i].name] = i;
+
+	spdlog::debug("Catalog of \"{}\": {} tiles, {} newly indexed", cat->dir.empty() ? "." : cat->dir, cat->entries.size(),
+			indexed);
+
+	/* Only directories holding tiles get a catalog */
+	if ((indexed > 0 || kept != old.size()) && !cat->entries.empty()) {
+		int success;
+		if ((success = write_catalog(cat, cat->dir + CATALOG_FILE)) != 0)
+			spdlog::debug("Could not write the catalog of \"{}\": {}", cat->dir, strerror(success));
+	}
+
+	return 0;
+}
+
+/*
+ * catalog_find
+ * Returns the entry for a file name, or NULL when the directory has no
+ * such tile.
+ */
+const catalog_entry_t *catalog_find(const catalog_t *cat, const char *name){
+	auto i = cat->index.find(name);
+
+	return i == cat->index.end() ? NULL : &cat->entries[i->second];
+}
+
+/*
+ * catalog_query
+ * Adds the tiles of the given formats (a mask of 1 << CAT_*) overlapping
+ * window (positive westing, NULL for all) to found, in name order. When
+ * several files share a name but for the extension, only the one in the
+ * format listed first is taken, so a pyramid hides the grid it came from.
+ */
+void catalog_query(const catalog_t *cat, const bbox *window, unsigned formats, std::vector<const catalog_entry_t *> &found){
+	std::unordered_map<std::string, const catalog_entry_t *> by_stem;
+	std::vector<std::string> stems;
+
+	for (auto &e : cat->entries) {
+		if ((formats & (1u << e.format)) == 0)
+			continue;
+
+		if (window != NULL && (e.xll >= east_of(window->lower_right.lon) || e.xur <= east_of(window->upper_left.lon) ||
+					e.yll >= window->upper_left.lat || e.yur <= window->lower_right.lat))
+			continue;
+
+		std::string stem = e.name.substr(0, e.name.find('.'));
+		auto s = by_stem.find(stem);
+		if (s == by_stem.end()) {
+			by_stem[stem] = &e;
+			stems.push_back(stem);
+		}
+		else if (e.format < s->second->format)
+			s->second = &e;
+	}
+
+	for (auto &stem : stems)
+		found.push_back(by_stem[stem]);
+}
@@ -0,0 +1,55 @@
+#ifndef _CATALOG_HH_
+#define _CATALOG_HH_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common.hh"
+
+/*
+ * Tile catalog. Lists the DEM and LIDAR tiles in a directory with their
+ * extent, format and resolution, so loaders can look up the files covering
+ * a plot instead of trying to open every name they might have. It is kept
+ * in the directory as CATALOG_FILE, written on first use and brought up to
+ * date on later ones by indexing only the files added or changed since.
+ */
+
+#define CATALOG_FILE	"signalserver.catalog"
+#define CATALOG_MAGIC	"# signalserver tile catalog 1"
+
+/* File formats, in the order LoadSDF() tries them */
+enum {
+	CAT_SDP = 0,	/* DEM pyramid, of either kind */
+	CAT_HGT,
+	CAT_SDB,
+	CAT_SDF,
+	CAT_SDF_BZ,
+	CAT_SDF_GZ,
+	CAT_TIF,
+	CAT_ASC,
+	CAT_FORMATS
+};
+
+/* The formats -lid can load */
+#define CAT_LIDAR	((1u << CAT_SDP) | (1u << CAT_TIF) | (1u << CAT_ASC))
+
+typedef struct _catalog_entry_t{
+	std::string	name;		/* within the directory */
+	int	format;
+	long long	size;
+	long long	mtime;
+	double	xll, yll, xur, yur;	/* WGS84 degrees */
+	double	cellsize;	/* degrees */
+} catalog_entry_t;
+
+typedef struct _catalog_t{
+	std::string	dir;		/* with a trailing '/', empty for the working directory */
+	std::vector<catalog_entry_t>	entries;	/* by name */
+	std::unordered_map<std::string, size_t>	index;
+} catalog_t;
+
+int catalog_open(catalog_t *cat, const char *dir);
+const catalog_entry_t *catalog_find(const catalog_t *cat, const char *name);
+void catalog_query(const catalog_t *cat, const bbox *window, unsigned formats, std::vector<const catalog_entry_t *> &found);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _COMMON_HH_
 #define _COMMON_HH_
 
+#include <stdint.h>
+
 #define GAMMA 		2.5
 
 #ifndef PI
@@ -38,8 +40,13 @@ struct dem {
 	int max_el;
 	int min_el;
 	short **data;
-	unsigned char **mask;
-	unsigned char **signal;
+	unsigned char *mask;		/* see result_cell() */
+	unsigned char *signal;
+	float *value;			/* unquantized results, if kept */
+	uint64_t *claims;		/* a bit per cell, set once a plot has it */
+	uint32_t *epochs;		/* the plot each result block belongs to */
+	unsigned char **clutter;	/* clutter height in metres, NULL if none */
+	struct _dem_blocks_t *blocks;	/* terrain when packed, else NULL */
 };
 
 struct site {
@@ -53,7 +60,7 @@ struct site {
 struct path {
 	double *lat;
 	double *lon;
-	double *elevation;
+	float *elevation;	/* terrain plus clutter, metres */
 	double *distance;
 	int length;
 };
@@ -0,0 +1,695 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "geotiff.hh"
+
+/* Pixels kept around the window so paths at its edge have terrain */
+#define WINDOW_MARGIN 2
+
+typedef struct _tiff_t{
+	int	fd;
+	bool	motorola;	/* big-endian file */
+	bool	bigtiff;
+	bool	tiled;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	block_width;	/* tiles, or whole rows of strips */
+	uint32_t	block_height;
+	int	bits;
+	int	format;		/* 1 unsigned, 2 signed, 3 floating point */
+	int	compression;
+	int	predictor;
+	int	samples;
+	std::vector<uint64_t>	offsets;
+	std::vector<uint64_t>	counts;
+	std::vector<double>	scale;		/* ModelPixelScale */
+	std::vector<double>	tiepoint;	/* ModelTiepoint */
+	std::vector<double>	geokeys;	/* GeoKeyDirectory */
+	bool	has_nodata;
+	double	nodata;
+} tiff_t;
+
+static uint64_t get(const tiff_t *t, const unsigned char *p, int size){
+	uint64_t v = 0;
+
+	for (int i = 0; i < size; i++)
+		v |= (uint64_t)p[t->motorola ? size - 1 - i : i] << (8 * i);
+
+	return v;
+}
+
+static int type_size(int type){
+	switch (type) {
+		case 1: case 2: case 6: case 7: return 1;	/* BYTE, ASCII, SBYTE, UNDEFINED */
+		case 3: case 8: return 2;			/* SHORT, SSHORT */
+		case 4: case 9: case 11: case 13: return 4;	/* LONG, SLONG, FLOAT, IFD */
+		case 5: case 10: case 12: case 16: case 17: case 18: return 8;	/* RATIONAL, DOUBLE, LONG8... */
+		default: return 0;
+	}
+}
+
+/* Reads the values of one IFD entry, as numbers or as text */
+static int entry_values(const tiff_t *t, const unsigned char *entry, std::vector<double> &values, std::string *text){
+	int type = get(t, entry + 2, 2), size = type_size(type), field = t->bigtiff ? 8 : 4;
+	uint64_t count = get(t, entry + 4, t->bigtiff ? 8 : 4);
+	const unsigned char *inline_data = entry + (t->bigtiff ? 12 : 8);
+	std::vector<unsigned char> data;
+
+	if (size == 0 || count > (1u << 28))
+		return EINVAL;
+
+	data.resize(count * size);
+	if (count * size <= (uint64_t)field)
+		memcpy(data.data(), inline_data, count * size);
+	else if (pread(t->fd, data.data(), data.size(), get(t, inline_data, field)) != (ssize_t)data.size())
+		return EIO;
+
+	if (text != NULL) {
+		text->assign((const char *)data.data(), count);
+		return 0;
+	}
+
+	values.resize(count);
+	for (uint64_t i = 0; i < count; i++) {
+		const unsigned char *p = &data[i * size];
+		uint64_t v = get(t, p, size == 8 && type != 5 && type != 10 ? 8 : std::min(size, 4));
+
+		switch (type) {
+			case 5: values[i] = (double)(uint32_t)v / (uint32_t)get(t, p + 4, 4); break;
+			case 10: values[i] = (double)(int32_t)v / (int32_t)get(t, p + 4, 4); break;
+			case 6: values[i] = (int8_t)v; break;
+			case 8: values[i] = (int16_t)v; break;
+			case 9: values[i] = (int32_t)v; break;
+			case 11: { uint32_t u = v; float f; memcpy(&f, &u, 4); values[i] = f; break; }
+			case 12: { double d; memcpy(&d, &v, 8); values[i] = d; break; }
+			case 17: values[i] = (int64_t)v; break;
+			default: values[i] = v;
+		}
+	}
+
+	return 0;
+}
+
+/* Parses the header and first IFD */
+static int tiff_open(tiff_t *t, const char *filename){
+	unsigned char header[16];
+	uint64_t ifd, entries;
+	int entry_size;
+
+	if ((t->fd = open(filename, O_RDONLY)) < 0)
+		return errno;
+
+	if (pread(t->fd, header, sizeof(header), 0) < 8 || (memcmp(header, "II", 2) != 0 && memcmp(header, "MM", 2) != 0))
+		return EINVAL;
+
+	t->motorola = header[0] == 'M';
+	t->bigtiff = get(t, header + 2, 2) == 43;
+	if (!t->bigtiff && get(t, header + 2, 2) != 42)
+		return EINVAL;
+
+	ifd = t->bigtiff ? get(t, header + 8, 8) : get(t, header + 4, 4);
+	entry_size = t->bigtiff ? 20 : 12;
+
+	unsigned char count[8];
+	if (pread(t->fd, count, t->bigtiff ? 8 : 2, ifd) != (t->bigtiff ? 8 : 2))
+		return EIO;
+	entries = get(t, count, t->bigtiff ? 8 : 2);
+
+	std::vector<unsigned char> dir(entries * entry_size);
+	if (entries > 4096 || pread(t->fd, dir.data(), dir.size(), ifd + (t->bigtiff ? 8 : 2)) != (ssize_t)dir.size())
+		return EIO;
+
+	t->bits = 1;
+	t->format = 1;
+	t->compression = 1;
+	t->predictor = 1;
+	t->samples = 1;
+	t->has_nodata = false;
+
+	std::vector<double> values, strip_rows;
+	for (uint64_t i = 0; i < entries; i++) {
+		const unsigned char *entry = &dir[i * entry_size];
+		int tag = get(t, entry, 2), success = 0;
+		std::string text;
+
+		values.clear();
+		if (tag == 42113)
+			success = entry_values(t, entry, values, &text);
+		else if (tag == 256 || tag == 257 || tag == 258 || tag == 259 || tag == 273 || tag == 277 || tag == 278 ||
+				 tag == 279 || tag == 317 || tag == 322 || tag == 323 || tag == 324 || tag == 325 || tag == 339 ||
+				 tag == 33550 || tag == 33922 || tag == 34735)
+			success = entry_values(t, entry, values, NULL);
+		else
+			continue;
+
+		if (success != 0)
+			return success;
+		if (values.empty() && tag != 42113)
+			return EINVAL;
+
+		switch (tag) {
+			case 256: t->width = values[0]; break;
+			case 257: t->height = values[0]; break;
+			case 258: t->bits = values[0]; break;
+			case 259: t->compression = values[0]; break;
+			case 273: case 324: t->offsets.assign(values.begin(), values.end()); break;
+			case 277: t->samples = values[0]; break;
+			case 278: strip_rows = values; break;
+			case 279: case 325: t->counts.assign(values.begin(), values.end()); break;
+			case 317: t->predictor = values[0]; break;
+			case 322: t->block_width = values[0]; break;
+			case 323: t->block_height = values[0]; break;
+			case 339: t->format = values[0]; break;
+			case 33550: t->scale = values; break;
+			case 33922: t->tiepoint = values; break;
+			case 34735: t->geokeys = values; break;
+			case 42113:
+				t->has_nodata = !text.empty() && strncasecmp(text.c_str(), "nan", 3) != 0;
+				t->nodata = atof(text.c_str());
+				break;
+		}
+	}
+
+	/* Strips are blocks as wide as the image */
+	t->tiled = t->block_width != 0;
+	if (!t->tiled) {
+		t->block_width = t->width;
+		t->block_height = strip_rows.empty() ? t->height : std::min((uint32_t)strip_rows[0], t->height);
+	}
+
+	if (t->width == 0 || t->height == 0 || t->block_width == 0 || t->block_height == 0 || t->offsets.empty() ||
+			t->offsets.size() != t->counts.size())
+		return EINVAL;
+
+	return 0;
+}
+
+/* TIFF flavoured LZW: MSB first codes of 9 to 12 bits, widened one code early */
+static int lzw_decode(const unsigned char *in, size_t n, unsigned char *out, size_t size){
+	uint16_t prefix[4096], length[4096];
+	unsigned char suffix[4096], first[4096];
+	uint32_t bits = 0;
+	int nbits = 0, width = 9, next = 258, old = -1;
+	size_t pos = 0, i = 0;
+
+	for (int c = 0; c < 256; c++) {
+		prefix[c] = 0;
+		length[c] = 1;
+		suffix[c] = first[c] = c;
+	}
+
+	/* Writes the string of code at out[pos] */
+	auto emit = [&](int code) -> bool {
+		if (pos + length[code] > size)
+			return false;
+		for (int c = code, k = length[code] - 1; k >= 0; c = prefix[c], k--)
+			out[pos + k] = suffix[c];
+		pos += length[code];
+		return true;
+	};
+
+	for (;;) {
+		while (nbits < width) {
+			if (i >= n)
+				return pos == size ? 0 : EIO;
+			bits = (bits << 8) | in[i++];
+			nbits += 8;
+		}
+		int code = (bits >> (nbits - width)) & ((1 << width) - 1);
+		nbits -= width;
+
+		if (code == 257)
+			break;
+		if (code == 256) {
+			width = 9;
+			next = 258;
+			old = -1;
+			continue;
+		}
+		if (old < 0) {
+			if (code > 255 || !emit(code))
+				return EIO;
+			old = code;
+			continue;
+		}
+		if (code > next || next >= 4096)
+			return EIO;
+
+		/* The new entry is the old string plus the first byte of this one */
+		unsigned char c = code < next ? first[code] : first[old];
+		prefix[next] = old;
+		suffix[next] = c;
+		first[next] = first[old];
+		length[next] = length[old] + 1;
+		next++;
+
+		if (!emit(code))
+			return EIO;
+		old = code;
+
+		if (next >= (1 << width) - 1 && width < 12)
+			width++;
+	}
+
+	return pos == size ? 0 : EIO;
+}
+
+/* Decodes one block into `rows` rows of doubles, block_width wide */
+static int decode_block(const tiff_t *t, size_t index, int rows, std::vector<double> &values){
+	int bytes = t->bits / 8;
+	size_t row_bytes = (size_t)t->block_width * bytes, size = row_bytes * rows;
+	std::vector<unsigned char> raw(t->counts[index]), data;
+
+	if (pread(t->fd, raw.data(), raw.size(), t->offsets[index]) != (ssize_t)raw.size())
+		return EIO;
+
+	if (t->compression == 1) {
+		data.swap(raw);
+		if (data.size() < size)
+			return EIO;
+	} else if (t->compression == 5) {
+		data.resize(size);
+		if (lzw_decode(raw.data(), raw.size(), data.data(), size) != 0)
+			return EIO;
+	} else {
+		uLongf len = size;
+		data.resize(size);
+		if (uncompress(data.data(), &len, raw.data(), raw.size()) != Z_OK || len != size)
+			return EIO;
+	}
+
+	values.resize((size_t)t->block_width * rows);
+
+	for (int r = 0; r < rows; r++) {
+		unsigned char *row = &data[r * row_bytes];
+		double *dst = &values[(size_t)r * t->block_width];
+
+		if (t->predictor == 3) {
+			/* Floating point predictor: byte differences across the row,
+			 * then each byte plane in turn, most significant first */
+			for (size_t k = 1; k < row_bytes; k++)
+				row[k] += row[k - 1];
+			for (uint32_t k = 0; k < t->block_width; k++) {
+				uint64_t v = 0;
+				for (int b = 0; b < bytes; b++)
+					v = (v << 8) | row[b * t->block_width + k];
+				if (bytes == 4) {
+					uint32_t u = v;
+					float f;
+					memcpy(&f, &u, 4);
+					dst[k] = f;
+				} else {
+					double d;
+					memcpy(&d, &v, 8);
+					dst[k] = d;
+				}
+			}
+			continue;
+		}
+
+		uint64_t acc = 0, mask = bytes == 8 ? ~0ull : (1ull << t->bits) - 1;
+		for (uint32_t k = 0; k < t->block_width; k++) {
+			uint64_t v = get(t, &row[k * bytes], bytes);
+
+			/* Horizontal differencing, in the width of the samples */
+			if (t->predictor == 2)
+				v = acc = (acc + v) & mask;
+
+			if (t->format == 3) {
+				if (bytes == 4) {
+					uint32_t u = v;
+					float f;
+					memcpy(&f, &u, 4);
+					dst[k] = f;
+				} else {
+					double d;
+					memcpy(&d, &v, 8);
+					dst[k] = d;
+				}
+			} else if (t->format == 2) {
+				dst[k] = bytes == 1 ? (int8_t)v : bytes == 2 ? (int16_t)v : bytes == 4 ? (int32_t)v : (int64_t)v;
+			} else {
+				dst[k] = v;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Looks up a GeoKey, or returns -1 */
+static int geokey(const tiff_t *t, int key){
+	for (size_t i = 4; i + 3 < t->geokeys.size(); i += 4) {
+		if (t->geokeys[i] == key && t->geokeys[i + 1] == 0)
+			return t->geokeys[i + 3];
+	}
+	return -1;
+}
+
+/* Opens a GeoTIFF we can read and finds its north west corner in WGS84
+ * degrees. Returns 0 or an errno, with the file closed on error */
+static int tiff_georef(tiff_t *t, const char *filename, double *west, double *north){
+	int success;
+
+	t->fd = -1;
+	t->width = t->height = t->block_width = t->block_height = 0;
+
+	if ((success = tiff_open(t, filename)) != 0) {
+		if (t->fd >= 0)
+			close(t->fd);
+		return success;
+	}
+
+	auto fail = [&](int error, const char *why) {
+		fprintf(stderr, "GeoTIFF %s: %s\n", filename, why);
+		close(t->fd);
+		return error;
+	};
+
+	if (t->samples != 1)
+		return fail(EINVAL, "only single band DEMs are supported");
+	if (t->compression != 1 && t->compression != 5 && t->compression != 8 && t->compression != 32946)
+		return fail(EINVAL, "only uncompressed, LZW or deflate data is supported");
+	if ((t->format == 3 && t->bits != 32 && t->bits != 64) || (t->format != 3 && t->bits != 8 && t->bits != 16 && t->bits != 32) ||
+			t->format < 1 || t->format > 3 || t->predictor < 1 || t->predictor > 3)
+		return fail(EINVAL, "unsupported sample format");
+	if (t->scale.size() < 2 || t->tiepoint.size() < 6)
+		return fail(EINVAL, "no georeferencing");
+	if (geokey(t, 1024) == 1 || geokey(t, 3072) > 0 || (geokey(t, 2048) > 0 && geokey(t, 2048) != 4326))
+		return fail(EINVAL, "must be in EPSG:4326 (WGS84 degrees)");
+
+	/* Corner of the image, in WGS84 degrees. PixelIsPoint ties the
+	 * centre of the pixel rather than its corner */
+	*west = t->tiepoint[3] - t->tiepoint[0] * t->scale[0];
+	*north = t->tiepoint[4] + t->tiepoint[1] * t->scale[1];
+	if (geokey(t, 1025) == 2) {
+		*west -= t->scale[0] / 2;
+		*north += t->scale[1] / 2;
+	}
+
+	return 0;
+}
+
+int geotiff_bounds(const char *filename, double *xll, double *yll, double *xur, double *yur, double *cellsize){
+	tiff_t tiff;
+	double west, north;
+	int success;
+
+	if ((success = tiff_georef(&tiff, filename, &west, &north)) != 0)
+		return success;
+	close(tiff.fd);
+
+	*cellsize = tiff.scale[0];
+	*xll = west;
+	*yur = north;
+	*xur = west + tiff.width * tiff.scale[0];
+	*yll = north - tiff.height * tiff.scale[1];
+
+	return 0;
+}
+
+int tile_load_geotiff(tile_t *tile, char *filename, bbox *window){
+	tiff_t tiff;
+	double west, north;
+	int success;
+
+	/* Clear the tile data */
+	memset(tile, 0x00, sizeof(tile_t));
+
+	if ((success = tiff_georef(&tiff, filename, &west, &north)) != 0)
+		return success;
+
+	auto fail = [&](int error, const char *why) {
+		if (why != NULL)
+			fprintf(stderr, "GeoTIFF %s: %s\n", filename, why);
+		close(tiff.fd);
+		return error;
+	};
+
+	double sx = tiff.scale[0], sy = tiff.scale[1];
+
+	/* The pixels the window covers */
+	int c0 = 0, c1 = tiff.width, r0 = 0, r1 = tiff.height;
+	if (window != NULL) {
+		double e0 = window->upper_left.lon <= 180 ? -window->upper_left.lon : 360 - window->upper_left.lon;
+		double e1 = window->lower_right.lon <= 180 ? -window->lower_right.lon : 360 - window->lower_right.lon;
+
+		c0 = std::max((int)floor((e0 - west) / sx) - WINDOW_MARGIN, 0);
+		c1 = std::min((int)ceil((e1 - west) / sx) + WINDOW_MARGIN, (int)tiff.width);
+		r0 = std::max((int)floor((north - window->upper_left.lat) / sy) - WINDOW_MARGIN, 0);
+		r1 = std::min((int)ceil((north - window->lower_right.lat) / sy) + WINDOW_MARGIN, (int)tiff.height);
+
+		if (c0 >= c1 || r0 >= r1)
+			return fail(ENODATA, NULL);
+	}
+
+	tile->filename = strdup(filename);
+	tile->width = c1 - c0;
+	tile->height = r1 - r0;
+	tile->cellsize = sx;
+	tile->xll = west + c0 * sx;
+	tile->xur = west + c1 * sx;
+	tile->yur = north - r0 * sy;
+	tile->yll = north - r1 * sy;
+
+	if (tile->xur > eastoffset)
+		eastoffset = tile->xur;
+	if (tile->xll < westoffset)
+		westoffset = tile->xll;
+
+	// Transform WGS84 longitudes into 'west' values, as tile_load_lidar() does
+	if (tile->xll >= 0)
+		tile->xll = 360-tile->xll;
+	if(tile->xur >= 0)
+		tile->xur = 360-tile->xur;
+	if(tile->xll < 0)
+		tile->xll = tile->xll * -1;
+	if(tile->xur < 0)
+		tile->xur = tile->xur * -1;
+
+	if ( (tile->data = tile_alloc((size_t)tile->width * tile->height)) == NULL ) {
+		free(tile->filename);
+		return fail(ENOMEM, NULL);
+	}
+
+	/* Decode the blocks touching the window on every core */
+	uint32_t across = (tiff.width + tiff.block_width - 1) / tiff.block_width;
+	int bx0 = c0 / tiff.block_width, bx1 = (c1 - 1) / tiff.block_width;
+	int by0 = r0 / tiff.block_height, by1 = (r1 - 1) / tiff.block_height;
+	int nblocks = (bx1 - bx0 + 1) * (by1 - by0 + 1);
+	std::atomic<int> next(0), error(0);
+	std::vector<short> block_max(nblocks, 0);
+
+	auto worker = [&]() {
+		std::vector<double> values;
+		int n;
+
+		while ((n = next++) < nblocks && error == 0) {
+			int bx = bx0 + n % (bx1 - bx0 + 1), by = by0 + n / (bx1 - bx0 + 1);
+			size_t index = (size_t)by * across + bx;
+			short bmax = 0;
+
+			/* Tiles are always whole, strips may be short at the bottom */
+			int rows = tiff.tiled ? tiff.block_height : std::min(tiff.block_height, tiff.height - by * tiff.block_height);
+
+			if (index >= tiff.offsets.size() || decode_block(&tiff, index, rows, values) != 0) {
+				error = EIO;
+				break;
+			}
+
+			int y0 = std::max(r0, (int)(by * tiff.block_height)), y1 = std::min(r1, (int)((by + 1) * tiff.block_height));
+			int x0 = std::max(c0, (int)(bx * tiff.block_width)), x1 = std::min(c1, (int)((bx + 1) * tiff.block_width));
+
+			for (int y = y0; y < y1; y++) {
+				const double *src = &values[(size_t)(y - by * tiff.block_height) * tiff.block_width + x0 - bx * tiff.block_width];
+				short *dst = &tile->data[(size_t)(y - r0) * tile->width + x0 - c0];
+
+				for (int x = 0; x < x1 - x0; x++) {
+					double v = src[x];
+
+					/* Voids and anything below sea level become zero, as in tile_load_lidar() */
+					if ((tiff.has_nodata && v == tiff.nodata) || !(v > 0))
+						v = 0;
+					dst[x] = (short)lrint(std::min(v, 32767.0));
+					if (dst[x] > bmax)
+						bmax = dst[x];
+				}
+			}
+			block_max[n] = bmax;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < MAX((int)std::thread::hardware_concurrency(), 1) && t < nblocks; t++)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (auto &th : workers)
+		th.join();
+
+	close(tiff.fd);
+
+	if (error != 0) {
+		fprintf(stderr, "GeoTIFF %s: corrupt or truncated block\n", filename);
+		tile_destroy(tile);
+		free(tile->filename);
+		return error;
+	}
+
+	/* From zero, as tile_load_lidar() gives them */
+	tile->max_el = *std::max_element(block_max.begin(), block_max.end());
+	tile->min_el = 0;
+
+	/* Resolution of the whole image, so it does not depend on the window */
+	double full_east = west + tiff.width * sx;
+	double max_west = west >= 0 ? 360 - west : -west, min_west = full_east >= 0 ? 360 - full_east : -full_east;
+	double current_res_km = haversine_formula(north, max_west, north, min_west);
+	tile->precise_resolution = (current_res_km/MAX(tiff.width,tiff.height)*1000);
+
+	// Round to nearest 0.5
+	tile->resolution = tile->precise_resolution < 0.5f ? 0.5f : ceil((tile->precise_resolution * 2)+0.5) / 2;
+
+	// Positive westing
+	tile->width_deg = tile->max_west - tile->min_west >= 0 ? tile->max_west - tile->min_west : tile->max_west + (360 - tile->min_west);
+	tile->height_deg = tile->max_north - tile->min_north;
+
+	tile->ppdx = tile->width / tile->width_deg;
+	tile->ppdy = tile->height / tile->height_deg;
+
+	if (debug)
+		fprintf(stderr,"GeoTIFF %s: %ux%u in %ux%u blocks, window %d,%d %dx%d, %d blocks read (PPD %dx%d, Res %f (%.2f))\n",
+			filename, tiff.width, tiff.height, tiff.block_width, tiff.block_height, c0, r0, tile->width, tile->height,
+			nblocks, tile->ppdx, tile->ppdy, tile->precise_resolution, tile->resolution);
+
+	return 0;
+}
+
+/* An IFD entry being written, its values in host order */
+typedef struct _tiff_entry_t{
+	uint16_t	tag;
+	uint16_t	type;
+	uint32_t	count;
+	std::vector<unsigned char>	data;
+} tiff_entry_t;
+
+template <typename T>
+static void add_entry(std::vector<tiff_entry_t> &entries, uint16_t tag, uint16_t type, const std::vector<T> &values){
+	tiff_entry_t entry = {tag, type, (uint32_t)values.size(), std::vector<unsigned char>(values.size() * sizeof(T))};
+
+	memcpy(entry.data.data(), values.data(), entry.data.size());
+	entries.push_back(entry);
+}
+
+/*
+ * geotiff_write
+ * Writes width x height float samples, rows north first, as a single
+ * band, uncompressed EPSG:4326 GeoTIFF, the top left corner of its first
+ * cell at west (degrees east), north, its cells cellsize degrees square.
+ * The header is followed by the samples as they are, in host order, so
+ * the file can be mapped as well as read. Returns 0 or an errno.
+ */
+int geotiff_write(const char *filename, const float *values, uint32_t width, uint32_t height,
+		double west, double north, double cellsize, double nodata){
+	const uint16_t one = 1;
+	uint64_t bytes = (uint64_t)width * height * sizeof(float);
+	uint32_t strip_rows = std::max(65536u / (uint32_t)(width * sizeof(float)), 1u);
+	uint32_t strips = (height + strip_rows - 1) / strip_rows;
+	std::vector<tiff_entry_t> entries;
+	std::vector<uint32_t> offsets, counts;
+	char text[64];
+
+	if (width == 0 || height == 0)
+		return EINVAL;
+
+	snprintf(text, sizeof(text), "%.17g", nodata);
+	std::string nodata_text = std::string(text) + '\0';
+
+	/* In tag order. Strip offsets are filled in once the header is laid out */
+	add_entry<uint32_t>(entries, 256, 4, {width});
+	add_entry<uint32_t>(entries, 257, 4, {height});
+	add_entry<uint16_t>(entries, 258, 3, {32});
+	add_entry<uint16_t>(entries, 259, 3, {1});			/* uncompressed */
+	add_entry<uint16_t>(entries, 262, 3, {1});			/* black is zero */
+	add_entry<uint32_t>(entries, 273, 4, std::vector<uint32_t>(strips));
+	add_entry<uint16_t>(entries, 277, 3, {1});
+	add_entry<uint32_t>(entries, 278, 4, {strip_rows});
+	for (uint32_t s = 0; s < strips; s++)
+		counts.push_back(std::min(strip_rows, height - s * strip_rows) * width * sizeof(float));
+	add_entry<uint32_t>(entries, 279, 4, counts);
+	add_entry<uint16_t>(entries, 284, 3, {1});			/* one plane */
+	add_entry<uint16_t>(entries, 339, 3, {3});			/* floating point */
+	add_entry<double>(entries, 33550, 12, {cellsize, cellsize, 0.0});
+	add_entry<double>(entries, 33922, 12, {0.0, 0.0, 0.0, west, north, 0.0});
+	/* Geographic, pixels are areas, WGS84 */
+	add_entry<uint16_t>(entries, 34735, 3, {1, 1, 0, 3, 1024, 0, 1, 2, 1025, 0, 1, 1, 2048, 0, 1, 4326});
+	add_entry<char>(entries, 42113, 2, std::vector<char>(nodata_text.begin(), nodata_text.end()));
+
+	/* The header and the IFD, then the values too big for it, then the
+	   samples, 16 byte aligned */
+	uint64_t at = 8 + 2 + entries.size() * 12 + 4;
+	std::vector<uint32_t> places;
+	for (auto &entry : entries) {
+		places.push_back(entry.data.size() > 4 ? at : 0);
+		if (entry.data.size() > 4)
+			at += (entry.data.size() + 1) & ~(size_t)1;
+	}
+	uint64_t data_at = (at + 15) & ~(uint64_t)15;
+
+	if (data_at + bytes > UINT32_MAX)
+		return EFBIG;	/* needs BigTIFF */
+
+	for (uint32_t s = 0; s < strips; s++)
+		offsets.push_back(data_at + (uint64_t)s * strip_rows * width * sizeof(float));
+	for (auto &entry : entries)
+		if (entry.tag == 273)
+			memcpy(entry.data.data(), offsets.data(), entry.data.size());
+
+	std::vector<unsigned char> header(data_at, 0);
+	uint16_t count = entries.size(), magic = 42;
+	uint32_t first = 8;
+	unsigned char *p = header.data();
+
+	memcpy(p, *(const unsigned char *)&one ? "II" : "MM", 2);
+	memcpy(p + 2, &magic, 2);
+	memcpy(p + 4, &first, 4);
+	memcpy(p + 8, &count, 2);
+	p += 10;
+	for (size_t i = 0; i < entries.size(); i++, p += 12) {
+		tiff_entry_t &entry = entries[i];
+
+		memcpy(p, &entry.tag, 2);
+		memcpy(p + 2, &entry.type, 2);
+		memcpy(p + 4, &entry.count, 4);
+		if (places[i] == 0)
+			memcpy(p + 8, entry.data.data(), entry.data.size());
+		else {
+			memcpy(p + 8, &places[i], 4);
+			memcpy(&header[places[i]], entry.data.data(), entry.data.size());
+		}
+	}
+	/* The next IFD offset, zero, is already there */
+
+	FILE *fd = fopen(filename, "wb");
+	int success = 0;
+
+	if (fd == NULL)
+		return errno;
+	if (fwrite(header.data(), 1, header.size(), fd) != header.size() ||
+			fwrite(values, sizeof(float), (size_t)width * height, fd) != (size_t)width * height)
+		success = EIO;
+	if (fclose(fd) != 0 && success == 0)
+		success = errno;
+
+	return success;
+}
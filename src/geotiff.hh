@@ -0,0 +1,25 @@
+#ifndef _GEOTIFF_HH_
+#define _GEOTIFF_HH_
+
+#include "common.hh"
+#include "tiles.hh"
+
+/*
+ * Loads the part of a single band, EPSG:4326 GeoTIFF DEM that covers
+ * window (positive westing, NULL for all of it) as a tile. Tiled and
+ * striped files, uncompressed, LZW or deflate, with or without a
+ * predictor, and 8 to 32 bit integer or floating point samples are
+ * read. Returns 0, ENODATA when the file misses the window, or an errno.
+ */
+int tile_load_geotiff(tile_t *tile, char *filename, bbox *window);
+
+/* Reads just the extent of a GeoTIFF DEM tile_load_geotiff() can load, in
+ * WGS84 degrees. Returns 0 or an errno */
+int geotiff_bounds(const char *filename, double *xll, double *yll, double *xur, double *yur, double *cellsize);
+
+/* Writes float samples as a single band EPSG:4326 GeoTIFF. Returns 0 or
+ * an errno */
+int geotiff_write(const char *filename, const float *values, uint32_t width, uint32_t height,
+		double west, double north, double cellsize, double nodata);
+
+#endif
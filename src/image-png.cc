@@ -0,0 +1,419 @@
+/*
+ * PNG output. Rows are filtered and deflated in chunks on every core,
+ * each chunk primed with the 32 KB of data before it the way pigz does,
+ * so the chunks join into one zlib stream, written out in order as IDAT
+ * chunks while later ones are still being compressed. RGB and RGBA
+ * images are written as their rows come (image_stream()); palette images
+ * are kept in the canvas until written, as their palette must come first.
+ * Rows are drawn in RGB, and written as image_set_png() says, unless the
+ * image is initialized as IMAGE_RGBA, when they are written as they are.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "image.hh"
+
+#define PNG_CHUNK	(256 << 10)	/* filtered bytes deflated by one thread */
+#define PNG_WINDOW	32768		/* deflate history carried into the next chunk */
+
+static int png_type = IMAGE_PNG_RGB;
+
+typedef struct _png_job_t{
+	std::vector<uint8_t> rows;	/* lead rows, then the rows of this chunk */
+	size_t lead;			/* rows only there to prime the filters and history */
+	bool last;
+	std::vector<uint8_t> out;	/* raw deflate */
+	uLong adler;			/* of the filtered rows of this chunk */
+	size_t length;
+	int error;
+	std::thread thread;
+} png_job_t;
+
+typedef struct _png_state_t{
+	int type;			/* IMAGE_PNG_* being written */
+	size_t pixel;			/* bytes of a drawn pixel */
+	size_t bpp, row_bytes;		/* of a written pixel and row */
+	std::unordered_map<uint32_t, uint8_t> index;	/* palette entry of each colour */
+	std::vector<uint32_t> palette;
+	std::vector<uint8_t> pending;	/* written rows, not yet handed to a job */
+	size_t lead;			/* of them, kept from the last job */
+	std::deque<png_job_t*> jobs;	/* in order */
+	size_t threads;
+	bool started, first;
+	uLong adler;
+} png_state_t;
+
+#define STATE(ctx) ((png_state_t*)(ctx)->priv)
+
+/*
+ * image_set_png
+ * Sets how PNG images store their pixels: RGB, RGBA with white made
+ * transparent, or a palette of up to 256 colours, white transparent.
+ */
+int image_set_png(int type){
+	if(type < IMAGE_PNG_RGB || type > IMAGE_PNG_PALETTE)
+		return EINVAL;
+	png_type = type;
+	return 0;
+}
+
+int png_init(image_ctx_t *ctx){
+	png_state_t *state;
+
+	if(ctx->canvas != NULL)
+		return EINVAL;
+	if(ctx->model != IMAGE_RGBA)
+		ctx->model = IMAGE_RGB;
+	ctx->format = IMAGE_PNG;
+	ctx->extension = (char*)".png";
+
+	/* Unless streamed, rows are kept until written */
+	ctx->canvas = (uint8_t*) calloc(ctx->width * ctx->height * (ctx->model == IMAGE_RGBA ? RGBA_SIZE : RGB_SIZE),sizeof(uint8_t));
+	ctx->next_pixel = ctx->canvas;
+	if(ctx->canvas == NULL)
+		return ENOMEM;
+
+	state = new png_state_t();
+	state->type = ctx->model == IMAGE_RGBA ? IMAGE_PNG_RGBA : png_type;
+	state->pixel = ctx->model == IMAGE_RGBA ? RGBA_SIZE : RGB_SIZE;
+	state->threads = std::max(std::thread::hardware_concurrency(), 1u);
+	state->first = true;
+	ctx->priv = (void*)state;
+
+	/* A palette must be known before any row is written */
+	if(state->type == IMAGE_PNG_PALETTE)
+		((image_dispatch_table_t*)ctx->_dt)->write_rows = NULL;
+
+	return 0;
+}
+
+int png_add_pixel(image_ctx_t *ctx,const uint8_t r,const uint8_t g,const uint8_t b,const uint8_t a){
+	uint8_t* next = ctx->next_pixel;
+
+	next[0] = r;
+	next[1] = g;
+	next[2] = b;
+	if(ctx->model == IMAGE_RGBA)
+		next[3] = a;
+	ctx->next_pixel += STATE(ctx)->pixel;
+
+	return 0;
+}
+
+int png_add_row(image_ctx_t *ctx,const uint8_t *row){
+	memcpy(ctx->next_pixel, row, ctx->width * STATE(ctx)->pixel);
+	ctx->next_pixel += ctx->width * STATE(ctx)->pixel;
+
+	return 0;
+}
+
+static inline void put32(uint8_t *p, uint32_t v){
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Writes a PNG chunk, its length and CRC around type and data */
+static int write_chunk(FILE *fd, const char *type, const uint8_t *data, size_t length){
+	uint8_t head[8], tail[4];
+	uLong crc;
+
+	put32(head, length);
+	memcpy(head + 4, type, 4);
+	crc = crc32(0, head + 4, 4);
+	if(length > 0)
+		crc = crc32(crc, data, length);
+	put32(tail, crc);
+
+	if(fwrite(head,1,8,fd) != 8 || (length > 0 && fwrite(data,1,length,fd) != length) || fwrite(tail,1,4,fd) != 4)
+		return EPIPE;
+	return 0;
+}
+
+/* Paeth predictor, from the PNG specification */
+static inline uint8_t paeth(int a, int b, int c){
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if(pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+/* Filters a row against the one above, out[0] being the filter type. As
+ * libpng does, palette rows are left unfiltered and other rows take the
+ * filter with the smallest sum of absolute differences. */
+static void filter_row(const uint8_t *row, const uint8_t *up, size_t bytes, size_t bpp, uint8_t *out, uint8_t *trial){
+	unsigned long best = ~0UL, sum;
+	size_t i;
+	int f;
+
+	out[0] = 0;
+	memcpy(out + 1, row, bytes);
+	if(bpp == 1)
+		return;
+
+	for(f = 0; f <= 4; f++){
+		sum = 0;
+		for(i = 0; i < bytes; i++){
+			int a = i >= bpp ? row[i - bpp] : 0, b = up[i], c = i >= bpp ? up[i - bpp] : 0;
+			uint8_t v = row[i];
+
+			switch(f){
+				case 1: v -= a; break;
+				case 2: v -= b; break;
+				case 3: v -= (a + b) >> 1; break;
+				case 4: v -= paeth(a, b, c); break;
+			}
+			trial[i] = v;
+			sum += v < 128 ? v : 256 - v;
+		}
+		if(sum < best){
+			best = sum;
+			out[0] = f;
+			memcpy(out + 1, trial, bytes);
+		}
+	}
+}
+
+/* Filters and deflates the rows of a job, its lead rows priming the
+ * filters and the deflate history as if the stream had not been split */
+static void deflate_job(png_job_t *job, size_t row_bytes, size_t bpp){
+	size_t nrows = job->rows.size() / row_bytes, stride = row_bytes + 1, r, start;
+	std::vector<uint8_t> filtered(nrows * stride), trial(row_bytes), zero(row_bytes, 0);
+	z_stream zs;
+	int flush, ret;
+
+	/* With lead rows the first is only there to filter the second */
+	start = job->lead > 0 ? 1 : 0;
+	for(r = start; r < nrows; r++)
+		filter_row(&job->rows[r * row_bytes], r == 0 ? zero.data() : &job->rows[(r - 1) * row_bytes],
+				row_bytes, bpp, &filtered[r * stride], trial.data());
+
+	uint8_t *data = &filtered[job->lead * stride];
+	size_t history = (job->lead - start) * stride;
+	job->length = (nrows - job->lead) * stride;
+	job->adler = adler32(adler32(0, NULL, 0), data, job->length);
+
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+		job->error = ENOMEM;
+		return;
+	}
+	if(history > 0)
+		deflateSetDictionary(&zs, data - std::min(history, (size_t)PNG_WINDOW), std::min(history, (size_t)PNG_WINDOW));
+
+	/* The last chunk ends the stream, the rest end on a byte boundary */
+	flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+	job->out.resize(deflateBound(&zs, job->length) + 16);
+	zs.next_in = data;
+	zs.avail_in = job->length;
+	do{
+		if(zs.total_out == job->out.size())
+			job->out.resize(2 * job->out.size());
+		zs.next_out = &job->out[zs.total_out];
+		zs.avail_out = job->out.size() - zs.total_out;
+		ret = deflate(&zs, flush);
+	}while(ret == Z_OK && (zs.avail_out == 0 || zs.avail_in > 0));
+	job->out.resize(zs.total_out);
+	if(zs.avail_in > 0 || (job->last && ret != Z_STREAM_END))
+		job->error = ENOMEM;
+	deflateEnd(&zs);
+}
+
+/* Waits for the oldest job and writes its data as an IDAT chunk, with the
+ * zlib header before the first and the checksum after the last */
+static int retire_job(png_state_t *state, FILE *fd){
+	png_job_t *job = state->jobs.front();
+	std::vector<uint8_t> idat;
+	int success;
+
+	state->jobs.pop_front();
+	job->thread.join();
+	success = job->error;
+
+	if(success == 0){
+		if(state->first)
+			idat.insert(idat.end(), {0x78, 0x9c});
+		idat.insert(idat.end(), job->out.begin(), job->out.end());
+		state->adler = state->first ? job->adler : adler32_combine(state->adler, job->adler, job->length);
+		if(job->last){
+			idat.resize(idat.size() + 4);
+			put32(&idat[idat.size() - 4], state->adler);
+		}
+		state->first = false;
+		success = write_chunk(fd, "IDAT", idat.data(), idat.size());
+	}
+	delete job;
+	return success;
+}
+
+/* Hands the pending rows to a new job, keeping enough of them to prime
+ * the next, once too few jobs are running */
+static int start_job(png_state_t *state, FILE *fd, bool last){
+	png_job_t *job = new png_job_t();
+	size_t keep, nrows;
+	int success = 0;
+
+	while(state->jobs.size() >= state->threads && success == 0)
+		success = retire_job(state, fd);
+
+	job->rows = state->pending;
+	job->lead = state->lead;
+	job->last = last;
+	job->error = 0;
+	job->thread = std::thread(deflate_job, job, state->row_bytes, state->bpp);
+	state->jobs.push_back(job);
+
+	nrows = state->pending.size() / state->row_bytes;
+	keep = std::min(nrows, (PNG_WINDOW + state->row_bytes) / (state->row_bytes + 1) + 1);
+	state->pending.erase(state->pending.begin(), state->pending.end() - keep * state->row_bytes);
+	state->lead = keep;
+
+	return success;
+}
+
+/* Writes the signature and the chunks before the image data */
+static int begin_png(image_ctx_t *ctx, FILE *fd){
+	png_state_t *state = STATE(ctx);
+	static const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	uint8_t ihdr[13];
+	int success = 0;
+
+	state->bpp = state->type == IMAGE_PNG_RGB ? 3 : state->type == IMAGE_PNG_RGBA ? 4 : 1;
+	state->row_bytes = ctx->width * state->bpp;
+
+	put32(ihdr, ctx->width);
+	put32(ihdr + 4, ctx->height);
+	ihdr[8] = 8;			/* bits per sample */
+	ihdr[9] = state->type == IMAGE_PNG_RGB ? 2 : state->type == IMAGE_PNG_RGBA ? 6 : 3;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;	/* deflate, adaptive filtering, not interlaced */
+
+	if(fwrite(signature,1,8,fd) != 8)
+		return EPIPE;
+	success = write_chunk(fd, "IHDR", ihdr, sizeof(ihdr));
+
+	if(success == 0 && state->type == IMAGE_PNG_PALETTE){
+		std::vector<uint8_t> plte, trns;
+
+		for(uint32_t colour : state->palette){
+			plte.insert(plte.end(), {(uint8_t)(colour >> 16), (uint8_t)(colour >> 8), (uint8_t)colour});
+			trns.push_back(colour == 0xffffff ? 0 : 255);
+		}
+		success = write_chunk(fd, "PLTE", plte.data(), plte.size());
+		if(success == 0)
+			success = write_chunk(fd, "tRNS", trns.data(), trns.size());
+	}
+	state->started = true;
+	return success;
+}
+
+/* Adds drawn rows to the image being written, the last ending it */
+static int add_png_rows(image_ctx_t *ctx, FILE *fd, const uint8_t *rows, size_t count, bool last){
+	png_state_t *state = STATE(ctx);
+	size_t r, x, chunk_rows = std::max((size_t)PNG_CHUNK / (state->row_bytes + 1), (size_t)1);
+	int success = 0;
+
+	for(r = 0; r < count && success == 0; r++){
+		const uint8_t *px = rows + r * ctx->width * state->pixel;
+		size_t at = state->pending.size();
+
+		state->pending.resize(at + state->row_bytes);
+		uint8_t *out = &state->pending[at];
+		/* Rows drawn with their alpha are written as they are */
+		if(state->pixel == RGBA_SIZE)
+			memcpy(out, px, state->row_bytes);
+		else for(x = 0; x < ctx->width; x++, px += RGB_SIZE){
+			uint32_t colour = px[0] << 16 | px[1] << 8 | px[2];
+
+			switch(state->type){
+				case IMAGE_PNG_RGB:
+					memcpy(out, px, 3);
+					out += 3;
+					break;
+				case IMAGE_PNG_RGBA:
+					memcpy(out, px, 3);
+					out[3] = colour == 0xffffff ? 0 : 255;
+					out += 4;
+					break;
+				default:
+					*out++ = state->index[colour];
+			}
+		}
+		if(state->pending.size() / state->row_bytes - state->lead >= chunk_rows)
+			success = start_job(state, fd, last && r == count - 1);
+	}
+	if(success == 0 && last && state->pending.size() / state->row_bytes > state->lead)
+		success = start_job(state, fd, true);
+
+	/* Later jobs are still joined if one fails */
+	while(last && !state->jobs.empty()){
+		int retired = retire_job(state, fd);
+
+		if(success == 0)
+			success = retired;
+	}
+	if(success == 0 && last)
+		success = write_chunk(fd, "IEND", NULL, 0);
+	return success;
+}
+
+/* Writes rows as they come, the chunks before the image data before the
+ * first and those after it after the last */
+int png_write_rows(image_ctx_t *ctx, FILE* fd, const uint8_t *rows, const size_t count){
+	png_state_t *state = STATE(ctx);
+	int success = 0;
+
+	if(!state->started)
+		success = begin_png(ctx, fd);
+	if(success == 0)
+		success = add_png_rows(ctx, fd, rows, count, ctx->rows_done + count == ctx->height);
+	return success;
+}
+
+int png_write(image_ctx_t *ctx, FILE* fd){
+	png_state_t *state = STATE(ctx);
+	size_t i, count = ctx->width * ctx->height;
+
+	if(state->type == IMAGE_PNG_PALETTE){
+		for(i = 0; i < count && state->palette.size() <= 256; i++){
+			const uint8_t *px = ctx->canvas + i * RGB_SIZE;
+			uint32_t colour = px[0] << 16 | px[1] << 8 | px[2];
+
+			if(state->index.count(colour) == 0){
+				state->index[colour] = state->palette.size();
+				state->palette.push_back(colour);
+			}
+		}
+		if(state->palette.size() > 256){
+			fprintf(stderr,"Image has more than 256 colours, writing RGBA PNG\n");
+			state->type = IMAGE_PNG_RGBA;
+		}
+	}
+
+	int success = begin_png(ctx, fd);
+	if(success == 0)
+		success = add_png_rows(ctx, fd, ctx->canvas, ctx->height, true);
+	return success;
+}
+
+void png_free(image_ctx_t *ctx){
+	png_state_t *state = STATE(ctx);
+
+	if(state == NULL)
+		return;
+	for(png_job_t *job : state->jobs){
+		job->thread.join();
+		delete job;
+	}
+	delete state;
+	ctx->priv = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef _IMAGE_PNG_HH
+#define _IMAGE_PNG_HH
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "image.hh"
+
+int png_init(image_ctx_t *ctx);
+int png_add_pixel(image_ctx_t *ctx,const uint8_t r,const uint8_t g,const uint8_t b,const uint8_t a);
+int png_add_row(image_ctx_t *ctx,const uint8_t *row);
+int png_write(image_ctx_t *ctx, FILE* fd);
+int png_write_rows(image_ctx_t *ctx, FILE* fd, const uint8_t *rows, const size_t count);
+void png_free(image_ctx_t *ctx);
+
+image_dispatch_table_t png_dt = {\
+	.init 		= png_init, \
+	.add_pixel 	= png_add_pixel, \
+	.set_pixel	= NULL, \
+	.get_pixel	= NULL, \
+	.write		= png_write, \
+	.free		= png_free, \
+	.add_row	= png_add_row, \
+	.write_rows	= png_write_rows
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include "image.hh"
 
@@ -39,6 +40,13 @@ int ppm_add_pixel(image_ctx_t *ctx,const uint8_t r,const uint8_t g,const uint8_t
 	return 0;
 }
 
+int ppm_add_row(image_ctx_t *ctx,const uint8_t *row){
+	memcpy(ctx->next_pixel, row, ctx->width * RGB_SIZE);
+	ctx->next_pixel += ctx->width * RGB_SIZE;
+
+	return 0;
+}
+
 int ppm_get_pixel(image_ctx_t *ctx,const size_t x,const size_t y,const uint8_t *r,const uint8_t *g,const uint8_t *b,const uint8_t *a){
 	/* STUB */
 	return 0;
@@ -56,4 +64,17 @@ int ppm_write(image_ctx_t *ctx, FILE* fd){
 		return EPIPE;
 	
 	return 0;
-}
\ No newline at end of file
+}
+
+/* Writes rows as they come, the header before the first */
+int ppm_write_rows(image_ctx_t *ctx, FILE* fd, const uint8_t *rows, const size_t count){
+	size_t written;
+
+	if(ctx->rows_done == 0 && fprintf(fd, "P6\n%zu %zu\n255\n", ctx->width, ctx->height) < 0)
+		return EPIPE;
+	written = fwrite(rows,ctx->width * RGB_SIZE,count,fd);
+	if(written < count)
+		return EPIPE;
+
+	return 0;
+}
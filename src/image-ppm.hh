@@ -9,7 +9,9 @@
 int ppm_init(image_ctx_t *ctx);
 int ppm_add_pixel(image_ctx_t *ctx,const uint8_t r,const uint8_t g,const uint8_t b,const uint8_t a);
 int ppm_get_pixel(image_ctx_t *ctx,const size_t x,const size_t y,const uint8_t *r,const uint8_t *g,const uint8_t *b,const uint8_t *a);
+int ppm_add_row(image_ctx_t *ctx,const uint8_t *row);
 int ppm_write(image_ctx_t *ctx, FILE* fd);
+int ppm_write_rows(image_ctx_t *ctx, FILE* fd, const uint8_t *rows, const size_t count);
 
 image_dispatch_table_t ppm_dt = {\
 	.init 		= ppm_init, \
@@ -17,7 +19,9 @@ image_dispatch_table_t ppm_dt = {\
 	.set_pixel	= NULL, \
 	.get_pixel	= ppm_get_pixel, \
 	.write		= ppm_write, \
-	.free		= NULL
+	.free		= NULL, \
+	.add_row	= ppm_add_row, \
+	.write_rows	= ppm_write_rows
 };
 
 #endif
\ No newline at end of file
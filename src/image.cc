@@ -13,9 +13,11 @@
 #include <dlfcn.h>
 #include "image.hh"
 #include "image-ppm.hh"
+#include "image-png.hh"
 
 int get_dt(image_dispatch_table_t *dt, int format);
 int load_library(image_dispatch_table_t *dt);
+static int image_finish_stream(image_ctx_t *ctx);
 
 #define DISPATCH_TABLE(ctx) ((image_dispatch_table_t*)(ctx)->_dt)
 
@@ -102,12 +104,12 @@ int image_init(image_ctx_t *ctx, \
  * These functions simply wrap the underlying format-specific functions
  */
 int image_add_pixel(image_ctx_t *ctx, const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a){
-	if(ctx->initialized != 1) return EINVAL;
+	if(ctx->initialized != 1 || ctx->stream != NULL) return EINVAL;
 	return DISPATCH_TABLE(ctx)->add_pixel(ctx,r,g,b,a);
 }
 int image_set_pixel(image_ctx_t *ctx, const size_t x, const size_t y, const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a){
 	size_t block_size;
-	if(ctx->initialized != 1) return EINVAL;
+	if(ctx->initialized != 1 || ctx->stream != NULL) return EINVAL;
 	/* Image format handlers have the option to specify a _set_pixel handler */
 	if(DISPATCH_TABLE(ctx)->set_pixel != NULL){
 		return DISPATCH_TABLE(ctx)->set_pixel(ctx,x,y,r,g,b,a);
@@ -124,6 +126,8 @@ int image_get_pixel(image_ctx_t *ctx, const size_t x, const size_t y, const uint
 }
 int image_write(image_ctx_t *ctx, FILE *fd){
 	if(ctx->initialized != 1) return EINVAL;
+	if(ctx->stream != NULL)
+		return image_finish_stream(ctx);
 	return DISPATCH_TABLE(ctx)->write(ctx,fd);
 }
 void image_free(image_ctx_t *ctx){
@@ -134,6 +138,99 @@ void image_free(image_ctx_t *ctx){
 	if(ctx->canvas != NULL) free(ctx->canvas);
 }
 
+/*
+ * image_row
+ * Returns where row y starts in a plain RGB canvas kept here, so renderers
+ * may fill rows directly and from several threads at once, or NULL if the
+ * format keeps its canvas its own way and pixels must be added in order.
+ */
+uint8_t* image_row(image_ctx_t *ctx, const size_t y){
+	if(ctx->initialized != 1 || ctx->format == IMAGE_LIBRARY || ctx->model != IMAGE_RGB || ctx->canvas == NULL)
+		return NULL;
+	if(ctx->stream != NULL)
+		return NULL;
+	if(y >= ctx->height)
+		return NULL;
+	return ctx->canvas + PIXEL_OFFSET(0,y,ctx->width,RGB_SIZE);
+}
+
+/*
+ * image_add_rows
+ * Adds count whole rows of pixels, packed as the model says, after those
+ * added so far. Rows of a streamed image are written out there and then;
+ * the rest go to the canvas by row, or by pixel if the format has no
+ * add_row handler.
+ */
+int image_add_rows(image_ctx_t *ctx, const uint8_t *rows, const size_t count){
+	image_dispatch_table_t *dt = DISPATCH_TABLE(ctx);
+	size_t block_size, row, x;
+	const uint8_t *px;
+	int success = 0;
+
+	if(ctx->initialized != 1) return EINVAL;
+	if(ctx->rows_done + count > ctx->height) return EINVAL;
+	block_size = ctx->model == IMAGE_RGB ? RGB_SIZE : RGBA_SIZE;
+
+	if(ctx->stream != NULL){
+		success = dt->write_rows(ctx,ctx->stream,rows,count);
+		if(success == 0)
+			ctx->rows_done += count;
+		return success;
+	}
+
+	for(row = 0; row < count && success == 0; row++, ctx->rows_done++){
+		px = rows + row * ctx->width * block_size;
+		if(dt->add_row != NULL){
+			success = dt->add_row(ctx,px);
+			continue;
+		}
+		for(x = 0; x < ctx->width && success == 0; x++, px += block_size)
+			success = dt->add_pixel(ctx,px[0],px[1],px[2],block_size == RGBA_SIZE ? px[3] : 0xff);
+	}
+	return success;
+}
+
+/*
+ * image_stream
+ * Writes the rows of an image to fd as they are added by image_add_rows(),
+ * rather than holding them all in a canvas until image_write(), so an
+ * image of any size takes the memory of the rows in flight. The canvas is
+ * dropped, and pixels may no longer be added or set one at a time.
+ * Returns ENOSYS if the format cannot write rows as they come.
+ */
+int image_stream(image_ctx_t *ctx, FILE *fd){
+	if(ctx->initialized != 1 || fd == NULL) return EINVAL;
+	if(DISPATCH_TABLE(ctx)->write_rows == NULL) return ENOSYS;
+	if(ctx->rows_done != 0) return EINVAL;
+
+	if(ctx->canvas != NULL) free(ctx->canvas);
+	ctx->canvas = NULL;
+	ctx->next_pixel = NULL;
+	ctx->stream = fd;
+	return 0;
+}
+
+/* Writes out whatever rows of a streamed image were never added, blank as
+ * in a fresh canvas */
+static int image_finish_stream(image_ctx_t *ctx){
+	size_t block_size, count;
+	uint8_t *blank;
+	int success = 0;
+
+	block_size = ctx->model == IMAGE_RGB ? RGB_SIZE : RGBA_SIZE;
+	count = ctx->height - ctx->rows_done;
+	if(count > 0){
+		blank = (uint8_t*) calloc(count * ctx->width * block_size,sizeof(uint8_t));
+		if(blank == NULL)
+			return ENOMEM;
+		success = image_add_rows(ctx,blank,count);
+		free(blank);
+	}
+	if(success == 0 && fflush(ctx->stream) != 0)
+		success = EPIPE;
+	return success;
+}
+
 /*
  * image_get_filename
  * Creates an appropriate file name using data supplied
@@ -184,7 +281,7 @@ int image_get_filename(image_ctx_t *ctx, char *out, size_t len_out, char *in){
 /*
  * get_dt
  * Load the dispatch table for the specified image
- * format. Currently only pixmap supported.
+ * format: pixmap, PNG or an external library.
  */
 int get_dt(image_dispatch_table_t *dt, int format){
 	int success = 0;
@@ -194,6 +291,9 @@ int get_dt(image_dispatch_table_t *dt, int format){
 		case IMAGE_PPM:
 			*dt = ppm_dt;
 			break;
+		case IMAGE_PNG:
+			*dt = png_dt;
+			break;
 		case IMAGE_LIBRARY:
 			success = load_library(dt);
 			break;
@@ -272,6 +372,8 @@ int load_library(image_dispatch_table_t *dt){
 		dt->get_pixel = (_get_pixel*)dlsym(hndl,"lib_get_pixel");
 		dt->set_pixel = (_set_pixel*)dlsym(hndl,"lib_set_pixel");
 		dt->free = (_free*)dlsym(hndl,"lib_free");
+		dt->add_row = (_add_row*)dlsym(hndl,"lib_add_row");
+		dt->write_rows = (_write_rows*)dlsym(hndl,"lib_write_rows");
 	}
 
 	return success;
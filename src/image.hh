@@ -2,6 +2,7 @@
 #define _IMAGE_HH_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define RGB_SIZE  3
 #define RGBA_SIZE 4
@@ -9,9 +10,16 @@
 enum _image_format{	IMAGE_DEFAULT = 0, \
 					IMAGE_PPM, \
 					IMAGE_LIBRARY, \
+					IMAGE_PNG, \
 					IMAGE_FORMAT_MAX \
 				};
 
+/* How PNG images store what is drawn in RGB */
+enum _image_png{	IMAGE_PNG_RGB, \
+					IMAGE_PNG_RGBA, \
+					IMAGE_PNG_PALETTE \
+				};
+
 enum _image_model{	IMAGE_RGB, \
 					IMAGE_RGBA, \
 					IMAGE_MODEL_MAX
@@ -27,13 +35,18 @@ typedef struct _image_ctx{
 	uint32_t initialized;
 	char *extension;
 	void *_dt;
+	FILE *stream;		/* rows go straight here, see image_stream() */
+	size_t rows_done;	/* rows added so far by row */
+	void *priv;		/* format specific state */
 } image_ctx_t, *pimage_ctx_t;
 
 typedef int _init(image_ctx_t*);
 typedef int _add_pixel(image_ctx_t*,const uint8_t,const uint8_t,const uint8_t,const uint8_t);
 typedef int _set_pixel(image_ctx_t*,const size_t,const size_t,const uint8_t,const uint8_t,const uint8_t,const uint8_t);
 typedef int _get_pixel(image_ctx_t*,const size_t,const size_t,const uint8_t*,const uint8_t*,const uint8_t*,const uint8_t*);
+typedef int _add_row(image_ctx_t*,const uint8_t*);
 typedef int _write(image_ctx_t*,FILE*);
+typedef int _write_rows(image_ctx_t*,FILE*,const uint8_t*,const size_t);
 typedef void _free(image_ctx_t*);
 
 typedef struct _image_dispatch_table{
@@ -43,17 +56,23 @@ typedef struct _image_dispatch_table{
 	_get_pixel	*get_pixel;
 	_write		*write;
 	_free		*free;
+	_add_row	*add_row;
+	_write_rows	*write_rows;
 } image_dispatch_table_t;
 
 int image_set_format(int);
 int image_init(image_ctx_t*, const size_t, const size_t, const int, const int);
 int image_add_pixel(image_ctx_t* ctx, const uint8_t, const uint8_t, const uint8_t, const uint8_t);
 int image_set_pixel(image_ctx_t* ctx, const size_t, const size_t, const uint8_t, const uint8_t, const uint8_t, const uint8_t);
+uint8_t* image_row(image_ctx_t* ctx, const size_t);
 int image_get_pixel(image_ctx_t* ctx,const size_t,const size_t, uint8_t const*, uint8_t const*, uint8_t const*, uint8_t const*);
 int image_get_filename(image_ctx_t*, char*, size_t, char*);
+int image_add_rows(image_ctx_t* ctx, const uint8_t*, const size_t);
+int image_stream(image_ctx_t*, FILE*);
 int image_write(image_ctx_t*, FILE*);
 void image_free(image_ctx_t*);
 int image_set_library(char*);
+int image_set_png(int);
 
 #define ADD_PIXEL(ctx,r,g,b) image_add_pixel((ctx),(r),(g),(b),0xff)
 #define ADD_PIXELA(ctx,r,g,b,a) image_add_pixel((ctx),(r),(g),(b),(a))
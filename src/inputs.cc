@@ -1,16 +1,35 @@
 #include <bzlib.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <math.h>
 #include <spdlog/spdlog.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <zlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "catalog.hh"
 #include "common.hh"
 #include "main.hh"
+#include "geotiff.hh"
+#include "layout.hh"
+#include "mem.hh"
+#include "pages.hh"
+#include "pyramid.hh"
 #include "tiles.hh"
 
 #define BZBUFFER 65536
@@ -26,136 +45,220 @@ extern long bzbuf_pointer, bzbytes_read, gzbuf_pointer, gzbytes_read;
 
 extern double antenna_rotation, antenna_downtilt, antenna_dt_direction;
 
+/* Binary clutter raster: this header followed by nrows rows of ncols
+	 class bytes, north to south, so any row can be read with one seek. */
+#define CLUTTER_MAGIC "SSCLT01"
+
+struct clutter_header {
+	char magic[8];
+	int ncols, nrows;
+	double xll, yll, cellsize;
+};
+
+/* Nominal land cover heights in metres per MODIS class, taken from ITU-R P.452-11.
+	 Classes 0, 9, 10, 11, 15, 16 are treated as water (Water, savanna, grassland,
+	 wetland, snow, barren) */
+static const unsigned char clutter_heights[17] = {
+		0,  20, 20, 15, 15, 15,  // evergreen, evergreen, deciduous, deciduous, mixed
+		4,  2,  4,  2,  2,       // woody shrublands & savannas, shrublands, savannas
+		0,  2,  20, 2,  0,  0    // croplands, urban
+};
+
+static int convertClutter(char *filename, char *binfile)
+{
+	/* Converts a MODIS 17-class clutter file in ASCII Grid format into
+		 the binary clutter raster `binfile`. Returns 0 or an errno. */
+
+	struct clutter_header hdr;
+	char key[32], *line = NULL, *p, *end, tmpfile[PATH_MAX + 16];
+	size_t len = 0;
+	double value;
+	int x, y;
+	FILE *fd, *out;
+
+	if ((fd = fopen(filename, "rb")) == NULL) return errno;
+
+	memset(&hdr, 0, sizeof(hdr));
+	strcpy(hdr.magic, CLUTTER_MAGIC);
+
+	/* Header lines are "key value" pairs, the grid starts with the first number */
+	long datastart = ftell(fd);
+	while (getline(&line, &len, fd) != -1 && sscanf(line, "%31s %lf", key, &value) == 2 && isalpha(key[0])) {
+		if (strcasecmp(key, "ncols") == 0) hdr.ncols = (int)value;
+		if (strcasecmp(key, "nrows") == 0) hdr.nrows = (int)value;
+		if (strcasecmp(key, "xllcorner") == 0 || strcasecmp(key, "xllcenter") == 0) hdr.xll = value;
+		if (strcasecmp(key, "yllcorner") == 0 || strcasecmp(key, "yllcenter") == 0) hdr.yll = value;
+		if (strcasecmp(key, "cellsize") == 0) hdr.cellsize = value;
+		datastart = ftell(fd);
+	}
+
+	if (hdr.ncols <= 0 || hdr.nrows <= 0 || hdr.cellsize <= 0) {
+		spdlog::error("Error loading clutter file, invalid header {} x {} cellsize {}", hdr.ncols, hdr.nrows, hdr.cellsize);
+		free(line);
+		fclose(fd);
+		return EINVAL;
+	}
+
+	spdlog::debug("Converting clutter file \"{}\" {} x {}...", filename, hdr.ncols, hdr.nrows);
+
+	snprintf(tmpfile, sizeof(tmpfile), "%s.%d", binfile, (int)getpid());
+	if ((out = fopen(tmpfile, "wb")) == NULL) {
+		free(line);
+		fclose(fd);
+		return errno;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	unsigned char *row = (unsigned char *)calloc(hdr.ncols, 1);
+	fseek(fd, datastart, SEEK_SET);
+	for (y = 0; y < hdr.nrows; y++) {
+		memset(row, 0, hdr.ncols);
+		if (getline(&line, &len, fd) == -1) {
+			spdlog::error("Clutter error @ y {}", y);
+		}
+		else {
+			for (p = line, x = 0; x < hdr.ncols; x++, p = end) {
+				long z = strtol(p, &end, 10);
+				if (end == p) break;
+				row[x] = z > 0 && z < 256 ? z : 0;
+			}
+		}
+		fwrite(row, 1, hdr.ncols, out);
+	}
+	free(row);
+	free(line);
+	fclose(fd);
+
+	if (fclose(out) != 0 || rename(tmpfile, binfile) != 0) {
+		int err = errno;
+		unlink(tmpfile);
+		return err;
+	}
+	return 0;
+}
+
 int loadClutter(char *filename, double radius, struct site tx)
 {
-	/* This function reads a MODIS 17-class clutter file in ASCII Grid format.
+	/* This function applies a MODIS 17-class clutter file in ASCII Grid format.
 		 The nominal heights it applies to each value, eg. 5 (Mixed forest) = 15m are
 		 taken from ITU-R P.452-11.
-		 It doesn't have it's own matrix, instead it boosts the DEM matrix like point clutter
-		 AddElevation(lat, lon, height);
-			If tiles are standard 2880 x 3840 then cellsize is constant at 0.004166
-	 */
-	int x, y, z, h = 0, w = 0;
-	double clh, xll, yll, cellsize, cellsize2, xOffset, yOffset, lat, lon;
-	char line[100000];
-	char *s, *pch = NULL;
-	FILE *fd;
+		 The heights go into the clutter layer of each DEM page, which is
+		 added to the terrain as path profiles are read. The grid is converted once into a binary raster next to the source file
+		 (<file>.bin) and only the rows and columns within radius degrees of the
+		 transmitter are read from it. Every DEM pixel then takes the height of
+		 the clutter cell it falls in. */
 
-	if ((fd = fopen(filename, "rb")) == NULL) return errno;
+	struct clutter_header hdr;
+	struct stat src_st, bin_st;
+	char binfile[PATH_MAX];
+	int fd, r, c, x, y, indx, result;
 
-	if (fgets(line, 19, fd) != NULL) {
-		pch = strtok(line, " ");
-		pch = strtok(NULL, " ");
-		w = atoi(pch);
-	}
+	snprintf(binfile, sizeof(binfile), "%s.bin", filename);
 
-	if (fgets(line, 19, fd) != NULL) {
-		pch = strtok(line, " ");
-		pch = strtok(NULL, " ");
-		h = atoi(pch);
+	if (stat(filename, &src_st) != 0) return errno;
+
+	if (stat(binfile, &bin_st) != 0 || bin_st.st_mtime < src_st.st_mtime) {
+		if ((result = convertClutter(filename, binfile)) != 0) {
+			spdlog::error("Error converting clutter file \"{}\" to \"{}\": {}", filename, binfile, strerror(result));
+			return result;
+		}
 	}
 
-	if (w == 2880 && h == 3840) {
-		cellsize = 0.004167;
-		cellsize2 = cellsize * 3;
+	if ((fd = open(binfile, O_RDONLY)) < 0) return errno;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || strcmp(hdr.magic, CLUTTER_MAGIC) != 0) {
+		spdlog::error("Error loading clutter file, \"{}\" is not a clutter raster", binfile);
+		close(fd);
+		return EINVAL;
 	}
-	else {
-		spdlog::error("Error Loading clutter file, unsupported resolution {} x {}.", w, h);
-		return 0;  // can't work with this yet
+
+	/* Window of cells covering the plot, rows counted from the north */
+	double tx_east = tx.lon > 180 ? 360 - tx.lon : -tx.lon;
+	int r0 = MAX((int)floor((hdr.yll + hdr.nrows * hdr.cellsize - (tx.lat + radius)) / hdr.cellsize), 0);
+	int r1 = std::min((int)floor((hdr.yll + hdr.nrows * hdr.cellsize - (tx.lat - radius)) / hdr.cellsize), hdr.nrows - 1);
+	int c0 = MAX((int)floor((tx_east - radius - hdr.xll) / hdr.cellsize), 0);
+	int c1 = std::min((int)floor((tx_east + radius - hdr.xll) / hdr.cellsize), hdr.ncols - 1);
+
+	if (r0 > r1 || c0 > c1) {
+		spdlog::debug("Clutter file \"{}\" does not cover the plot", filename);
+		close(fd);
+		return 0;
 	}
 
-	spdlog::debug("Loading clutter file \"{}\" {} x {}...", filename, w, h);
+	int rows = r1 - r0 + 1, cols = c1 - c0 + 1;
+	std::vector<unsigned char> window(rows * cols);
 
-	if (fgets(line, 25, fd) != NULL) {
-		sscanf(pch, "%lf", &xll);
+	spdlog::debug("Loading clutter file \"{}\" rows {}-{} cols {}-{}...", filename, r0, r1, c0, c1);
+
+	for (r = 0; r < rows; r++) {
+		off_t offset = sizeof(hdr) + (off_t)(r0 + r) * hdr.ncols + c0;
+		if (pread(fd, &window[r * cols], cols, offset) != cols) {
+			spdlog::error("Clutter error @ row {}", r0 + r);
+			close(fd);
+			return EIO;
+		}
 	}
+	close(fd);
 
-	s = fgets(line, 25, fd);
-	if (fgets(line, 25, fd) != NULL) {
-		sscanf(pch, "%lf", &yll);
+	/* Turn classes into heights and clear the near field */
+	int tx_r = (int)floor((hdr.yll + hdr.nrows * hdr.cellsize - tx.lat) / hdr.cellsize) - r0;
+	int tx_c = (int)floor((tx_east - hdr.xll) / hdr.cellsize) - c0;
+
+	for (r = 0; r < rows; r++) {
+		for (c = 0; c < cols; c++) {
+			unsigned char z = window[r * cols + c];
+			window[r * cols + c] = z < 17 && (abs(r - tx_r) > 3 || abs(c - tx_c) > 3) ? clutter_heights[z] : 0;
+		}
 	}
 
-	spdlog::debug("xll {:.2f} yll {:.2f}", xll, yll);
+	/* One pass over every page pixel under the window, so every page
+		 has to be in memory first */
+	if ((result = pages_finish()) != 0) return result;
 
-	s = fgets(line, 25, fd);  // cellsize
+	alloc_clutter();
 
-	if (s)
-		;
+	std::vector<int> cell_col(ippd);
+	for (indx = 0; indx < MAXPAGES && dem[indx].max_north != -90; indx++) {
+		for (y = 0; y <= mpi; y++) {
+			double west = dem[indx].max_west - (mpi - y) / yppd;
+			double east = west > 180 ? 360 - west : -west;
+			cell_col[y] = (int)floor((east - hdr.xll) / hdr.cellsize) - c0;
+		}
 
-	// loop over matrix
-	for (y = h; y > 0; y--) {
-		x = 0;
-		if (fgets(line, sizeof(line) - 1, fd) != NULL) {
-			pch = strtok(line, " ");
-			while (pch != NULL && x < w) {
-				z = atoi(pch);
-				// Apply ITU-R P.452-11
-				// Treat classes 0, 9, 10, 11, 15, 16 as water, (Water, savanna, grassland, wetland, snow, barren)
-				clh = 0.0;
-
-				// evergreen, evergreen, urban
-				if (z == 1 || z == 2 || z == 13) clh = 20.0;
-				// deciduous, deciduous, mixed
-				if (z == 3 || z == 4 || z == 5) clh = 15.0;
-				// woody shrublands & savannas
-				if (z == 6 || z == 8) clh = 4.0;
-				// shrublands, savannas, croplands...
-				if (z == 7 || z == 9 || z == 10 || z == 12 || z == 14) clh = 2.0;
-
-				if (clh > 1) {
-					xOffset = x * cellsize;  // 12 deg wide
-					yOffset = y * cellsize;  // 16 deg high
-
-					// make all longitudes positive
-					if (xll + xOffset > 0) {
-						lon = 360 - (xll + xOffset);
-					}
-					else {
-						lon = (xll + xOffset) * -1;
-					}
-					lat = yll + yOffset;
-
-					// bounding box
-					if (lat > tx.lat - radius && lat < tx.lat + radius && lon > tx.lon - radius && lon < tx.lon + radius) {
-						// not in near field
-						if ((lat > tx.lat + cellsize2 || lat < tx.lat - cellsize2) ||
-								(lon > tx.lon + cellsize2 || lon < tx.lon - cellsize2)) {
-							AddElevation(lat, lon, clh, 2);
-						}
-					}
-				}
+		for (x = 0; x <= mpi; x++) {
+			double lat = dem[indx].min_north + x / ppd;
+			r = (int)floor((hdr.yll + hdr.nrows * hdr.cellsize - lat) / hdr.cellsize) - r0;
+			if (r < 0 || r >= rows) continue;
 
-				x++;
-				pch = strtok(NULL, " ");
-			}  // while
+			const unsigned char *cells = &window[r * cols];
+			for (y = 0; y <= mpi; y++) {
+				c = cell_col[y];
+				if (c >= 0 && c < cols) dem[indx].clutter[0][page_cell(x, y)] = cells[c];
+			}
 		}
-		else {
-			spdlog::error("Clutter error @ x {} y {}", x, y);
-		}  // if
-	}    // for
+	}
 
-	fclose(fd);
 	return 0;
 }
 
-int averageHeight(int height, int width, int x, int y)
+int averageHeight(const short *below, const short *above, int x)
 {
 	int total = 0;
 	int c = 0;
-	if (dem[0].data[y - 1][x - 1] > 0) {
-		total += dem[0].data[y - 1][x - 1];
+	if (below[x - 1] > 0) {
+		total += below[x - 1];
 		c++;
 	}
-	if (dem[0].data[y + 1][x + 1] > 0) {
-		total += dem[0].data[y + 1][x + 1];
+	if (above[x + 1] > 0) {
+		total += above[x + 1];
 		c++;
 	}
-	if (dem[0].data[y - 1][x + 1] > 0) {
-		total += dem[0].data[y - 1][x + 1];
+	if (below[x + 1] > 0) {
+		total += below[x + 1];
 		c++;
 	}
-	if (dem[0].data[y + 1][x - 1] > 0) {
-		total += dem[0].data[y + 1][x - 1];
+	if (above[x - 1] > 0) {
+		total += above[x - 1];
 		c++;
 	}
 
@@ -167,11 +270,59 @@ int averageHeight(int height, int width, int x, int y)
 	}
 }
 
-int loadLIDAR(char *filenames, int resample)
+#define FILL_BAND 256
+
+static void fillHoles(size_t height, size_t width)
+{
+	/* Fills the voids (<= 0) of the lidar super tile from the diagonal
+		 neighbours, north to south and east to west. The grid is cut into
+		 fixed bands of FILL_BAND rows that are filled concurrently; a band
+		 sees the unfilled edge rows of its neighbours, so the result does
+		 not depend on the number of threads. */
+
+	if (height < 3 || width < 3) return;
+
+	size_t nbands = (height - 2 + FILL_BAND - 1) / FILL_BAND;
+	std::vector<short> edges(nbands * 2 * width);
+
+	/* Snapshot the rows just outside every band before anyone writes */
+	for (size_t b = 0; b < nbands; b++) {
+		size_t lo = 1 + b * FILL_BAND;
+		size_t hi = std::min(lo + FILL_BAND - 1, height - 2);
+		memcpy(&edges[(2 * b) * width], dem[0].data[lo - 1], width * sizeof(short));
+		memcpy(&edges[(2 * b + 1) * width], dem[0].data[hi + 1], width * sizeof(short));
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t b;
+		while ((b = next++) < nbands) {
+			size_t lo = 1 + b * FILL_BAND;
+			size_t hi = std::min(lo + FILL_BAND - 1, height - 2);
+			for (size_t y = hi; y >= lo; y--) {
+				const short *below = y == lo ? &edges[(2 * b) * width] : dem[0].data[y - 1];
+				const short *above = y == hi ? &edges[(2 * b + 1) * width] : dem[0].data[y + 1];
+				short *row = dem[0].data[y];
+				for (size_t x = width - 2; x > 0; x--) {
+					if (row[x] <= 0) row[x] = averageHeight(below, above, x);
+				}
+			}
+		}
+	};
+
+	size_t nthreads = std::min((size_t)MAX(std::thread::hardware_concurrency(), 1u), nbands);
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < nthreads; t++) threads.push_back(std::thread(worker));
+	worker();
+	for (auto &th : threads) th.join();
+}
+
+int loadLIDAR(char *filenames, int resample, bbox *window)
 {
 	char *filename;
-	char *files[900];  // 20x20=400, 16x16=256 tiles
-	int indx = 0, fc = 0, success;
+	std::vector<std::string> files;
+	int indx = 0, fc = 0, nfiles, success;
+	struct stat st;
 	double avgCellsize = 0, smCellsize = 0;
 	tile_t *tiles;
 
@@ -179,13 +330,28 @@ int loadLIDAR(char *filenames, int resample)
 	min_west = 361;  // any value will be lower than this
 	max_west = 0;    // any value will be higher than this
 
-	// test for multiple files
+	// test for multiple files. Directories give the tiles their catalog
+	// lists under the plot
 	filename = strtok(filenames, " ,");
 	while (filename != NULL) {
-		files[fc] = filename;
+		if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+			catalog_t catalog;
+			std::vector<const catalog_entry_t *> found;
+
+			if ((success = catalog_open(&catalog, filename)) != 0) {
+				spdlog::error("Could not read LIDAR directory {}", filename);
+				return success;
+			}
+			catalog_query(&catalog, window, CAT_LIDAR, found);
+			spdlog::info("{} of {} tiles in {} cover the plot", found.size(), catalog.entries.size(), filename);
+
+			for (auto e : found) files.push_back(catalog.dir + e->name);
+		}
+		else
+			files.push_back(filename);
 		filename = strtok(NULL, " ,");
-		fc++;
 	}
+	fc = files.size();
 
 	/* Allocate the tile array */
 	if ((tiles = (tile_t *)calloc(fc + 1, sizeof(tile_t))) == NULL) {
@@ -193,16 +359,34 @@ int loadLIDAR(char *filenames, int resample)
 		return ENOMEM;
 	}
 
-	/* Load each tile in turn */
-	for (indx = 0; indx < fc; indx++) {
+	/* Pyramids are read at the overview nearest the resampled resolution,
+		 which is then only rescaled by what is left */
+	int level = resample > 1 ? (int)log2(resample) : 0;
+
+	/* Load each tile in turn. GeoTIFFs only load the part under the plot,
+		 and are left out if they miss it */
+	nfiles = fc;
+	for (int f = 0; f < nfiles; f++) {
+		char *file = &files[f][0];
+
 		/* Grab the tile metadata */
-		if ((success = tile_load_lidar(&tiles[indx], files[indx])) != 0) {
-			spdlog::error("Failed to load LIDAR tile {}", files[indx]);
+		if (strstr(file, ".sdp") != NULL)
+			success = tile_load_pyramid(&tiles[indx], file, level);
+		else if (strstr(file, ".tif") != NULL)
+			success = tile_load_geotiff(&tiles[indx], file, window);
+		else
+			success = tile_load_lidar(&tiles[indx], file);
+		if (success == ENODATA) {
+			spdlog::debug("\"{}\" does not cover the plot, skipping it", file);
+			continue;
+		}
+		if (success != 0) {
+			spdlog::error("Failed to load LIDAR tile {}", file);
 			free(tiles);
 			return success;
 		}
 
-		spdlog::debug("Loading \"{}\" into page {} with width {}...", files[indx], indx, tiles[indx].width);
+		spdlog::debug("Loading \"{}\" into page {} with width {}...", file, indx, tiles[indx].width);
 
 		// Increase the "average" cell size
 		avgCellsize += tiles[indx].cellsize;
@@ -234,14 +418,24 @@ int loadLIDAR(char *filenames, int resample)
 		}
 		// Handle tile with 360 XUR
 		if (min_west > 359) min_west = 0.0;
+
+		indx++;
+	}
+	fc = indx;
+
+	if (fc == 0) {
+		spdlog::error("None of the LIDAR tiles cover the plot");
+		free(tiles);
+		return ENODATA;
 	}
 
 	/* Iterate through all of the tiles to find the smallest resolution. We will
 	 * need to rescale every tile from here on out to this value */
 	float smallest_res = 0;
 	for (size_t i = 0; i < (unsigned)fc; i++) {
-		if (smallest_res == 0 || tiles[i].resolution < smallest_res) {
-			smallest_res = tiles[i].resolution;
+		float full_res = tiles[i].resolution / (1 << tiles[i].level);
+		if (smallest_res == 0 || full_res < smallest_res) {
+			smallest_res = full_res;
 		}
 	}
 
@@ -255,16 +449,26 @@ int loadLIDAR(char *filenames, int resample)
 
 	// Don't resize large 1 deg tiles in large multi-degree plots as it gets messy
 	if (tiles[0].width != 3600) {
+		/* Tiles are resampled concurrently, sharing the cores between them */
+		std::vector<std::future<int>> rescales;
+		int cores = MAX(std::thread::hardware_concurrency(), 1u);
+		int threads = MAX(cores / fc, 1);
 		for (size_t i = 0; i < (unsigned)fc; i++) {
 			float rescale = tiles[i].resolution / (float)desired_resolution;
 			spdlog::debug("res {:.5f} desired_res {:.5f}", tiles[i].resolution, (float)desired_resolution);
 			if (rescale != 1) {
-				if ((success = tile_rescale(&tiles[i], rescale) != 0)) {
-					spdlog::error("Error resampling tiles");
-					return success;
-				}
+				rescales.push_back(std::async(std::launch::async, tile_rescale, &tiles[i], rescale, threads));
 			}
 		}
+		success = 0;
+		for (auto &r : rescales) {
+			int result = r.get();
+			if (result != 0) success = result;
+		}
+		if (success != 0) {
+			spdlog::error("Error resampling tiles");
+			return success;
+		}
 	}
 
 	/* Now we work out the size of the giant lidar tile. */
@@ -276,6 +480,9 @@ int loadLIDAR(char *filenames, int resample)
 	spdlog::debug("totalh: {:.7f} - {:.7f} = {:.7f} totalw: {:.7f} - {:.7f} = {:.7f} fc: {}", max_north, min_north, total_height,
 								max_west, min_west, total_width, fc);
 
+	// the squaring tiles added below are not ours to free
+	int real_fc = fc;
+
 	// detect problematic layouts eg. vertical rectangles
 	//  1x2
 	if (fc >= 2 && desired_resolution < 28 && total_height > total_width * 1.5) {
@@ -331,55 +538,27 @@ int loadLIDAR(char *filenames, int resample)
 
 		spdlog::debug("north_pixel_offset {} west_pixel_offset {}, {} x {}", north_pixel_offset, west_pixel_offset, new_height,
 									new_width);
-
-		// sanity check!
-		if (new_width > 39e3 || new_height > 39e3) {
-			spdlog::error("Not processing a tile with these dimensions: {} x {}", new_width, new_height);
-			exit(1);
-		}
 	}
 
-	size_t new_tile_alloc = new_width * new_height;
-	short *new_tile = (short *)calloc(new_tile_alloc, sizeof(short));
+	/* The tiles are joined into one square page. Unless it is spilled to
+		 disk (-ooc), its terrain has to fit in memory */
+	size_t side = MAX(new_width, new_height);
+	size_t terrain = side * side * sizeof(short);
+	size_t memory = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
 
-	if (new_tile == NULL) {
-		spdlog::error("Could not allocate {} bytes", new_tile_alloc);
+	if (side > INT_MAX / 2 || (!mem_spilling() && terrain > memory)) {
+		if (side > INT_MAX / 2)
+			spdlog::error("Not processing a tile with these dimensions: {} x {}", new_width, new_height);
+		else
+			spdlog::error("A {} x {} tile needs {} MB, more than the {} MB of memory here. Use -ooc to spill it to disk",
+										new_width, new_height, terrain >> 20, memory >> 20);
+		for (int i = 0; i < real_fc; i++) tile_destroy(&tiles[i]);
 		free(tiles);
-		return ENOMEM;
+		return side > INT_MAX / 2 ? EFBIG : ENOMEM;
 	}
 
 	spdlog::debug("Lidar tile dimensions w:{} ({}) h:{} ({})", total_width, new_width, total_height, new_height);
 
-	/* ...If we wanted a value other than sea level here, we would
-		 need to initialize the array... */
-
-	/* Fill out the array one tile at a time */
-	for (size_t i = 0; i < (unsigned)fc; i++) {
-		double north_offset = max_north - tiles[i].max_north;
-		double west_offset =
-				max_west - tiles[i].max_west >= 0 ? max_west - tiles[i].max_west : max_west + (360 - tiles[i].max_west);
-		size_t north_pixel_offset = north_offset * tiles[i].ppdy;
-		size_t west_pixel_offset = west_offset * tiles[i].ppdx;
-
-		spdlog::debug("mn: {} mw: {} globals: {} {}", tiles[i].max_north, tiles[i].max_west, max_north, max_west);
-		spdlog::debug("Offset n:{} ({}) w:{} ({})", north_pixel_offset, north_offset, west_pixel_offset, west_offset);
-		spdlog::debug("Height: {}", tiles[i].height);
-
-		/* Copy it row-by-row from the tile */
-		for (size_t h = 0; h < (unsigned)tiles[i].height; h++) {
-			register short *dest_addr = &new_tile[(north_pixel_offset + h) * new_width + west_pixel_offset];
-			register short *src_addr = &tiles[i].data[h * tiles[i].width];
-			// Check if we might overflow
-			if (dest_addr + tiles[i].width > new_tile + new_tile_alloc || dest_addr < new_tile) {
-				if (debug) {
-					spdlog::error("Overflow {}", i);
-				}
-				continue;
-			}
-			memcpy(dest_addr, src_addr, tiles[i].width * sizeof(short));
-		}
-	}
-
 	// SUPER tile
 	MAXPAGES = 1;
 	IPPD = MAX(new_width, new_height);
@@ -387,6 +566,7 @@ int loadLIDAR(char *filenames, int resample)
 
 	ARRAYSIZE = (MAXPAGES * IPPD) + 10;
 	do_allocs();
+	alloc_page(0);
 
 	height = new_height;
 	width = new_width;
@@ -401,46 +581,110 @@ int loadLIDAR(char *filenames, int resample)
 	dem[0].max_el = max_elevation;
 	dem[0].min_el = min_elevation;
 
+	/* ...alloc_page() leaves the layers zeroed, so areas no tile covers
+		 are at sea level... */
+
 	/*
-	 * Copy the lidar tile data into the dem array. The dem array is then rotated
-	 * 90 degrees(!)...it's a legacy thing.
+	 * Copy each lidar tile straight into the dem array. The dem array is
+	 * rotated 180 degrees relative to the tile (rows run south to north and
+	 * columns east to west)...it's a legacy thing. Each tile row therefore
+	 * lands reversed in a single dem row.
 	 */
-	int y = new_height - 1;
-	for (size_t h = 0; h < new_height; h++, y--) {
-		int x = new_width - 1;
-		for (size_t w = 0; w < new_width; w++, x--) {
-			dem[0].data[y][x] = new_tile[h * new_width + w];
-			dem[0].signal[y][x] = 0;
-			dem[0].mask[y][x] = 0;
-		}
-	}
+	for (size_t i = 0; i < (unsigned)fc; i++) {
+		double north_offset = max_north - tiles[i].max_north;
+		double west_offset =
+				max_west - tiles[i].max_west >= 0 ? max_west - tiles[i].max_west : max_west + (360 - tiles[i].max_west);
+		size_t north_pixel_offset = north_offset * tiles[i].ppdy;
+		size_t west_pixel_offset = west_offset * tiles[i].ppdx;
 
-	// Polyfilla for warped tiles
-	y = new_height - 2;
-	for (size_t h = 0; h < new_height - 2; h++, y--) {
-		int x = new_width - 2;
-		for (size_t w = 0; w < new_width - 2; w++, x--) {
-			if (dem[0].data[y][x] <= 0) {
-				dem[0].data[y][x] = averageHeight(new_height, new_width, x, y);
+		spdlog::debug("mn: {} mw: {} globals: {} {}", tiles[i].max_north, tiles[i].max_west, max_north, max_west);
+		spdlog::debug("Offset n:{} ({}) w:{} ({})", north_pixel_offset, north_offset, west_pixel_offset, west_offset);
+		spdlog::debug("Height: {}", tiles[i].height);
+
+		for (size_t h = 0; h < (unsigned)tiles[i].height; h++) {
+			// Check if we might overflow
+			if (north_pixel_offset + h >= new_height || west_pixel_offset + tiles[i].width > new_width) {
+				if (debug) {
+					spdlog::error("Overflow {}", i);
+				}
+				continue;
 			}
+			short *src_addr = &tiles[i].data[h * tiles[i].width];
+			short *dest_addr = &dem[0].data[new_height - 1 - north_pixel_offset - h][new_width - west_pixel_offset];
+			for (int w = 0; w < tiles[i].width; w++) *--dest_addr = src_addr[w];
 		}
+
+		// The squaring tiles borrow the data of the last real tile, so keep that one until the end
+		if (i < (unsigned)real_fc - 1) tile_destroy(&tiles[i]);
 	}
-	if (width > 3600 * 8) {
-		spdlog::error("DEM fault. Contact system administrator: {}", width);
-		exit(1);
-	}
+	tile_destroy(&tiles[real_fc - 1]);
+
+	// Polyfilla for warped tiles
+	fillHoles(new_height, new_width);
 
 	spdlog::debug("LIDAR LOADED {} x {}", width, height);
 	spdlog::debug("fc {} WIDTH {} HEIGHT {} ippd {} minN {:.5f} maxN {:.5f} minW {:.5f} maxW {:.5f} avgCellsize {:.5f}", fc,
 								width, height, ippd, min_north, max_north, min_west, max_west, avgCellsize);
 
-	if (tiles != NULL)
-		for (size_t i = 0; i < (unsigned)fc - 1; i++) tile_destroy(&tiles[i]);
 	free(tiles);
 
 	return 0;
 }
 
+/* Catalogs of the working directory and sdf_path, opened on first use */
+static catalog_t sdf_catalogs[2];
+static int sdf_catalog_count = -1;
+
+static int FindSDF(const char *file, char *path_plus_name, size_t size)
+{
+	/* Looks a DEM file up in the catalogs of the current working
+		 directory, then of the SDF path, the order the loaders have
+		 always searched them in, so missing files cost no failed
+		 opens.  Returns 0 with the path in path_plus_name, or ENOENT */
+
+	if (sdf_catalog_count < 0) {
+		sdf_catalog_count = 0;
+		if (catalog_open(&sdf_catalogs[sdf_catalog_count], "") == 0) sdf_catalog_count++;
+		if (sdf_path[0] && catalog_open(&sdf_catalogs[sdf_catalog_count], sdf_path) == 0) sdf_catalog_count++;
+	}
+
+	for (int i = 0; i < sdf_catalog_count; i++) {
+		if (catalog_find(&sdf_catalogs[i], file) != NULL) {
+			snprintf(path_plus_name, size, "%s%s", sdf_catalogs[i].dir.c_str(), file);
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+static int ClaimPage(int minlat, int maxlat, int minlon, int maxlon)
+{
+	/* Returns the dem page to load a region into, its layers
+		 allocated, or -1 if the region is in memory already or no
+		 page is free.  While the residency manager reads back the
+		 terrain of an evicted page, that page is the one returned */
+
+	int indx;
+
+	if ((indx = pages_reloading()) >= 0) return indx;
+
+	for (indx = 0; indx < MAXPAGES; indx++) {
+		if (minlat == dem[indx].min_north && minlon == dem[indx].min_west && maxlat == dem[indx].max_north &&
+				maxlon == dem[indx].max_west)
+			return -1;
+	}
+
+	for (indx = 0; indx < MAXPAGES && dem[indx].max_north != -90; indx++)
+		;
+
+	if (indx == MAXPAGES) return -1;
+
+	if (dem[indx].data == NULL) alloc_page(indx);
+
+	return indx;
+}
+
 int LoadSDF_SDF(char *name)
 {
 	/* This function reads uncompressed ss Data Files (.sdf)
@@ -450,8 +694,8 @@ int LoadSDF_SDF(char *name)
 		 dem[] structure.
 		 NOTE: On error, this function returns a negative errno */
 
-	int x, y, data = 0, indx, minlat, minlon, maxlat, maxlon, j;
-	char found, free_page = 0, line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX];
+	int x, y, data = 0, indx, minlat, minlon, maxlat, maxlon, j, success;
+	char line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX];
 
 	FILE *fd;
 
@@ -469,39 +713,18 @@ int LoadSDF_SDF(char *name)
 	sdf_file[x + 3] = 'f';
 	sdf_file[x + 4] = 0;
 
-	/* Is it already in memory? */
+	/* Is it already in memory, or is room available to load it? */
 
-	for (indx = 0, found = 0; indx < MAXPAGES && found == 0; indx++) {
-		if (minlat == dem[indx].min_north && minlon == dem[indx].min_west && maxlat == dem[indx].max_north &&
-				maxlon == dem[indx].max_west)
-			found = 1;
-	}
-
-	/* Is room available to load it? */
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
 
-	if (found == 0) {
-		for (indx = 0, free_page = 0; indx < MAXPAGES && free_page == 0; indx++)
-			if (dem[indx].max_north == -90) free_page = 1;
-	}
+	if (indx >= 0) {
+		/* Search for SDF file in current working directory first,
+			 then in the path specified in $HOME/.ss_path file or by
+			 -d argument */
 
-	indx--;
+		if ((success = FindSDF(sdf_file, path_plus_name, sizeof(path_plus_name))) != 0) return -success;
 
-	if (free_page && found == 0 && indx >= 0 && indx < MAXPAGES) {
-		/* Search for SDF file in current working directory first */
-
-		strncpy(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
-
-		if ((fd = fopen(path_plus_name, "rb")) == NULL) {
-			/* Next, try loading SDF file from path specified
-				 in $HOME/.ss_path file or by -d argument */
-
-			strncpy(path_plus_name, sdf_path, sizeof(path_plus_name) - 1);
-			strncat(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
-            //spdlog::debug("Trying to load SDF file {}", path_plus_name);
-			if ((fd = fopen(path_plus_name, "rb")) == NULL) {
-				return -errno;
-			}
-		}
+		if ((fd = fopen(path_plus_name, "rb")) == NULL) return -errno;
 
 		spdlog::debug("Loading SDF \"{}\" into page {}...", path_plus_name, indx + 1);
 
@@ -537,8 +760,6 @@ int LoadSDF_SDF(char *name)
 				}
 
 				dem[indx].data[x][y] = data;
-				dem[indx].signal[x][y] = 0;
-				dem[indx].mask[x][y] = 0;
 
 				if (data > dem[indx].max_el) dem[indx].max_el = data;
 
@@ -656,8 +877,8 @@ int LoadSDF_BZ(char *name)
 		 dem[] structure.
 		 NOTE: On error, this function returns a negative errno */
 
-	int x, y, found, data = 0, indx, minlat, minlon, maxlat, maxlon, j, success, pos;
-	char free_page = 0, line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX], bzline[20], *posn;
+	int x, y, data = 0, indx, minlat, minlon, maxlat, maxlon, j, success, pos;
+	char line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX], bzline[20], *posn;
 
 	FILE *fd;
 	BZFILE *bzfd;
@@ -680,46 +901,24 @@ int LoadSDF_BZ(char *name)
 	sdf_file[x + 7] = '2';
 	sdf_file[x + 8] = 0;
 
-	/* Is it already in memory? */
-
-	for (indx = 0, found = 0; indx < MAXPAGES && found == 0; indx++) {
-		if (minlat == dem[indx].min_north && minlon == dem[indx].min_west && maxlat == dem[indx].max_north &&
-				maxlon == dem[indx].max_west)
-			found = 1;
-	}
+	/* Is it already in memory, or is room available to load it? */
 
-	/* Is room available to load it? */
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
 
-	if (found == 0) {
-		for (indx = 0, free_page = 0; indx < MAXPAGES && free_page == 0; indx++)
-			if (dem[indx].max_north == -90) free_page = 1;
-	}
+	if (indx >= 0) {
+		/* Search for SDF file in current working directory first,
+			 then in the path specified in $HOME/.ss_path file or by
+			 -d argument */
 
-	indx--;
+		if ((success = FindSDF(sdf_file, path_plus_name, sizeof(path_plus_name))) != 0) return -success;
 
-	if (free_page && found == 0 && indx >= 0 && indx < MAXPAGES) {
-		/* Search for SDF file in current working directory first */
+		if ((fd = fopen(path_plus_name, "rb")) == NULL) return -errno;
 
-		strncpy(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
-
-		success = 0;
-		fd = fopen(path_plus_name, "rb");
 		bzfd = BZ2_bzReadOpen(&bzerror, fd, 0, 0, NULL, 0);
-
-		if (fd != NULL && bzerror == BZ_OK)
-			success = 1;
-		else {
-			/* Next, try loading SDF file from path specified
-				 in $HOME/.ss_path file or by -d argument */
-
-			strncpy(path_plus_name, sdf_path, sizeof(path_plus_name) - 1);
-			strncat(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
-            //spdlog::debug("Trying to load BZ compressed SDF file {}", path_plus_name);
-			fd = fopen(path_plus_name, "rb");
-			bzfd = BZ2_bzReadOpen(&bzerror, fd, 0, 0, NULL, 0);
-			if (fd != NULL && bzerror == BZ_OK) success = 1;
+		if (bzerror != BZ_OK) {
+			fclose(fd);
+			return -EIO;
 		}
-		if (!success) return -errno;
 
 		spdlog::debug("Decompressing BZ SDF \"{}\" into page {}...", path_plus_name, indx + 1);
 
@@ -769,8 +968,6 @@ int LoadSDF_BZ(char *name)
 				data = atoi(line);
 
 				dem[indx].data[x][y] = data;
-				dem[indx].signal[x][y] = 0;
-				dem[indx].mask[x][y] = 0;
 
 				if (data > dem[indx].max_el) dem[indx].max_el = data;
 
@@ -910,8 +1107,8 @@ int LoadSDF_GZ(char *name)
 		 dem[] structure.
 		 NOTE: On error, this function returns a negative errno */
 
-	int x, y, found, data = 0, indx, minlat, minlon, maxlat, maxlon, j, success, pos;
-	char free_page = 0, line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX], gzline[20], *posn;
+	int x, y, data = 0, indx, minlat, minlon, maxlat, maxlon, j, success, pos;
+	char line[20], jline[20], sdf_file[255], path_plus_name[PATH_MAX], gzline[20], *posn;
 	const char *errmsg;
 
 	gzFile gzfd;
@@ -933,45 +1130,18 @@ int LoadSDF_GZ(char *name)
 	sdf_file[x + 6] = 'z';
 	sdf_file[x + 7] = 0;
 
-	/* Is it already in memory? */
-
-	for (indx = 0, found = 0; indx < MAXPAGES && found == 0; indx++) {
-		if (minlat == dem[indx].min_north && minlon == dem[indx].min_west && maxlat == dem[indx].max_north &&
-				maxlon == dem[indx].max_west)
-			found = 1;
-	}
-
-	/* Is room available to load it? */
-
-	if (found == 0) {
-		for (indx = 0, free_page = 0; indx < MAXPAGES && free_page == 0; indx++)
-			if (dem[indx].max_north == -90) free_page = 1;
-	}
+	/* Is it already in memory, or is room available to load it? */
 
-	indx--;
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
 
-	if (free_page && found == 0 && indx >= 0 && indx < MAXPAGES) {
-		/* Search for SDF file in current working directory first */
+	if (indx >= 0) {
+		/* Search for SDF file in current working directory first,
+			 then in the path specified in $HOME/.ss_path file or by
+			 -d argument */
 
-		strncpy(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
+		if ((success = FindSDF(sdf_file, path_plus_name, sizeof(path_plus_name))) != 0) return -success;
 
-		success = 0;
-		gzfd = gzopen(path_plus_name, "rb");
-
-		if (gzfd != NULL)
-			success = 1;
-		else {
-			/* Next, try loading SDF file from path specified
-				 in $HOME/.ss_path file or by -d argument */
-
-			strncpy(path_plus_name, sdf_path, sizeof(path_plus_name) - 1);
-			strncat(path_plus_name, sdf_file, sizeof(path_plus_name) - 1);
-            //spdlog::debug("Trying to load GZ compressed SDF file {}", path_plus_name);
-			gzfd = gzopen(path_plus_name, "rb");
-
-			if (gzfd != NULL) success = 1;
-		}
-		if (!success) return -errno;
+		if ((gzfd = gzopen(path_plus_name, "rb")) == NULL) return -errno;
 
 		if (gzbuffer(gzfd, GZBUFFER))  // Allocate 32K buffer
 			return -EIO;
@@ -1034,8 +1204,6 @@ int LoadSDF_GZ(char *name)
                 data = atoi(line);
 
                 dem[indx].data[x][y] = data;
-                dem[indx].signal[x][y] = 0;
-                dem[indx].mask[x][y] = 0;
 
                 if (data > dem[indx].max_el) dem[indx].max_el = data;
 
@@ -1118,10 +1286,431 @@ int LoadSDF_GZ(char *name)
         return 0;
 	}
 
+static void FoldBounds(float north_min, float north_max, float west_min, float west_max)
+{
+	/* Folds the limits of a dem page into the global boundary
+		 values */
+
+	if (max_north == -90)
+		max_north = north_max;
+
+	else if (north_max > max_north)
+		max_north = north_max;
+
+	if (min_north == 90)
+		min_north = north_min;
+
+	else if (north_min < min_north)
+		min_north = north_min;
+
+	if (max_west == -1)
+		max_west = west_max;
+
+	else {
+		if (abs(west_max - max_west) < 180) {
+			if (west_max > max_west) max_west = west_max;
+		}
+
+		else {
+			if (west_max < max_west) max_west = west_max;
+		}
+	}
+
+	if (min_west == 360)
+		min_west = west_min;
+
+	else {
+		if (fabs(west_min - min_west) < 180.0) {
+			if (west_min < min_west) min_west = west_min;
+		}
+
+		else {
+			if (west_min > min_west) min_west = west_min;
+		}
+	}
+}
+
+static void UpdateBounds(int indx)
+{
+	/* Folds the limits of a freshly loaded dem page into the
+		 global elevation and boundary values */
+
+	if (dem[indx].min_el < min_elevation) min_elevation = dem[indx].min_el;
+
+	if (dem[indx].max_el > max_elevation) max_elevation = dem[indx].max_el;
+
+	FoldBounds(dem[indx].min_north, dem[indx].max_north, dem[indx].min_west, dem[indx].max_west);
+}
+
+static void FillHGTVoids(short *grid, int n)
+{
+	/* Replaces voids (below sea level) in a native (n+1)x(n+1) SRTM
+		 grid with the average of their valid neighbours, visiting
+		 them in the same order and with the same rules as
+		 srtm2sdf's average_terrain() */
+
+	int x, y, temp, count, bad_value, stride = n + 1, mpi_hgt = n - 1;
+	long accum;
+
+	for (y = n; y >= 1; y--) {
+		for (x = mpi_hgt; x >= 0; x--) {
+			short *p = &grid[y * stride + x];
+
+			if (*p >= 0) continue;
+
+			bad_value = *p;
+			accum = 0;
+			count = 0;
+
+			auto add = [&](int v) {
+				if (v > bad_value) {
+					accum += v;
+					count++;
+				}
+			};
+
+			if (y >= 2) add(p[-stride]);
+			if (y <= mpi_hgt) add(p[stride]);
+			if (y >= 2 && x <= mpi_hgt - 1) add(p[-stride + 1]);
+			if (x <= mpi_hgt - 1) add(p[1]);
+			if (x <= mpi_hgt - 1 && y <= mpi_hgt) add(p[stride + 1]);
+			if (x >= 1 && y >= 2) add(p[-stride - 1]);
+			if (x >= 1) add(p[-1]);
+			if (y <= mpi_hgt && x >= 1) add(p[stride - 1]);
+
+			temp = count ? (int)(((double)accum / count) + 0.5) : 0;
+			*p = temp > 0 ? temp : 0;
+		}
+	}
+}
+
+int LoadSDF_HGT(char *name)
+{
+	/* This function maps a raw SRTM .hgt tile (1201x1201 or
+		 3601x3601 big-endian samples, eg. N51W001.hgt) for the
+		 region named like an SDF file and decodes it straight into
+		 the first available dem[] structure, laid out exactly as
+		 srtm2sdf would have written it.  Tiles finer than ippd are
+		 subsampled.  Voids are filled as srtm2sdf fills them.
+		 NOTE: On error, this function returns a negative errno */
+
+	int x, y, n, step, indx, minlat, minlon, maxlat, maxlon, fd, voids = 0;
+	char hgt_file[32], path_plus_name[PATH_MAX];
+	struct stat st;
+
+	if (sscanf(name, "%d_%d_%d_%d", &minlat, &maxlat, &minlon, &maxlon) != 4) return -EINVAL;
+
+	/* SRTM tiles are named after their south west corner */
+
+	if (maxlon <= 180)
+		snprintf(hgt_file, sizeof(hgt_file), "%c%02d%c%03d.hgt", minlat < 0 ? 'S' : 'N', abs(minlat), 'W', maxlon);
+	else
+		snprintf(hgt_file, sizeof(hgt_file), "%c%02d%c%03d.hgt", minlat < 0 ? 'S' : 'N', abs(minlat), 'E', 360 - maxlon);
+
+	/* Is it already in memory, or is room available to load it? */
+
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
+
+	if (indx >= 0) {
+		/* Search for HGT file in current working directory first,
+			 then in the SDF path */
+
+		if ((fd = FindSDF(hgt_file, path_plus_name, sizeof(path_plus_name))) != 0) return -fd;
+
+		if ((fd = open(path_plus_name, O_RDONLY)) < 0) return -errno;
+
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return -errno;
+		}
+
+		if (st.st_size == 1201 * 1201 * 2)
+			n = 1200;
+		else if (st.st_size == 3601 * 3601 * 2)
+			n = 3600;
+		else {
+			spdlog::warn("Ignoring \"{}\", not a 1201x1201 or 3601x3601 SRTM tile", path_plus_name);
+			close(fd);
+			return 0;
+		}
+
+		/* We can only take every step'th sample, not invent them */
+
+		if (n % ippd != 0) {
+			spdlog::debug("Ignoring \"{}\", {} samples per degree cannot make {}", path_plus_name, n, ippd);
+			close(fd);
+			return 0;
+		}
+		step = n / ippd;
+
+		const unsigned short *hgt = (const unsigned short *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (hgt == MAP_FAILED) return -errno;
+
+		spdlog::debug("Loading HGT \"{}\" into page {}...", path_plus_name, indx + 1);
+
+		dem[indx].max_west = maxlon;
+		dem[indx].min_north = minlat;
+		dem[indx].min_west = minlon;
+		dem[indx].max_north = maxlat;
+
+		/* Rows run north to south and columns west to east in the
+			 tile, the reverse of a dem page, and the northern row and
+			 eastern column overlap the neighbouring tiles */
+
+		for (x = 0; x < ippd; x++) {
+			const unsigned short *src = &hgt[(size_t)(n - step * x) * (n + 1) + n - step];
+			short *dst = dem[indx].data[x];
+
+			for (y = 0; y < ippd; y++) {
+				dst[y] = (short)__builtin_bswap16(src[-step * y]);
+				voids |= dst[y] < 0;
+			}
+		}
+
+		if (voids) {
+			/* Fill the voids on the full grid, so fills can use
+				 the samples we skip */
+
+			std::vector<short> grid((size_t)(n + 1) * (n + 1));
+			for (size_t i = 0; i < grid.size(); i++) grid[i] = (short)__builtin_bswap16(hgt[i]);
+
+			FillHGTVoids(grid.data(), n);
+
+			for (x = 0; x < ippd; x++) {
+				const short *src = &grid[(size_t)(n - step * x) * (n + 1) + n - step];
+				for (y = 0; y < ippd; y++) dem[indx].data[x][y] = src[-step * y];
+			}
+		}
+
+		munmap((void *)hgt, st.st_size);
+
+		for (x = 0; x < ippd; x++) {
+			for (y = 0; y < ippd; y++) {
+				if (dem[indx].data[x][y] > dem[indx].max_el) dem[indx].max_el = dem[indx].data[x][y];
+
+				if (dem[indx].data[x][y] < dem[indx].min_el) dem[indx].min_el = dem[indx].data[x][y];
+			}
+		}
+
+		UpdateBounds(indx);
+
+		return 1;
+	}
+
+	else
+		return 0;
+}
+
+/* Binary SDF (.sdb) as written by srtm2sdf -b: this header followed
+	 by ippd x ippd little-endian samples in the order of a text SDF */
+
+struct sdb_header {
+	char magic[4];
+	int ippd, max_west, min_north, min_west, max_north;
+};
+
+int LoadSDF_SDB(char *name)
+{
+	/* This function reads binary SDF files (.sdb), whose rows are
+		 already laid out like those of a dem page, straight into the
+		 first available dem[] structure.  Files finer than ippd are
+		 subsampled.
+		 NOTE: On error, this function returns a negative errno */
+
+	int x, y, step, indx, minlat, minlon, maxlat, maxlon, success;
+	char sdb_file[255], path_plus_name[PATH_MAX];
+	struct sdb_header header;
+	FILE *fd;
+
+	for (x = 0; name[x] != '.' && name[x] != 0 && x < 250; x++) sdb_file[x] = name[x];
+
+	sdb_file[x] = 0;
+
+	if (sscanf(sdb_file, "%d_%d_%d_%d", &minlat, &maxlat, &minlon, &maxlon) != 4) return -EINVAL;
+
+	strcpy(&sdb_file[x], ".sdb");
+
+	/* Is it already in memory, or is room available to load it? */
+
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
+
+	if (indx >= 0) {
+		/* Search for SDB file in current working directory first,
+			 then in the SDF path */
+
+		if ((success = FindSDF(sdb_file, path_plus_name, sizeof(path_plus_name))) != 0) return -success;
+
+		if ((fd = fopen(path_plus_name, "rb")) == NULL) return -errno;
+
+		if (fread(&header, sizeof(header), 1, fd) != 1 || memcmp(header.magic, "SDB1", 4) != 0 ||
+				header.ippd <= 0 || header.ippd % ippd != 0) {
+			spdlog::warn("Ignoring \"{}\", not a binary SDF file of {} or a multiple of {} samples per degree",
+									 path_plus_name, ippd, ippd);
+			fclose(fd);
+			return 0;
+		}
+		step = header.ippd / ippd;
+
+		spdlog::debug("Loading SDB \"{}\" into page {}...", path_plus_name, indx + 1);
+
+		dem[indx].max_west = maxlon;
+		dem[indx].min_north = minlat;
+		dem[indx].min_west = minlon;
+		dem[indx].max_north = maxlat;
+
+		std::vector<short> row(step > 1 ? header.ippd : 0);
+
+		for (x = 0; x < ippd; x++) {
+			short *dst = dem[indx].data[x];
+			size_t got;
+
+			if (step == 1)
+				got = fread(dst, sizeof(short), ippd, fd);
+			else {
+				/* Take every step'th row and column, as LoadSDF_HGT()
+					 does, skipping the rows in between */
+
+				if (fseek(fd, (long)(step - 1) * header.ippd * sizeof(short) * (x > 0), SEEK_CUR) != 0) break;
+				got = fread(row.data(), sizeof(short), header.ippd, fd) == (size_t)header.ippd ? ippd : 0;
+				for (y = 0; y < ippd && got; y++) dst[y] = row[step * y + step - 1];
+			}
+
+			if (got != (size_t)ippd) break;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			for (y = 0; y < ippd; y++) dst[y] = (short)__builtin_bswap16(dst[y]);
+#endif
+
+			for (y = 0; y < ippd; y++) {
+				if (dst[y] > dem[indx].max_el) dem[indx].max_el = dst[y];
+
+				if (dst[y] < dem[indx].min_el) dem[indx].min_el = dst[y];
+			}
+		}
+
+		fclose(fd);
+
+		if (x < ippd) {
+			spdlog::error("Premature EOF in \"{}\"", path_plus_name);
+
+			/* Leave the page free */
+			dem[indx].max_north = -90;
+			dem[indx].min_north = 90;
+			dem[indx].min_el = 32768;
+			dem[indx].max_el = -32768;
+			return -EIO;
+		}
+
+		UpdateBounds(indx);
+
+		return 1;
+	}
+
+	else
+		return 0;
+}
+
+int LoadSDF_PYR(char *name)
+{
+	/* This function reads a DEM pyramid (.sdp, see sdfpyr) for the
+		 region named like an SDF file.  The same file serves every
+		 resolution: the coarsest overview that ippd divides is read,
+		 and subsampled further if need be, picking the samples the
+		 SDF loaders would.
+		 NOTE: On error, this function returns a negative errno */
+
+	int x, y, level, step, size, indx, minlat, minlon, maxlat, maxlon, success;
+	char pyr_file[64], path_plus_name[PATH_MAX];
+	pyramid_t pyr;
+
+	if (sscanf(name, "%d_%d_%d_%d", &minlat, &maxlat, &minlon, &maxlon) != 4) return -EINVAL;
+
+	/* One pyramid covers standard and HD definition alike */
+
+	snprintf(pyr_file, sizeof(pyr_file), "%d_%d_%d_%d.sdp", minlat, maxlat, minlon, maxlon);
+
+	/* Is it already in memory, or is room available to load it? */
+
+	indx = ClaimPage(minlat, maxlat, minlon, maxlon);
+
+	if (indx >= 0) {
+		/* Search for the pyramid in current working directory first,
+			 then in the SDF path */
+
+		if ((success = FindSDF(pyr_file, path_plus_name, sizeof(path_plus_name))) == 0)
+			success = pyramid_open(&pyr, path_plus_name);
+
+		if (success != 0) {
+			if (success == EINVAL) spdlog::warn("Ignoring \"{}\", not a DEM pyramid", path_plus_name);
+			return success == EINVAL ? 0 : -success;
+		}
+
+		/* The coarsest level still holding a whole number of samples per page sample */
+
+		for (level = pyr.header.levels - 1; level >= 0; level--) {
+			if (pyr.width[level] == pyr.height[level] && pyr.width[level] << level == pyr.header.width &&
+					pyr.width[level] % ippd == 0)
+				break;
+		}
+
+		if (level < 0) {
+			spdlog::debug("Ignoring \"{}\", no level of {} samples can make {}", path_plus_name, pyr.header.width, ippd);
+			pyramid_close(&pyr);
+			return 0;
+		}
+
+		size = pyr.width[level];
+		step = size / ippd;
+
+		std::vector<short> grid((size_t)size * size);
+		success = pyramid_read(&pyr, level, 0, 0, size, size, grid.data(), MAX(std::thread::hardware_concurrency(), 1u));
+		pyramid_close(&pyr);
+
+		if (success != 0) return -success;
+
+		spdlog::debug("Loading pyramid \"{}\" level {} into page {}...", path_plus_name, level, indx + 1);
+
+		dem[indx].max_west = maxlon;
+		dem[indx].min_north = minlat;
+		dem[indx].min_west = minlon;
+		dem[indx].max_north = maxlat;
+
+		/* Levels run north to south and west to east, the reverse of
+			 a dem page */
+
+		for (x = 0; x < ippd; x++) {
+			const short *src = &grid[(size_t)(size - 1 - step * x) * size + size - step];
+			short *dst = dem[indx].data[x];
+
+			for (y = 0; y < ippd; y++) {
+				dst[y] = src[-step * y];
+
+				if (dst[y] > dem[indx].max_el) dem[indx].max_el = dst[y];
+
+				if (dst[y] < dem[indx].min_el) dem[indx].min_el = dst[y];
+			}
+		}
+
+		UpdateBounds(indx);
+
+		return 1;
+	}
+
+	else
+		return 0;
+}
+
 int LoadSDF(char *name)
 {
 	/* This function loads the requested SDF file from the filesystem.
-		 It first tries to invoke the LoadSDF_SDF() function to load an
+		 It first looks for a DEM pyramid with LoadSDF_PYR(), which
+		 reads no more samples than the resolution in use needs, then
+		 tries to map a raw SRTM .hgt tile for the region with
+		 LoadSDF_HGT(), as that needs no parsing at all, then for a
+		 binary SDF with LoadSDF_SDB().  It then tries
+		 to invoke the LoadSDF_SDF() function to load an
 		 uncompressed SDF file (since uncompressed files load slightly
 		 faster).  If that attempt fails, then it tries to load a
 		 compressed SDF file by invoking the LoadSDF_BZ() function.
@@ -1132,12 +1721,23 @@ int LoadSDF(char *name)
 		 requested must be entirely over water. */
 
 	int x, y, indx, minlat, minlon, maxlat, maxlon;
-	char found, free_page = 0;
 	int return_value = -1;
 
-	/* Try to load an uncompressed SDF first. */
+	/* Try a pyramid first. */
+
+	return_value = LoadSDF_PYR(name);
+
+	/* Then map a raw SRTM tile. */
+
+	if (return_value <= 0) return_value = LoadSDF_HGT(name);
 
-	return_value = LoadSDF_SDF(name);
+	/* Then a binary SDF. */
+
+	if (return_value <= 0) return_value = LoadSDF_SDB(name);
+
+	/* Then an uncompressed SDF. */
+
+	if (return_value <= 0) return_value = LoadSDF_SDF(name);
 
 	/* If that fails, try loading a BZ2 compressed SDF. */
 
@@ -1152,24 +1752,11 @@ int LoadSDF(char *name)
 	if (return_value <= 0) {
 		sscanf(name, "%d_%d_%d_%d", &minlat, &maxlat, &minlon, &maxlon);
 
-		/* Is it already in memory? */
+		/* Is it already in memory, or is room available to load it? */
 
-		for (indx = 0, found = 0; indx < MAXPAGES && found == 0; indx++) {
-			if (minlat == dem[indx].min_north && minlon == dem[indx].min_west && maxlat == dem[indx].max_north &&
-					maxlon == dem[indx].max_west)
-				found = 1;
-		}
-
-		/* Is room available to load it? */
-
-		if (found == 0) {
-			for (indx = 0, free_page = 0; indx < MAXPAGES && free_page == 0; indx++)
-				if (dem[indx].max_north == -90) free_page = 1;
-		}
+		indx = ClaimPage(minlat, maxlat, minlon, maxlon);
 
-		indx--;
-
-		if (free_page && found == 0 && indx >= 0 && indx < MAXPAGES) {
+		if (indx >= 0) {
 			spdlog::warn("SDF file not found, region \"{}\" assumed as sea-level into page {}...", name, indx + 1);
 
 			dem[indx].max_west = maxlon;
@@ -1182,8 +1769,6 @@ int LoadSDF(char *name)
 			for (x = 0; x < ippd; x++)
 				for (y = 0; y < ippd; y++) {
 					dem[indx].data[x][y] = 0;
-					dem[indx].signal[x][y] = 0;
-					dem[indx].mask[x][y] = 0;
 
 					if (dem[indx].min_el > 0) dem[indx].min_el = 0;
 				}
@@ -2068,56 +2653,45 @@ int LoadTopoData(bbox region)
         exit(1);
     }
 
-    // Load the data
+    // List the tiles. They are loaded when first used, or by the
+    // prefetcher, but the plot covers all of them from the start
+    std::vector<std::string> names;
     for (int x = 0; x < tiles_lon; x++) {
         for (int y = 0; y < tiles_lat; y++) {
             int tile_lon = r_min_lon + x;
             int tile_lat = r_min_lat + y;
-            spdlog::debug("Loading topo for tile {}N {}W to {}N {}W", tile_lat, tile_lon, tile_lat + 1, tile_lon + 1);
+            spdlog::debug("Listing topo for tile {}N {}W to {}N {}W", tile_lat, tile_lon, tile_lat + 1, tile_lon + 1);
             // Generate the filename string to load
             char basename[32], string[32];
             snprintf(basename, 16, "%d_%d_%d_%d", tile_lat, tile_lat + 1, tile_lon, tile_lon + 1);
             strcpy(string, basename);
             if (ippd == 3600) strcat(string, "-hd");
-            // Load the tile
-            int success;
-            if ((success = LoadSDF(string)) < 0) 
-            {
-                return -success;
-            }
+            names.push_back(string);
+            FoldBounds(tile_lat, tile_lat + 1, tile_lon, tile_lon + 1);
         }
     }
 
-	return 0;
+	return pages_open(names, (region.lower_right.lat + region.upper_left.lat) / 2,
+			(region.lower_right.lon + region.upper_left.lon) / 2, LoadSDF);
 }
 
 int LoadUDT(char *filename)
 {
 	/* This function reads a file containing User-Defined Terrain
 		 features for their addition to the digital elevation model
-		 data used by SPLAT!.  Elevations in the UDT file are evaluated
-		 and then copied into a temporary file under /tmp.  Then the
-		 contents of the temp file are scanned, and if found to be unique,
-		 are added to the ground elevations described by the digital
-		 elevation data already loaded into memory. */
+		 data used by SPLAT!.  Features are keyed on the DEM pixel
+		 they fall in; where several share a pixel only the tallest
+		 is kept.  The survivors are then added to the ground
+		 elevations of each page, once all are loaded into memory. */
 
-	int i, x, y, z, ypix, xpix, tempxpix, tempypix, fd = 0, n = 0;
-	char input[80], str[3][80], tempname[15], *pointer = NULL, *s = NULL;
-	double latitude, longitude, height, tempheight, old_longitude = 0.0, old_latitude = 0.0;
-	FILE *fd1 = NULL, *fd2 = NULL;
-
-	strcpy(tempname, "/tmp/XXXXXX");
+	int i, x, y, z, indx, success;
+	char input[80], str[3][80], *pointer = NULL, *s = NULL;
+	double latitude, longitude, height;
+	FILE *fd1 = NULL;
+	std::unordered_map<uint64_t, double> features;
 
 	if ((fd1 = fopen(filename, "r")) == NULL) return errno;
 
-	if ((fd = mkstemp(tempname)) == -1) return errno;
-
-	if ((fd2 = fdopen(fd, "w")) == NULL) {
-		fclose(fd1);
-		close(fd);
-		return errno;
-	}
-
 	s = fgets(input, 78, fd1);
 
 	if (s)
@@ -2143,8 +2717,8 @@ int LoadUDT(char *filename)
 			}
 		}
 
-		old_latitude = latitude = ReadBearing(str[0]);
-		old_longitude = longitude = ReadBearing(str[1]);
+		latitude = ReadBearing(str[0]);
+		longitude = ReadBearing(str[1]);
 
 		latitude = fabs(latitude);  // Clip if negative
 		longitude = fabs(longitude);
@@ -2176,7 +2750,11 @@ int LoadUDT(char *filename)
 			height = rint(METERS_PER_FOOT * atof(str[2]));
 		}
 
-		if (height > 0.0) fprintf(fd2, "%d, %d, %f\n", (int)rint(latitude / dpp), (int)rint(longitude / dpp), height);
+		if (height > 0.0) {
+			uint64_t key = ((uint64_t)(uint32_t)(int)rint(latitude / dpp) << 32) | (uint32_t)(int)rint(longitude / dpp);
+			double &tallest = features[key];
+			if (height > tallest) tallest = height;
+		}
 
 		s = fgets(input, 78, fd1);
 
@@ -2186,59 +2764,32 @@ int LoadUDT(char *filename)
 	}
 
 	fclose(fd1);
-	fclose(fd2);
 
-	if ((fd1 = fopen(tempname, "r")) == NULL) return errno;
+	spdlog::debug("Adding {} UDT points", features.size());
 
-	if ((fd2 = fopen(tempname, "r")) == NULL) {
-		fclose(fd1);
-		return errno;
-	}
+	/* One pass over the features per page, all of them loaded */
+	if ((success = pages_finish()) != 0) return success;
 
-	y = 0;
+	for (indx = 0; indx < MAXPAGES && dem[indx].max_north != -90; indx++) {
+		bool pinned = false;
 
-	n = fscanf(fd1, "%d, %d, %lf", &xpix, &ypix, &height);
+		for (const auto &f : features) {
+			double lat = (int32_t)(f.first >> 32) * dpp;
+			double lon = (int32_t)(f.first & 0xffffffff) * dpp;
 
-	if (n)
-		;
+			x = (int)rint(ppd * (lat - dem[indx].min_north));
+			y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
 
-	do {
-		x = 0;
-		z = 0;
-
-		n = fscanf(fd2, "%d, %d, %lf", &tempxpix, &tempypix, &tempheight);
-
-		do {
-			if (x > y && xpix == tempxpix && ypix == tempypix) {
-				z = 1;  // Dupe Found!
-
-				if (tempheight > height) height = tempheight;
-			}
-
-			else {
-				n = fscanf(fd2, "%d, %d, %lf", &tempxpix, &tempypix, &tempheight);
-				x++;
+			if (x >= 0 && x <= mpi && y >= 0 && y <= mpi) {
+				/* Terrain changed here cannot be read back from the tile */
+				if (!pinned) {
+					pages_pin(indx);
+					pinned = true;
+				}
+				dem[indx].data[0][page_cell(x, y)] += (short)rint(f.second);
 			}
-
-		} while (feof(fd2) == 0 && z == 0);
-
-		if (z == 0) {
-			// No duplicate found
-			spdlog::debug("Adding UDT Point: {}, {}, {}", old_latitude, old_longitude, height);
-			AddElevation((double)xpix * dpp, (double)ypix * dpp, height, 1);
 		}
+	}
 
-		fflush(stderr);
-
-		n = fscanf(fd1, "%d, %d, %lf", &xpix, &ypix, &height);
-		y++;
-
-		rewind(fd2);
-
-	} while (feof(fd1) == 0);
-
-	fclose(fd1);
-	fclose(fd2);
-	unlink(tempname);
 	return 0;
 }
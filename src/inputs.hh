@@ -9,6 +9,9 @@ int resample_data(int scaling_factor);
 int resize_data(int resolution);
 
 int LoadSDF_SDF(char *name, int winfiles);
+int LoadSDF_HGT(char *name);
+int LoadSDF_SDB(char *name);
+int LoadSDF_PYR(char *name);
 char *BZfgets(char *output, BZFILE *bzfd, unsigned length);
 int LoadSDF_GZ(char *name);
 char *GZfgets(char *output, gzFile gzfd, unsigned length);
@@ -20,9 +23,9 @@ int LoadLossColors(struct site xmtr);
 int LoadDBMColors(struct site xmtr);
 int LoadTopoData(bbox region);
 int LoadUDT(char *filename);
-int loadLIDAR(char *filename, int resample);
+int loadLIDAR(char *filename, int resample, bbox *window);
 int loadClutter(char *filename, double radius, struct site tx);
-int averageHeight(int h, int w, int x, int y);
+int averageHeight(const short *below, const short *above, int x);
 static const char AZ_FILE_SUFFIX[] = ".az";
 static const char EL_FILE_SUFFIX[] = ".el";
 
@@ -0,0 +1,202 @@
+/*
+ * KMZ output, for Google Earth. A KMZ is a zip of doc.kml, here a
+ * GroundOverlay of the map, and the image it lays over the box. The
+ * image, a PNG already deflated on every core as it was drawn, is stored
+ * as it is; only the KML is deflated here.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "kmz.hh"
+
+#define ZIP_STORED	0
+#define ZIP_DEFLATED	8
+#define ZIP_VERSION	20	/* 2.0, deflate */
+
+typedef struct _zip_entry_t{
+	std::string name;
+	uint16_t method;
+	uint32_t crc, compressed, size, offset;
+} zip_entry_t;
+
+typedef struct _zip_t{
+	FILE *fd;
+	uint32_t at;		/* bytes written */
+	uint16_t time, date;	/* MS-DOS, local */
+	std::vector<zip_entry_t> entries;
+} zip_t;
+
+static void put16(std::vector<uint8_t> &out, uint16_t v){
+	out.push_back(v);
+	out.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v){
+	put16(out, v);
+	put16(out, v >> 16);
+}
+
+static int zip_out(zip_t *zip, const void *data, size_t bytes){
+	if(zip->at + (uint64_t)bytes > UINT32_MAX)
+		return EFBIG;	/* needs Zip64 */
+	if(bytes > 0 && fwrite(data, 1, bytes, zip->fd) != bytes)
+		return EIO;
+	zip->at += bytes;
+	return 0;
+}
+
+/* The fields a local header and its central directory entry share */
+static void zip_fields(std::vector<uint8_t> &out, const zip_entry_t *entry, uint16_t time, uint16_t date){
+	put16(out, ZIP_VERSION);
+	put16(out, 0);			/* flags */
+	put16(out, entry->method);
+	put16(out, time);
+	put16(out, date);
+	put32(out, entry->crc);
+	put32(out, entry->compressed);
+	put32(out, entry->size);
+	put16(out, entry->name.size());
+	put16(out, 0);			/* extra field */
+}
+
+/* Adds a file to the zip, deflated if pack says, unless it would not shrink */
+static int zip_add(zip_t *zip, const char *name, const uint8_t *data, size_t bytes, bool pack){
+	zip_entry_t entry = {name, ZIP_STORED, 0, 0, 0, zip->at};
+	std::vector<uint8_t> packed, header;
+	int success;
+
+	if(bytes > UINT32_MAX)
+		return EFBIG;
+	entry.crc = crc32(crc32(0, NULL, 0), data, bytes);
+	entry.size = entry.compressed = bytes;
+
+	if(pack){
+		z_stream zs;
+
+		memset(&zs, 0, sizeof(zs));
+		if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return ENOMEM;
+		packed.resize(deflateBound(&zs, bytes));
+		zs.next_in = (Bytef*)data;
+		zs.avail_in = bytes;
+		zs.next_out = packed.data();
+		zs.avail_out = packed.size();
+		success = deflate(&zs, Z_FINISH) == Z_STREAM_END ? 0 : ENOMEM;
+		packed.resize(zs.total_out);
+		deflateEnd(&zs);
+		if(success != 0)
+			return success;
+		if(packed.size() < bytes){
+			entry.method = ZIP_DEFLATED;
+			entry.compressed = packed.size();
+			data = packed.data();
+		}
+	}
+
+	put32(header, 0x04034b50);
+	zip_fields(header, &entry, zip->time, zip->date);
+	header.insert(header.end(), entry.name.begin(), entry.name.end());
+
+	if((success = zip_out(zip, header.data(), header.size())) == 0 &&
+	   (success = zip_out(zip, data, entry.compressed)) == 0)
+		zip->entries.push_back(entry);
+	return success;
+}
+
+/* Writes the central directory, ending the zip */
+static int zip_finish(zip_t *zip){
+	std::vector<uint8_t> dir;
+	uint32_t start = zip->at;
+	int success;
+
+	for(auto &entry : zip->entries){
+		put32(dir, 0x02014b50);
+		put16(dir, 3 << 8 | ZIP_VERSION);	/* made on Unix */
+		zip_fields(dir, &entry, zip->time, zip->date);
+		put16(dir, 0);			/* comment */
+		put16(dir, 0);			/* disk */
+		put16(dir, 0);			/* internal attributes */
+		put32(dir, 0644 << 16);		/* external: a regular file, rw-r--r-- */
+		put32(dir, entry.offset);
+		dir.insert(dir.end(), entry.name.begin(), entry.name.end());
+	}
+	if((success = zip_out(zip, dir.data(), dir.size())) != 0)
+		return success;
+
+	dir.clear();
+	put32(dir, 0x06054b50);
+	put16(dir, 0);
+	put16(dir, 0);
+	put16(dir, zip->entries.size());
+	put16(dir, zip->entries.size());
+	put32(dir, zip->at - start);
+	put32(dir, start);
+	put16(dir, 0);
+	return zip_out(zip, dir.data(), dir.size());
+}
+
+/* Text made safe for XML */
+static std::string xml_escape(const char *text){
+	std::string out;
+
+	for(; *text; text++)
+		switch(*text){
+			case '&': out += "&amp;"; break;
+			case '<': out += "&lt;"; break;
+			case '>': out += "&gt;"; break;
+			case '"': out += "&quot;"; break;
+			default: out += *text;
+		}
+	return out;
+}
+
+/*
+ * kmz_write
+ * Writes a KMZ to fd: doc.kml, a GroundOverlay called name laying the
+ * image file, bytes of data, over box. Returns 0, or an errno.
+ */
+int kmz_write(FILE *fd, const char *name, const char *image, const uint8_t *data, size_t bytes, const kmz_box_t *box){
+	zip_t zip;
+	time_t now = time(NULL);
+	struct tm local;
+	char kml[2048];
+	int length, success;
+
+	localtime_r(&now, &local);
+	zip.fd = fd;
+	zip.at = 0;
+	zip.time = local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2;
+	zip.date = (local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday;
+
+	length = snprintf(kml, sizeof(kml),
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+		"<GroundOverlay>\n"
+		"    <name>%s</name>\n"
+		"    <Icon>\n"
+		"        <href>%s</href>\n"
+		"    </Icon>\n"
+		"    <LatLonBox>\n"
+		"        <north>%.6f</north>\n"
+		"        <south>%.6f</south>\n"
+		"        <east>%.6f</east>\n"
+		"        <west>%.6f</west>\n"
+		"    </LatLonBox>\n"
+		"</GroundOverlay>\n"
+		"</kml>\n",
+		xml_escape(name).c_str(), xml_escape(image).c_str(), box->north, box->south, box->east, box->west);
+	if(length < 0 || length >= (int)sizeof(kml))
+		return ENAMETOOLONG;
+
+	/* The KML first, as viewers look for it there */
+	if((success = zip_add(&zip, "doc.kml", (const uint8_t*)kml, length, true)) == 0 &&
+	   (success = zip_add(&zip, image, data, bytes, false)) == 0)
+		success = zip_finish(&zip);
+	return success;
+}
@@ -0,0 +1,15 @@
+#ifndef _KMZ_HH_
+#define _KMZ_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The box a ground overlay covers, in degrees, east positive */
+typedef struct _kmz_box_t{
+	double north, south, east, west;
+} kmz_box_t;
+
+int kmz_write(FILE *fd, const char *name, const char *image, const uint8_t *data, size_t bytes, const kmz_box_t *box);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _LAYOUT_HH_
+#define _LAYOUT_HH_
+
+#include <stddef.h>
+#include "common.hh"
+
+/*
+ * DEM page layout. The terrain and clutter layers of a page hold IPPD x
+ * IPPD cells, found with page_cell(). By default a layer is
+ * kept row by row, rows running along latitude, so a path at most bearings
+ * crosses a row per sample, each in another cache line and often another
+ * memory page. Tiled (-tiled), a layer is kept in LAYOUT_TILE square tiles,
+ * row by row, with the cells of each tile in Z-order, so the cells along a
+ * path share cache lines whatever its bearing.
+ *
+ * Loaders still fill the terrain row by row, through dem[].data, and
+ * tile_page() moves it into place.
+ */
+
+/*
+ * The mask, signal and claim layers, which hold what a plot finds, are
+ * always kept in RESULT_BLOCK square blocks, row by row, found with
+ * result_cell(). A block of byte cells fills a 4 KB memory page. As the
+ * layers are mapped and only written where a plot reaches, memory is
+ * only taken by the blocks a plot reaches, however large the page. Each
+ * block is stamped with the plot that wrote it, so a new plot finds the
+ * blocks of the last empty without clearing them first (see NewPlot()).
+ *
+ * If result_values is set (-values), a float layer in the same blocks
+ * also keeps the loss, field strength or power each signal byte was
+ * quantized from, for export.
+ */
+
+#define LAYOUT_TILE	32	/* a power of 2 */
+#define RESULT_BLOCK	64	/* also the bits in a claim word */
+
+extern bool tiled_layout;
+extern bool result_values;
+
+/* Spreads the bits of a tile position out to every other bit */
+static inline size_t layout_spread(unsigned v){
+	v = (v | v << 4) & 0x10f;
+	v = (v | v << 2) & 0x133;
+	v = (v | v << 1) & 0x155;
+	return v;
+}
+
+/* Tiles across and down a page */
+static inline size_t layout_tiles(void){
+	return (IPPD + LAYOUT_TILE - 1) / LAYOUT_TILE;
+}
+
+/* Cells a layer of a page takes, tiles rounded up */
+static inline size_t layout_cells(void){
+	if (!tiled_layout)
+		return (size_t)IPPD * IPPD;
+
+	return layout_tiles() * layout_tiles() * LAYOUT_TILE * LAYOUT_TILE;
+}
+
+/* The offset of row x, column y of a page in its layers */
+static inline size_t page_cell(int x, int y){
+	unsigned ux = x, uy = y;
+
+	if (!tiled_layout)
+		return (size_t)ux * IPPD + uy;
+
+	return ((ux / LAYOUT_TILE) * layout_tiles() + uy / LAYOUT_TILE) * (LAYOUT_TILE * LAYOUT_TILE) +
+		(layout_spread(ux % LAYOUT_TILE) << 1 | layout_spread(uy % LAYOUT_TILE));
+}
+
+/* Blocks across and down a page */
+static inline size_t result_blocks(void){
+	return (IPPD + RESULT_BLOCK - 1) / RESULT_BLOCK;
+}
+
+/* Cells a result layer of a page takes, blocks rounded up */
+static inline size_t result_cells(void){
+	return result_blocks() * result_blocks() * RESULT_BLOCK * RESULT_BLOCK;
+}
+
+/* The offset of row x, column y of a page in its result layers, and of its
+ * bit in the claim layer */
+static inline size_t result_cell(int x, int y){
+	unsigned ux = x, uy = y;
+
+	return ((ux / RESULT_BLOCK) * result_blocks() + uy / RESULT_BLOCK) * (RESULT_BLOCK * RESULT_BLOCK) +
+		(ux % RESULT_BLOCK) * RESULT_BLOCK + uy % RESULT_BLOCK;
+}
+
+#endif
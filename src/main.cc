@@ -27,13 +27,20 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <sys/mman.h>
 #include <bzlib.h>
 #include <zlib.h>
+#include <algorithm>
+#include <vector>
 
 #include "main.hh"
 #include "common.hh"
 #include "inputs.hh"
 #include "outputs.hh"
+#include "pages.hh"
+#include "blocks.hh"
+#include "layout.hh"
+#include "mem.hh"
 #include "models/itwom3.0.hh"
 #include "models/los.hh"
 #include "models/pel.hh"
@@ -45,6 +52,9 @@
 int MAXPAGES = 10*10;
 int IPPD = 1200;
 int ARRAYSIZE = (MAXPAGES * IPPD) + 10;
+bool tiled_layout = false;
+bool result_values = false;
+static uint32_t plot_epoch = 1;	/* 0 marks blocks never written */
 
 char sdf_path[255], opened = 0, gpsav = 0, dashes[80], *color_file = NULL;
 
@@ -164,6 +174,142 @@ void *dec2dms(double decimal, char *string)
     return (string);
 }
 
+static __thread int last_page = 0;
+
+int FindPage(double lat, double lon, int *px, int *py)
+{
+    /* This function returns the dem page holding the given
+       latitude and longitude, and the position within it in
+       px/py, or -1 if the location is not covered.  The page
+       this thread found last is tried first, as consecutive
+       lookups nearly always land in the same page.  Tiles of
+       the plot not in memory yet are loaded on the spot. */
+
+    int x, y, indx, i, filled, pages;
+
+    do {
+        filled = pages_filled.load(std::memory_order_acquire);
+        pages = filled < MAXPAGES ? filled : MAXPAGES;
+
+        for (i = -1; i < pages; i++) {
+            indx = i < 0 ? last_page : i;
+
+            if (i == last_page || indx >= pages)
+                continue;
+
+            x = (int)rint(ppd * (lat - dem[indx].min_north));
+            y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
+
+            if (x >= 0 && x <= mpi && y >= 0 && y <= mpi) {
+                if (i >= 0) {
+                    last_page = indx;
+                    pages_touch(indx);
+                }
+                *px = x;
+                *py = y;
+                return indx;
+            }
+        }
+    } while (pages_fault(lat, lon, filled));
+
+    return -1;
+}
+
+#define EPOCH_BUSY	UINT32_MAX	/* a block being cleared */
+
+static void ClearBlock(int indx, size_t block)
+{
+    /* Zeroes the mask, signal, values and claims of a result block */
+
+    size_t first = block * RESULT_BLOCK * RESULT_BLOCK;
+
+    memset(&dem[indx].mask[first], 0, RESULT_BLOCK * RESULT_BLOCK);
+    memset(&dem[indx].signal[first], 0, RESULT_BLOCK * RESULT_BLOCK);
+    if (dem[indx].value != NULL)
+        memset(&dem[indx].value[first], 0, RESULT_BLOCK * RESULT_BLOCK * sizeof(float));
+    memset(&dem[indx].claims[first / RESULT_BLOCK], 0, RESULT_BLOCK * sizeof(uint64_t));
+}
+
+void NewPlot(void)
+{
+    /* Starts a plot.  Rather than clearing what the last plot
+       left in the result layers, the plot takes a new epoch, and
+       result blocks stamped with an older one read as empty, and
+       are cleared when the new plot first writes to them.  Call
+       before any plot thread starts. */
+
+    int i;
+    size_t block;
+
+    /* As do the peak and extent it tracks */
+    hottest = 0;
+    cropLat = -70;
+    cropLon = 0;
+
+    if (++plot_epoch != EPOCH_BUSY)
+        return;
+
+    /* Once the stamps run out, every block is cleared and they
+       start over */
+    for (i = 0; i < MAXPAGES; i++) {
+        if (dem[i].data == NULL)
+            continue;
+        for (block = 0; block < result_blocks() * result_blocks(); block++)
+            if (dem[i].epochs[block] != 0) {
+                ClearBlock(i, block);
+                dem[i].epochs[block] = 0;
+            }
+    }
+    plot_epoch = 1;
+}
+
+static inline bool BlockCurrent(int indx, size_t cell)
+{
+    /* Whether the result block of a cell belongs to this plot */
+
+    return __atomic_load_n(&dem[indx].epochs[cell / (RESULT_BLOCK * RESULT_BLOCK)], __ATOMIC_ACQUIRE) == plot_epoch;
+}
+
+static void RenewBlock(int indx, size_t cell)
+{
+    /* Makes the result block of a cell this plot's, clearing what
+       an earlier plot left in it.  Of threads reaching it at once,
+       one clears it while the others wait.  Blocks never written
+       are still zero, and left untouched. */
+
+    uint32_t *epoch = &dem[indx].epochs[cell / (RESULT_BLOCK * RESULT_BLOCK)];
+    uint32_t seen = __atomic_load_n(epoch, __ATOMIC_ACQUIRE);
+
+    while (seen != plot_epoch) {
+        if (seen != EPOCH_BUSY &&
+            __atomic_compare_exchange_n(epoch, &seen, EPOCH_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            if (seen != 0)
+                ClearBlock(indx, cell / (RESULT_BLOCK * RESULT_BLOCK));
+            __atomic_store_n(epoch, plot_epoch, __ATOMIC_RELEASE);
+            return;
+        }
+        seen = __atomic_load_n(epoch, __ATOMIC_ACQUIRE);
+    }
+}
+
+unsigned char PageMask(int indx, int x, int y)
+{
+    /* Mask bits of this plot at a page position */
+
+    size_t cell = result_cell(x, y);
+
+    return BlockCurrent(indx, cell) ? dem[indx].mask[cell] : 0;
+}
+
+unsigned char PageSignal(int indx, int x, int y)
+{
+    /* Signal level of this plot at a page position */
+
+    size_t cell = result_cell(x, y);
+
+    return BlockCurrent(indx, cell) ? dem[indx].signal[cell] : 0;
+}
+
 int PutMask(double lat, double lon, int value)
 {
     /* Lines, text, markings, and coverage areas are stored in a
@@ -172,22 +318,15 @@ int PutMask(double lat, double lon, int value)
        bits in the mask based on the latitude and longitude of the
        area pointed to. */
 
-    int x = 0, y = 0, indx;
-    char found;
+    int x, y, indx;
 
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (lat - dem[indx].min_north));
-        y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
-
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
-    }
+    if ((indx = FindPage(lat, lon, &x, &y)) >= 0) {
+        size_t cell = result_cell(x, y);
 
-    if (found) {
-        dem[indx].mask[x][y] = value;
-        return ((int)dem[indx].mask[x][y]);
+        if (!BlockCurrent(indx, cell))
+            RenewBlock(indx, cell);
+        dem[indx].mask[cell] = value;
+        return ((int)dem[indx].mask[cell]);
     }
 
     else
@@ -202,22 +341,16 @@ int OrMask(double lat, double lon, int value)
        the mask based on the latitude and longitude of the area
        pointed to. */
 
-    int x = 0, y = 0, indx;
-    char found;
-
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (lat - dem[indx].min_north));
-        y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
+    int x, y, indx;
 
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
-    }
+    if ((indx = FindPage(lat, lon, &x, &y)) >= 0) {
+        size_t cell = result_cell(x, y);
+        unsigned char *mask = &dem[indx].mask[cell];
 
-    if (found) {
-        dem[indx].mask[x][y] |= value;
-        return ((int)dem[indx].mask[x][y]);
+        if (!BlockCurrent(indx, cell))
+            RenewBlock(indx, cell);
+        *mask |= value;
+        return ((int)*mask);
     }
 
     else
@@ -227,45 +360,86 @@ int OrMask(double lat, double lon, int value)
 int GetMask(double lat, double lon)
 {
     /* This function returns the mask bits based on the latitude
-       and longitude given. */
+       and longitude given.  It only reads the mask, so blocks of
+       it no plot has written take no memory. */
 
-    return (OrMask(lat, lon, 0));
+    int x, y, indx;
+
+    if ((indx = FindPage(lat, lon, &x, &y)) >= 0)
+        return ((int)PageMask(indx, x, y));
+    else
+        return -1;
+}
+
+bool ClaimCell(double lat, double lon)
+{
+    /* Claims a location for the plot thread processing it.
+       Returns true the first time it is claimed, and false after,
+       so it is processed once however many paths cross it. */
+
+    int x, y, indx;
+
+    if ((indx = FindPage(lat, lon, &x, &y)) < 0)
+        return false;
+
+    size_t cell = result_cell(x, y);
+    uint64_t *word = &dem[indx].claims[cell / RESULT_BLOCK], bit = 1ULL << (cell % RESULT_BLOCK);
+
+    if (!BlockCurrent(indx, cell))
+        RenewBlock(indx, cell);
+
+    /* Looked at first, as most are claimed already */
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+        return false;
+    return (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0;
 }
 
 void PutSignal(double lat, double lon, unsigned char signal)
 {
-    int x = 0, y = 0, indx;
-    char found, dotfile[260], basename[255];
+    int x, y, indx;
 
     /* This function writes a signal level (0-255)
        at the specified location for later recall. */
 
-    snprintf(basename, 255, "%s", tx_site[0].filename);
-    strcpy(dotfile, basename);
-    strcat(dotfile, ".dot");
-
     if (signal > hottest)	// dBm, dBuV
         hottest = signal;
 
-    //lookup x/y for this co-ord
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (lat - dem[indx].min_north));
-        y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
+    if ((indx = FindPage(lat, lon, &x, &y)) >= 0) {
+        size_t cell = result_cell(x, y);
 
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
+        if (!BlockCurrent(indx, cell))
+            RenewBlock(indx, cell);
+        dem[indx].signal[cell] = signal;
     }
+}
 
-    if (found) {		// Write values to file
-        dem[indx].signal[x][y] = signal;
-        // return (dem[indx].signal[x][y]);
-        return;
+void PutValue(double lat, double lon, float value)
+{
+    /* Keeps the loss, field strength or power a PutSignal() level
+       was quantized from, if the plot keeps them.  Call after it. */
+
+    int x, y, indx;
+
+    if (result_values && (indx = FindPage(lat, lon, &x, &y)) >= 0) {
+        size_t cell = result_cell(x, y);
+
+        if (!BlockCurrent(indx, cell))
+            RenewBlock(indx, cell);
+        dem[indx].value[cell] = value;
     }
-    else
-      // return 0;
-      return;
+}
+
+float PageValue(int indx, int x, int y)
+{
+    /* Unquantized result of this plot at a page position, or NAN
+       where it has none.  A cell the plot claimed has one. */
+
+    size_t cell = result_cell(x, y);
+
+    if (dem[indx].value == NULL || !BlockCurrent(indx, cell) ||
+        !(dem[indx].claims[cell / RESULT_BLOCK] & (1ULL << (cell % RESULT_BLOCK))))
+        return NAN;
+    return dem[indx].value[cell];
 }
 
 unsigned char GetSignal(double lat, double lon)
@@ -274,53 +448,60 @@ unsigned char GetSignal(double lat, double lon)
        specified location that was previously written by the
        complimentary PutSignal() function. */
 
-    int x = 0, y = 0, indx;
-    char found;
-
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (lat - dem[indx].min_north));
-        y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
-
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
-    }
+    int x, y, indx;
 
-    if (found)
-        return (dem[indx].signal[x][y]);
+    if ((indx = FindPage(lat, lon, &x, &y)) >= 0)
+        return PageSignal(indx, x, y);
     else
         return 0;
 }
 
+short PageTerrain(int indx, int x, int y)
+{
+    /* Terrain height (in metres) at a page position, from the
+       packed blocks of the page if it has them.  Terrain evicted
+       by the residency manager is read back, and a read racing
+       an eviction is retried. */
+
+    unsigned gen;
+    short data;
+
+    if (dem[indx].blocks != NULL)
+        return blocks_get(dem[indx].blocks, x, y);
+
+    do {
+        gen = pages_need(indx);
+        data = dem[indx].data[0][page_cell(x, y)];
+    } while (!pages_valid(indx, gen));
+
+    return data;
+}
+
+static inline float PageElevation(int indx, int x, int y)
+{
+    /* Terrain plus clutter height (in metres) at a page position */
+
+    short data = PageTerrain(indx, x, y);
+
+    if (dem[indx].clutter != NULL)
+        return data + dem[indx].clutter[0][page_cell(x, y)];
+
+    return data;
+}
+
 double GetElevation(struct site location)
 {
     /* This function returns the elevation (in feet) of any location
-       represented by the digital elevation model data in memory.
+       represented by the digital elevation model data in memory,
+       including any clutter layer loaded over it.
        Function returns -5000.0 for locations not found in memory. */
 
-    char found;
-    int x = 0, y = 0, indx;
-    double elevation;
-
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (location.lat - dem[indx].min_north));
-        y = mpi -
-            (int)rint(yppd *
-                  (LonDiff(dem[indx].max_west, location.lon)));
+    int x, y, indx;
 
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
-    }
-
-    if (found)
-        elevation = 3.28084 * dem[indx].data[x][y];
+    if ((indx = FindPage(location.lat, location.lon, &x, &y)) >= 0)
+        return 3.28084 * PageElevation(indx, x, y);
     else
-        elevation = -5000.0;
-
-    return elevation;
+        return -5000.0;
 }
 
 int AddElevation(double lat, double lon, double height, int size)
@@ -330,28 +511,21 @@ int AddElevation(double lat, double lon, double height, int size)
        in memory.  Does nothing and returns 0 for locations
        not found in memory. */
 
-    char found;
     int i,j,x = 0, y = 0, indx;
+    char found = (indx = FindPage(lat, lon, &x, &y)) >= 0;
 
-    for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-        x = (int)rint(ppd * (lat - dem[indx].min_north));
-        y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
-
-        if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-            found = 1;
-        else
-            indx++;
-    }
+    if (found)
+        pages_pin(indx);
 
     if (found && size<2)
-        dem[indx].data[x][y] += (short)rint(height);
+        dem[indx].data[0][page_cell(x, y)] += (short)rint(height);
 
     // Make surrounding area bigger for wide area landcover. Should enhance 3x3 pixels including c.p
     if (found && size>1){
         for(i=size*-1; i <= size; i=i+1){
             for(j=size*-1; j <= size; j=j+1){
-                if(x+j >= 0 && x+j <=IPPD && y+i >= 0 && y+i <=IPPD)
-                    dem[indx].data[x+j][y+i] += (short)rint(height);
+                if(x+j >= 0 && x+j < IPPD && y+i >= 0 && y+i < IPPD)
+                    dem[indx].data[0][page_cell(x+j, y+i)] += (short)rint(height);
             }
 
         }
@@ -483,11 +657,10 @@ double ElevationAngle(struct site source, struct site destination)
 void ReadPath(struct site source, struct site destination)
 {
     
-    int c;
+    int c, samples, x, y, indx;
     double azimuth, distance, lat1, lon1, beta, den, num,
         lat2, lon2, total_distance, dx, dy, path_length,
         miles_per_sample, samples_per_radian = 68755.0;
-    struct site tempsite;
 
     lat1 = source.lat * DEG2RAD;
     lon1 = source.lon * DEG2RAD;
@@ -518,7 +691,6 @@ void ReadPath(struct site source, struct site destination)
 
         path.lat[c] = lat1;
         path.lon[c] = lon1;
-        path.elevation[c] = GetElevation(source);
         path.distance[c] = 0.0;
     }
 
@@ -559,21 +731,16 @@ void ReadPath(struct site source, struct site destination)
 
         path.lat[c] = lat2;
         path.lon[c] = lon2;
-        tempsite.lat = lat2;
-        tempsite.lon = lon2;
-        path.elevation[c] = GetElevation(tempsite);
-        // fix for tile gaps in multi-tile LIDAR plots
-        if(path.elevation[c]==0 && path.elevation[c-1] > 10)
-            path.elevation[c]=path.elevation[c-1];
         path.distance[c] = distance;
     }
 
+    samples = c;
+
     /* Make sure exact destination point is recorded at path.length-1 */
 
     if (c < ARRAYSIZE) {
         path.lat[c] = destination.lat;
         path.lon[c] = destination.lon;
-        path.elevation[c] = GetElevation(destination);
         path.distance[c] = total_distance;
         c++;
     }
@@ -582,6 +749,20 @@ void ReadPath(struct site source, struct site destination)
         path.length = c;
     else
         path.length = ARRAYSIZE - 1;
+
+    /* Gather the elevations (terrain plus clutter, in metres) for
+       the whole profile in one pass */
+
+    for (c = 0; c < path.length; c++) {
+        if ((indx = FindPage(path.lat[c], path.lon[c], &x, &y)) >= 0)
+            path.elevation[c] = PageElevation(indx, x, y);
+        else
+            path.elevation[c] = -5000.0 * METERS_PER_FOOT;
+
+        // fix for tile gaps in multi-tile LIDAR plots
+        if (c > 0 && c < samples && path.elevation[c] == 0 && path.elevation[c - 1] > 10 * METERS_PER_FOOT)
+            path.elevation[c] = path.elevation[c - 1];
+    }
 }
 
 double ElevationAngle2(struct site source, struct site destination, double er)
@@ -596,17 +777,21 @@ double ElevationAngle2(struct site source, struct site destination, double er)
     char block = 0;
     double source_alt, destination_alt, cos_xmtr_angle,
         cos_test_angle, test_alt, elevation, distance,
-        source_alt2, first_obstruction_angle = 0.0;
+        source_alt2, first_obstruction_angle = 0.0, earth, raise;
     struct path temp;
 
     temp = path;
 
     ReadPath(source, destination);
 
-    distance = FEET_PER_MILE * Distance(source, destination);
-    source_alt = er + source.alt + GetElevation(source);
-    destination_alt = er + destination.alt + GetElevation(destination);
+    /* The profile is in metres, so the geometry is too */
+
+    distance = METERS_PER_MILE * Distance(source, destination);
+    source_alt = METERS_PER_FOOT * (er + source.alt + GetElevation(source));
+    destination_alt = METERS_PER_FOOT * (er + destination.alt + GetElevation(destination));
     source_alt2 = source_alt * source_alt;
+    earth = METERS_PER_FOOT * earthradius;
+    raise = METERS_PER_FOOT * clutter;
 
     /* Calculate the cosine of the elevation angle of the
        destination (receiver) as seen by the source (transmitter). */
@@ -623,12 +808,12 @@ double ElevationAngle2(struct site source, struct site destination, double er)
        obstruction along the path between source and destination. */
 
     for (x = 2, block = 0; x < path.length && block == 0; x++) {
-        distance = FEET_PER_MILE * path.distance[x];
+        distance = METERS_PER_MILE * path.distance[x];
 
         test_alt =
-            earthradius + (path.elevation[x] ==
+            earth + (path.elevation[x] ==
                    0.0 ? path.elevation[x] : path.elevation[x] +
-                   clutter);
+                   raise);
 
         cos_test_angle =
             ((source_alt2) + (distance * distance) -
@@ -971,17 +1156,23 @@ void ObstructionAnalysis(struct site xmtr, struct site rcvr, double f,
 void free_dem(void)
 {
     int i;
-    int j;
 
     for (i = 0; i < MAXPAGES; i++) {
-        for (j = 0; j < IPPD; j++) {
-            delete [] dem[i].data[j];
-            delete [] dem[i].mask[j];
-            delete [] dem[i].signal[j];
-        }
+        if (dem[i].data == NULL)
+            continue;
+        mem_unmap(dem[i].data[0], layout_cells() * sizeof(short));
         delete [] dem[i].data;
-        delete [] dem[i].mask;
-        delete [] dem[i].signal;
+        mem_unmap(dem[i].mask, result_cells());
+        mem_unmap(dem[i].signal, result_cells());
+        if (dem[i].value != NULL)
+            mem_unmap(dem[i].value, result_cells() * sizeof(float));
+        mem_unmap(dem[i].claims, result_cells() / 8);
+        mem_unmap(dem[i].epochs, result_blocks() * result_blocks() * sizeof(uint32_t));
+        if (dem[i].clutter != NULL) {
+            mem_unmap(dem[i].clutter[0], layout_cells());
+            delete [] dem[i].clutter;
+        }
+        delete dem[i].blocks;
     }
     delete [] dem;
 }
@@ -1003,21 +1194,176 @@ void alloc_elev(void)
   elev  = new double[ARRAYSIZE + 10];
 }
 
+static void init_page(struct dem *page)
+{
+    page->min_el = 32768;
+    page->max_el = -32768;
+    page->min_north = 90;
+    page->max_north = -90;
+    page->min_west = 360;
+    page->max_west = -1;
+    page->data = NULL;
+    page->mask = NULL;
+    page->signal = NULL;
+    page->value = NULL;
+    page->claims = NULL;
+    page->epochs = NULL;
+    page->clutter = NULL;
+    page->blocks = NULL;
+}
+
 void alloc_dem(void)
 {
+    /* Pages start empty, their layers are allocated by
+       alloc_page() as tiles are loaded into them */
+
     int i;
-    int j;
 
     dem = new struct dem[MAXPAGES];
+    for (i = 0; i < MAXPAGES; i++)
+        init_page(&dem[i]);
+    pages_slots(MAXPAGES);
+}
+
+void grow_dem(int pages)
+{
+    /* Adds empty pages, up to pages in all.  Only safe while
+       no other thread is looking pages up */
+
+    struct dem *old = dem;
+    int i;
+
+    if (pages <= MAXPAGES)
+        return;
+
+    dem = new struct dem[pages];
+    for (i = 0; i < pages; i++) {
+        if (i < MAXPAGES)
+            dem[i] = old[i];
+        else
+            init_page(&dem[i]);
+    }
+    delete [] old;
+
+    spdlog::debug("Growing the DEM from {} to {} pages", MAXPAGES, pages);
+    MAXPAGES = pages;
+    pages_slots(MAXPAGES);
+}
+
+static void *map_layer(size_t bytes)
+{
+    /* A zeroed page layer.  It is mapped, so its memory is only
+       taken where it is written, and is placed near the thread
+       that first writes there */
+
+    void *block = mem_map(bytes);
+
+    if (block == NULL) {
+        spdlog::error("Cannot allocate {} MB for a DEM page layer", bytes >> 20);
+        exit(ENOMEM);
+    }
+    return block;
+}
+
+static unsigned char **alloc_layer(void)
+{
+    /* A zeroed byte layer, its rows in one block */
+
+    unsigned char **layer = new unsigned char *[IPPD];
+    unsigned char *block = (unsigned char *)map_layer(layout_cells());
+
+    for (int j = 0; j < IPPD; j++)
+        layer[j] = &block[(size_t)j * IPPD];
+    return layer;
+}
+
+void alloc_page(int indx)
+{
+    /* Allocates the layers of a page.  The terrain is mapped in
+       one block, so drop_page() can hand it back to the system */
+
+    short *block = (short *)map_layer(layout_cells() * sizeof(short));
+    int j;
+
+    dem[indx].data = new short *[IPPD];
+    for (j = 0; j < IPPD; j++)
+        dem[indx].data[j] = block + (size_t)j * IPPD;
+    dem[indx].mask = (unsigned char *)map_layer(result_cells());
+    dem[indx].signal = (unsigned char *)map_layer(result_cells());
+    if (result_values)
+        dem[indx].value = (float *)map_layer(result_cells() * sizeof(float));
+    dem[indx].claims = (uint64_t *)map_layer(result_cells() / 8);
+    dem[indx].epochs = (uint32_t *)map_layer(result_blocks() * result_blocks() * sizeof(uint32_t));
+}
+
+void drop_page(int indx)
+{
+    /* Hands the terrain of a page back to the system.  It reads
+       as sea level until loaded again */
+
+    madvise(dem[indx].data[0], layout_cells() * sizeof(short), MADV_DONTNEED);
+}
+
+void tile_page(int indx)
+{
+    /* Moves the terrain of a page, as the loaders leave it row by
+       row, into its tiles.  Only the ippd x ippd cells the loaders
+       fill are moved.  Tile rows are moved last first, as each lands
+       at or after where its rows were */
+
+    short *data = dem[indx].data[0];
+    std::vector<short> rows((size_t)LAYOUT_TILE * ippd);
+
+    if (!tiled_layout)
+        return;
+
+    for (int x0 = (ippd - 1) / LAYOUT_TILE * LAYOUT_TILE; x0 >= 0; x0 -= LAYOUT_TILE) {
+        int count = std::min(LAYOUT_TILE, ippd - x0);
+
+        for (int x = 0; x < count; x++)
+            std::copy(data + (size_t)(x0 + x) * IPPD, data + (size_t)(x0 + x) * IPPD + ippd, &rows[(size_t)x * ippd]);
+        for (int x = 0; x < count; x++)
+            for (int y = 0; y < ippd; y++)
+                data[page_cell(x0 + x, y)] = rows[(size_t)x * ippd + y];
+    }
+}
+
+void pack_page(int indx)
+{
+    /* Packs the terrain of a freshly loaded page into blocks,
+       and drops the unpacked terrain */
+
+    dem[indx].blocks = new dem_blocks_t;
+    blocks_pack(dem[indx].blocks, dem[indx].data, ippd);
+    drop_page(indx);
+
+    spdlog::debug("Packed page {} into {} KB", indx + 1, blocks_bytes(dem[indx].blocks) >> 10);
+}
+
+void unpack_page(int indx)
+{
+    /* Unpacks the terrain of a page, eg. to change it.  Only safe
+       while no other thread reads the page */
+
+    if (dem[indx].blocks == NULL)
+        return;
+
+    blocks_unpack(dem[indx].blocks, dem[indx].data);
+    delete dem[indx].blocks;
+    dem[indx].blocks = NULL;
+    tile_page(indx);
+}
+
+void alloc_clutter(void)
+{
+    /* The clutter layer is only allocated once clutter is loaded */
+
+    int i;
+
     for (i = 0; i < MAXPAGES; i++) {
-        dem[i].data = new short *[IPPD];
-        dem[i].mask = new unsigned char *[IPPD];
-        dem[i].signal = new unsigned char *[IPPD];
-        for (j = 0; j < IPPD; j++) {
-            dem[i].data[j] = new short[IPPD];
-            dem[i].mask[j] = new unsigned char[IPPD];
-            dem[i].signal[j] = new unsigned char[IPPD];
-        }
+        if (dem[i].data == NULL || dem[i].clutter != NULL)
+            continue;
+        dem[i].clutter = alloc_layer();
     }
 }
 
@@ -1025,26 +1371,15 @@ void alloc_path(void)
 {
     path.lat = new double[ARRAYSIZE];
     path.lon = new double[ARRAYSIZE];
-    path.elevation = new double[ARRAYSIZE];
+    path.elevation = new float[ARRAYSIZE];
     path.distance = new double[ARRAYSIZE];
 }
 
 void do_allocs(void)
 {
-    int i;
-
     alloc_elev();
     alloc_dem();
     alloc_path();
-
-    for (i = 0; i < MAXPAGES; i++) {
-        dem[i].min_el = 32768;
-        dem[i].max_el = -32768;
-        dem[i].min_north = 90;
-        dem[i].max_north = -90;
-        dem[i].min_west = 360;
-        dem[i].max_west = -1;
-    }
 }
 
 int main(int argc, char *argv[])
@@ -1061,11 +1396,19 @@ int main(int argc, char *argv[])
 
     bool use_radial = false;
 
+    bool pack = false;
+
+    bool mem_placement = false;
+
     unsigned char LRmap = 0, txsites = 0, topomap = 0, geo = 0, kml =
         0, area_mode = 0, max_txsites, ngs = 0;
 
     char mapfile[255], ano_filename[255], lidar_tiles[27000], clutter_file[255],antenna_file[255];
     char *az_filename, *el_filename, *udt_file = NULL;
+    char *xyz_dir = NULL;
+    int value_formats = 0;
+    bool kmz_output = false;
+    int zoom_min = -1, zoom_max = -1;
 
     double altitude = 0.0, altitudeLR = 0.0, tx_range = 0.0,
         rx_range = 0.0, deg_range = 0.0, deg_limit = 0.0, deg_range_lon;
@@ -1095,7 +1438,7 @@ int main(int argc, char *argv[])
 
     spdlog::info("Version {}.{} ({} {})", VER_MAJ, VER_MIN, GIT_BRANCH, GIT_COMMIT_HASH);
     spdlog::info("    Compile date: {} {}", __DATE__, __TIME__);
-    spdlog::info("    Built for {} DEM tiles at {} pixels", MAXPAGES, IPPD);
+    spdlog::info("    Built for {} DEM tiles at {} pixels, more on demand", MAXPAGES, IPPD);
     spdlog::info("");
 
     if (argc == 1) {
@@ -1107,10 +1450,15 @@ int main(int argc, char *argv[])
         fprintf(stdout, "Usage: signalserver [data options] [input options] [antenna options] [output options] -o outputfile\n\n");
         fprintf(stdout, "Data:\n");
         fprintf(stdout, "     -sdf Directory containing SRTM derived .sdf DEM tiles (may be .gz or .bz2)\n");
-        fprintf(stdout, "     -lid ASCII grid tile (LIDAR) with dimensions and resolution defined in header\n");
+        fprintf(stdout, "     -lid ASCII grid (.asc), GeoTIFF (.tif) or pyramid (.sdp) LIDAR tiles, or directories of them\n");
         fprintf(stdout, "     -udt User defined point clutter as decimal co-ordinates: 'latitude,longitude,height'\n");
         fprintf(stdout, "     -clt MODIS 17-class wide area clutter in ASCII grid format\n");
         fprintf(stdout, "     -color File to pre-load .scf/.lcf/.dcf for Signal/Loss/dBm color palette\n");
+        fprintf(stdout, "     -mem Memory budget for DEM tiles, eg. 512M or 4G (default: no limit)\n");
+        fprintf(stdout, "     -pack Keep DEM terrain packed in memory, for wide area plots\n");
+        fprintf(stdout, "     -tiled Keep DEM pages in 32x32 cell tiles, for faster lookups along paths\n");
+        fprintf(stdout, "     -alloc DEM page allocation: thp, hugetlb, interleave or local, comma separated (default: local)\n");
+        fprintf(stdout, "     -ooc Out of core: spill DEM pages, LIDAR tiles and results to files in this directory\n");
         fprintf(stdout, "Input:\n");
         fprintf(stdout,	"     -lat Tx Latitude (decimal degrees) -70/+70\n");
         fprintf(stdout,	"     -lon Tx Longitude (decimal degrees) -180/+180\n");
@@ -1133,6 +1481,13 @@ int main(int argc, char *argv[])
         fprintf(stdout, "     -segments Number of segments to divide the plot rectangle into (must be even and > 4)\n");
         fprintf(stdout, "Output:\n");
         fprintf(stdout, "     -o basename (Output file basename - required, min 5 chars)\n");
+        fprintf(stdout, "     -png Write the plot as PNG rather than PPM\n");
+        fprintf(stdout, "     -png32 Write the plot as RGBA PNG, white transparent\n");
+        fprintf(stdout, "     -png8 Write the plot as palette PNG, white transparent, if it has 256 colours or fewer\n");
+        fprintf(stdout, "     -kmz Write the plot as a Google Earth KMZ: a ground overlay of it as RGBA PNG, white transparent\n");
+        fprintf(stdout, "     -values Also export unquantized loss/signal/power as float32: tif (GeoTIFF), raw (.f32 + .json) or tif,raw\n");
+        fprintf(stdout, "     -xyz Also write the plot as Web Mercator z/x/y.png tiles, coverage only, to this directory\n");
+        fprintf(stdout, "     -zoom Tile zooms as MIN-MAX, 0 to 24 (default: 7 zooms, the highest near the plot resolution)\n");
         fprintf(stdout,	"     -dbm Plot Rxd signal power instead of field strength in dBuV/m\n");
         fprintf(stdout, "     -rt Rx Threshold (dB / dBm / dBuV/m)\n");
         fprintf(stdout, "     -R Radius (miles/kilometers)\n");
@@ -1375,6 +1730,56 @@ int main(int argc, char *argv[])
             }
         }
 
+        if (strcmp(argv[x], "-png") == 0 || strcmp(argv[x], "-png32") == 0 || strcmp(argv[x], "-png8") == 0) {
+            image_set_format(IMAGE_PNG);
+            image_set_png(argv[x][4] == '\0' ? IMAGE_PNG_RGB : argv[x][4] == '3' ? IMAGE_PNG_RGBA : IMAGE_PNG_PALETTE);
+        }
+
+        if (strcmp(argv[x], "-kmz") == 0) {
+            /* Laid over Google Earth, so white is transparent */
+            image_set_format(IMAGE_PNG);
+            image_set_png(IMAGE_PNG_RGBA);
+            SetKMZ(true);
+            kmz_output = true;
+        }
+
+        if (strcmp(argv[x], "-xyz") == 0) {
+            z = x + 1;
+
+            if (z <= y && argv[z][0] && argv[z][0] != '-')
+                xyz_dir = argv[z];
+        }
+
+        if (strcmp(argv[x], "-values") == 0) {
+            z = x + 1;
+
+            /* tif, raw, or both, comma separated */
+            if (z <= y && argv[z][0] && argv[z][0] != '-') {
+                value_formats = (strstr(argv[z], "tif") ? VALUES_TIFF : 0) | (strstr(argv[z], "raw") ? VALUES_RAW : 0);
+                if (value_formats == 0) {
+                    spdlog::error("Values must be tif, raw or tif,raw");
+                    exit(EINVAL);
+                }
+                result_values = true;
+            }
+        }
+
+        if (strcmp(argv[x], "-zoom") == 0) {
+            z = x + 1;
+
+            /* MIN-MAX, or one zoom */
+            if (z <= y && argv[z][0]) {
+                int n = sscanf(argv[z], "%d-%d", &zoom_min, &zoom_max);
+
+                if (n == 1)
+                    zoom_max = zoom_min;
+                if (n < 1 || zoom_min < 0 || zoom_max < zoom_min || zoom_max > 24) {
+                    spdlog::error("Zoom must be MIN-MAX, from 0 to 24");
+                    exit(EINVAL);
+                }
+            }
+        }
+
         if (strcmp(argv[x], "-rt") == 0) {
             z = x + 1;
 
@@ -1401,6 +1806,59 @@ int main(int argc, char *argv[])
                 strncpy(sdf_path, argv[z], 253);
         }
         
+        if (strcmp(argv[x], "-mem") == 0) {
+            z = x + 1;
+
+            if (z <= y && argv[z][0] && argv[z][0] != '-') {
+                const char *units = "KMGT", *u;
+                char *unit;
+                double bytes = strtod(argv[z], &unit);
+
+                // K, M, G or T suffixes, in powers of 1024
+                if (*unit && (u = strchr(units, toupper(*unit))) != NULL)
+                    bytes *= pow(1024, u - units + 1);
+                if (bytes < 1) {
+                    spdlog::error("Invalid memory budget \"{}\"", argv[z]);
+                    exit(EINVAL);
+                }
+                pages_budget((size_t)bytes);
+            }
+        }
+
+        if (strcmp(argv[x], "-pack") == 0) {
+            pack = true;
+            pages_pack(true);
+        }
+
+        if (strcmp(argv[x], "-alloc") == 0) {
+            z = x + 1;
+
+            if (z <= y && argv[z][0] && argv[z][0] != '-') {
+                if (mem_policy(argv[z]) != 0) {
+                    spdlog::error("Invalid allocation policy \"{}\"", argv[z]);
+                    exit(EINVAL);
+                }
+                mem_placement = true;
+            }
+        }
+
+        if (strcmp(argv[x], "-tiled") == 0)
+            tiled_layout = true;
+
+        if (strcmp(argv[x], "-ooc") == 0) {
+            z = x + 1;
+
+            if (z <= y && argv[z][0] && argv[z][0] != '-') {
+                int spill = mem_spill(argv[z]);
+
+                if (spill != 0) {
+                    spdlog::error("Cannot spill to \"{}\": {}", argv[z], strerror(spill));
+                    exit(spill);
+                }
+                mem_placement = true;
+            }
+        }
+
         if (strcmp(argv[x], "-lid") == 0) {
             z = x + 1;
             lidar=1;
@@ -1722,6 +2180,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (xyz_dir != NULL)
+        SetTilePyramid(xyz_dir, zoom_min, zoom_max);
+    if (value_formats != 0)
+        SetValueExport(mapfile, value_formats);
+
     if (debug) {
         spdlog::set_level(spdlog::level::debug);
         spdlog::debug("Debug logging enabled");
@@ -1791,6 +2254,16 @@ int main(int argc, char *argv[])
         exit(EINVAL);
     }
 
+    if (to_stdout == true && kmz_output) {
+        spdlog::error("Cannot write a KMZ to stdout");
+        exit(EINVAL);
+    }
+
+    if (to_stdout == true && value_formats != 0) {
+        spdlog::error("Cannot export values when writing to stdout");
+        exit(EINVAL);
+    }
+
     if(resample > 10){
         spdlog::error("Cannot resample higher than a factor of 10");
         exit(EINVAL);	
@@ -1899,11 +2372,15 @@ int main(int argc, char *argv[])
 
     /* Load the required tiles */
     if (lidar) {
-        if( (result = loadLIDAR(lidar_tiles, resample)) != 0 ){
+        if( (result = loadLIDAR(lidar_tiles, resample, &plot_bounds)) != 0 ){
             spdlog::error("Couldn't find one or more of the lidar files. Please ensure their paths are correct and try again.");
             spdlog::error("Error {}: {}", result, strerror(result));
             exit(result);
         }
+        if (pack)
+            pack_page(0);
+        else
+            tile_page(0);
 
         ppd=((double)height / (max_north-min_north));
         yppd=ppd;
@@ -1928,6 +2405,10 @@ int main(int argc, char *argv[])
             return result;
         }
 
+        // Area plots need every tile, so read ahead while they run
+        if (ppa == 0)
+            pages_prefetch();
+
         /*if (area_mode || topomap) {
             for (z = 0; z < txsites && z < max_txsites; z++) {
                 // "Ball park" estimates used to load any additional SDF files required to conduct this analysis.
@@ -2039,6 +2520,8 @@ int main(int argc, char *argv[])
         if (prop_model == LOS) {  // Model 2 = LOS
             cropping = false; // TODO: File is written in DoLOS() so this needs moving to PlotPropagation() to allow styling, cropping etc
             PlotLOSMap(tx_site[0], altitudeLR, ano_filename, use_threads, segments);
+            if ((result = pages_finish()) != 0)
+                return result;
             DoLOS(mapfile, geo, kml, ngs, tx_site, txsites);
         } else {
             // 90% of effort here
@@ -2053,6 +2536,12 @@ int main(int argc, char *argv[])
                 spdlog::debug("Finished PlotPropagation()");
             }
 
+            // The map shows terrain beyond the reach of the plot too
+            if ((result = pages_finish()) != 0) {
+                spdlog::error("Error loading topo data");
+                return result;
+            }
+
             if (cropping) {
                 // CROPPING Factor determined in propPathLoss().
                 // cropLon is the circle radius in pixels at it's widest (east/west) 
@@ -2069,7 +2558,7 @@ int main(int argc, char *argv[])
 
                 spdlog::debug("Cropping 2: max_west: {:.4f} cropLat: {:.4f} cropLon: {:.7f} longitude: {:.5f} width %d",max_west,cropLat,cropLon,tx_site[0].lon,width);
 
-                if (width > 3600 * 10 || cropLon < 0) {
+                if (width <= 0 || height <= 0 || cropLon < 0) {
                     spdlog::error("FATAL BOUNDS! max_west: {:.4f} cropLat: {:.4f} cropLon: {:.7f} longitude: {:.5f}",max_west,cropLat,cropLon,tx_site[0].lon);
                     return 0;
                 }
@@ -2109,6 +2598,8 @@ int main(int argc, char *argv[])
         // Order flipped for benefit of graph. Makes no difference to data.
         SeriesData(tx_site[1], tx_site[0], tx_site[0].filename, 1, normalise);
     }
+    if (mem_placement)
+        mem_report();
     fflush(stderr);
 
     return 0;
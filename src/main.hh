@@ -24,9 +24,17 @@ double LonDiff(double lon1, double lon2);
 void *dec2dms(double decimal, char *string);
 int PutMask(double lat, double lon, int value);
 int OrMask(double lat, double lon, int value);
+int FindPage(double lat, double lon, int *px, int *py);
 int GetMask(double lat, double lon);
+bool ClaimCell(double lat, double lon);
+void NewPlot(void);
+unsigned char PageMask(int indx, int x, int y);
+unsigned char PageSignal(int indx, int x, int y);
 void PutSignal(double lat, double lon, unsigned char signal);
 unsigned char GetSignal(double lat, double lon);
+void PutValue(double lat, double lon, float value);
+float PageValue(int indx, int x, int y);
+short PageTerrain(int indx, int x, int y);
 double GetElevation(struct site location);
 int AddElevation(double lat, double lon, double height, int size);
 double Distance(struct site site1, struct site site2);
@@ -42,6 +50,13 @@ void free_dem(void);
 void alloc_elev(void);
 void alloc_path(void);
 void alloc_dem(void);
+void grow_dem(int pages);
+void alloc_page(int indx);
+void drop_page(int indx);
+void pack_page(int indx);
+void unpack_page(int indx);
+void tile_page(int indx);
+void alloc_clutter(void);
 void do_allocs(void);
 
 #endif /* _MAIN_HH_ */
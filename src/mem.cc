@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mem.hh"
+
+#define HUGE_PAGE	(2UL << 20)
+#define MAX_NODES	1024
+
+typedef struct _mem_region_t{
+	size_t	bytes;		/* mapped, rounded up to huge pages for MAP_HUGETLB */
+	bool	hugetlb;
+	bool	spilled;	/* backed by a file in the spill directory */
+} mem_region_t;
+
+static int policy = 0;
+static bool hugetlb_failed = false;
+static std::string spill_dir;		/* empty unless out of core */
+static size_t spill_bytes = 0;		/* mapped from files there */
+static std::mutex regions_mutex;
+static std::map<char *, mem_region_t> regions;	/* every live mapping, by address */
+
+/* Highest NUMA node online, 0 if the system does not say */
+static int max_node(void){
+	FILE *fd = fopen("/sys/devices/system/node/online", "r");
+	int node, last = 0;
+	char sep;
+
+	if (fd == NULL)
+		return 0;
+	/* eg. "0", "0-1" or "0-3,6" */
+	while (fscanf(fd, "%d%c", &node, &sep) >= 1) {
+		last = std::max(last, node);
+		if (sep == '\n')
+			break;
+	}
+	fclose(fd);
+
+	return std::min(last, MAX_NODES - 1);
+}
+
+/*
+ * mem_policy
+ * Sets the allocation policy from a comma separated list of "thp",
+ * "hugetlb", "interleave" and "local", the default. Returns 0, or EINVAL
+ * if the list holds anything else.
+ */
+int mem_policy(const char *spec){
+	std::string list = spec;
+	size_t start = 0;
+
+	policy = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+		if (name == "thp")
+			policy |= MEM_THP;
+		else if (name == "hugetlb")
+			policy |= MEM_HUGETLB;
+		else if (name == "interleave")
+			policy |= MEM_INTERLEAVE;
+		else if (name == "local")
+			policy &= ~MEM_INTERLEAVE;
+		else
+			return EINVAL;
+
+		if (end == std::string::npos)
+			break;
+		start = end + 1;
+	}
+	return 0;
+}
+
+/*
+ * mem_spill
+ * Backs every mapping from here on with a file in dir, for out of core
+ * plots. Returns 0, or the errno met creating a file there.
+ */
+int mem_spill(const char *dir){
+	std::string name = std::string(dir) + "/ss-spill-XXXXXX";
+	int fd;
+
+	if ((fd = mkstemp(&name[0])) < 0)
+		return errno;
+	close(fd);
+	unlink(name.c_str());
+
+	spill_dir = dir;
+	return 0;
+}
+
+/* True if mappings are spilled to disk */
+bool mem_spilling(void){
+	return !spill_dir.empty();
+}
+
+/* Maps bytes from a new file in the spill directory, unlinked so it goes
+ * when unmapped, or returns MAP_FAILED */
+static void *map_spilled(size_t bytes){
+	std::string name = spill_dir + "/ss-spill-XXXXXX";
+	struct statvfs fs;
+	void *addr;
+	int fd;
+
+	/* Writing to a mapping past the end of the disk raises SIGBUS, so
+	 * the space is checked for, if not reserved */
+	if (statvfs(spill_dir.c_str(), &fs) == 0 && (size_t)fs.f_bavail * fs.f_frsize < bytes) {
+		spdlog::error("{} has {} MB free, too little to spill another {} MB", spill_dir,
+				((size_t)fs.f_bavail * fs.f_frsize) >> 20, bytes >> 20);
+		return MAP_FAILED;
+	}
+	if ((fd = mkstemp(&name[0])) < 0)
+		return MAP_FAILED;
+	unlink(name.c_str());
+
+	addr = ftruncate(fd, bytes) == 0 ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	return addr;
+}
+
+/*
+ * mem_map
+ * Maps bytes of zeroed memory under the allocation policy, none of it
+ * touched yet. Returns NULL if there is not enough.
+ */
+void *mem_map(size_t bytes){
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	mem_region_t region = {bytes, false, false};
+	void *addr = MAP_FAILED;
+
+	if (!spill_dir.empty()) {
+		/* The kernel writes back and reads in its pages as memory
+		 * runs short, so huge pages do not apply */
+		if ((addr = map_spilled(bytes)) == MAP_FAILED)
+			return NULL;
+		region.spilled = true;
+		spill_bytes += bytes;
+	} else if ((policy & MEM_HUGETLB) && !hugetlb_failed) {
+		region.bytes = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+		addr = mmap(NULL, region.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (addr == MAP_FAILED) {
+			/* Too few reserved in /proc/sys/vm/nr_hugepages */
+			spdlog::warn("No reserved huge pages for DEM pages ({}), using transparent huge pages", strerror(errno));
+			hugetlb_failed = true;
+			region.bytes = bytes;
+		} else
+			region.hugetlb = true;
+	}
+
+	if (addr == MAP_FAILED && (addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return NULL;
+
+	if (!region.hugetlb && !region.spilled && (policy & (MEM_THP | MEM_HUGETLB)))
+		madvise(addr, region.bytes, MADV_HUGEPAGE);
+
+	if (policy & MEM_INTERLEAVE) {
+		unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+		int last = max_node();
+
+		for (int node = 0; node <= last; node++)
+			mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_mbind, addr, region.bytes, MPOL_INTERLEAVE, mask, last + 2, 0) != 0)
+			spdlog::debug("Cannot interleave DEM pages: {}", strerror(errno));
+	}
+
+	regions[(char *)addr] = region;
+
+	return addr;
+}
+
+/* Unmaps memory from mem_map() */
+void mem_unmap(void *addr, size_t bytes){
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	auto region = regions.find((char *)addr);
+
+	if (region != regions.end()) {
+		bytes = region->second.bytes;
+		if (region->second.spilled)
+			spill_bytes -= bytes;
+		regions.erase(region);
+	}
+	munmap(addr, bytes);
+}
+
+/*
+ * mem_report
+ * Logs how much of the memory mapped so far is in use, on which NUMA
+ * nodes, and how much of it on huge pages.
+ */
+void mem_report(void){
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	std::vector<size_t> node_bytes(max_node() + 1, 0);
+	size_t mapped = 0, resident = 0, huge = 0, other = 0;
+	long page = sysconf(_SC_PAGESIZE);
+
+	/* Where each page is, asked of move_pages() a batch at a time */
+	for (auto &region : regions) {
+		size_t step = region.second.hugetlb ? HUGE_PAGE : page;
+		std::vector<void *> pages;
+		std::vector<int> status;
+
+		mapped += region.second.bytes;
+		for (size_t offset = 0; offset < region.second.bytes; offset += pages.size() * step) {
+			size_t count = std::min((region.second.bytes - offset + step - 1) / step, (size_t)4096);
+
+			pages.resize(count);
+			status.assign(count, -ENOENT);
+			for (size_t i = 0; i < count; i++)
+				pages[i] = region.first + offset + i * step;
+			if (syscall(SYS_move_pages, 0, count, pages.data(), NULL, status.data(), 0) != 0)
+				break;
+
+			/* Negative for pages not in memory yet */
+			for (int node : status) {
+				if (node < 0)
+					continue;
+				resident += step;
+				if (region.second.hugetlb)
+					huge += step;
+				if (node < (int)node_bytes.size())
+					node_bytes[node] += step;
+				else
+					other += step;
+			}
+		}
+	}
+
+	/* Transparent huge pages show in smaps as AnonHugePages */
+	FILE *fd = fopen("/proc/self/smaps", "r");
+	char line[256];
+	bool ours = false;
+
+	while (fd != NULL && fgets(line, sizeof(line), fd) != NULL) {
+		unsigned long start, end, kb;
+
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			auto region = regions.upper_bound((char *)end - 1);
+
+			ours = region != regions.begin() && !(--region)->second.hugetlb &&
+				region->first + region->second.bytes > (char *)start;
+		} else if (ours && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+			huge += kb << 10;
+	}
+	if (fd != NULL)
+		fclose(fd);
+
+	std::string nodes;
+	for (size_t i = 0; i < node_bytes.size(); i++)
+		nodes += fmt::format("{}node {}: {:.1f} MB, {:.0f}%", i ? "; " : "", i, node_bytes[i] / 1048576.0,
+				resident ? 100.0 * node_bytes[i] / resident : 0.0);
+	if (other != 0)
+		nodes += fmt::format("; unknown: {:.1f} MB", other / 1048576.0);
+
+	spdlog::info("DEM pages: {:.1f} MB mapped, {:.1f} MB in memory ({}), {:.1f} MB of it on huge pages",
+			mapped / 1048576.0, resident / 1048576.0, nodes, huge / 1048576.0);
+	if (!spill_dir.empty())
+		spdlog::info("DEM pages: {:.1f} MB of them spilled to {}", spill_bytes / 1048576.0, spill_dir);
+}
@@ -0,0 +1,35 @@
+#ifndef _MEM_HH_
+#define _MEM_HH_
+
+#include <stddef.h>
+
+/*
+ * Allocation policy for the large DEM page layers. Layers are mapped
+ * rather than allocated, so none of their memory is touched until a
+ * loader or plot thread first writes to it, and by default the kernel
+ * places it on that thread's NUMA node. A policy (-alloc) may instead
+ * back them with transparent or reserved huge pages, fewer TLB entries
+ * covering the same terrain, and interleave them over every node, so no
+ * node serves every thread. mem_report() logs where they ended up.
+ *
+ * Out of core (-ooc), layers are instead mapped from unlinked files in a
+ * spill directory, so the kernel writes their pages back to disk and reads
+ * them in again as memory runs short, and a plot may need more than the
+ * machine has. Huge page policies do not apply to them.
+ */
+
+/* Policy flags */
+enum {
+	MEM_THP = 1,		/* transparent huge pages, madvise(MADV_HUGEPAGE) */
+	MEM_HUGETLB = 2,	/* reserved huge pages, MAP_HUGETLB */
+	MEM_INTERLEAVE = 4	/* pages spread round robin over the NUMA nodes */
+};
+
+int mem_policy(const char *spec);
+int mem_spill(const char *dir);
+bool mem_spilling(void);
+void *mem_map(size_t bytes);
+void mem_unmap(void *addr, size_t bytes);
+void mem_report(void);
+
+#endif
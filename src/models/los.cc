@@ -19,95 +19,15 @@
 #include <limits.h>
 
 namespace {
-	bool ***processed;
-	bool has_init_processed = false;
-
     // Storage for processing threads
     std::vector<std::thread> threads;
 
     // Storage for processing thread futures
     std::vector<std::future<void *>> futures;
 
-    // Mutex for processed vector
-    std::mutex maskMutex;
-
     // Thread progress vector
     std::vector<progress_t> thread_progress;
 
-    // This is a 3D vector of the pixels & layers in our plot that have or have not been processed
-    std::vector<std::vector<std::vector<bool>>> processedPoints;
-
-	void init_processed()
-	{
-		int i;
-		int x;
-		int y;
-
-		/*processed = new bool **[MAXPAGES];
-		for (i = 0; i < MAXPAGES; i++) {
-			processed[i] = new bool *[ippd];
-			for (x = 0; x < ippd; x++)
-				processed[i][x] = new bool [ippd];
-		}*/
-
-        // Initialize our vector to the correct size (this is ugly but apparently the best way to do this)
-        processedPoints = std::vector<std::vector<std::vector<bool>>>(MAXPAGES, std::vector<std::vector<bool>>(ippd, std::vector<bool>(ippd)));
-
-        // Populate our processedPoints vector with the points to process
-		for (i = 0; i < MAXPAGES; i++) {
-			for (x = 0; x < ippd; x++) {
-				for (y = 0; y < ippd; y++) {
-                    processedPoints[i][x][y] = false;
-					//processed[i][x][y] = false;
-                } 
-			}
-		}
-
-        spdlog::debug("Initialized processedPoints vector of side {}x{}x{}", MAXPAGES, ippd, ippd);
-
-		has_init_processed = true;
-	}
-
-	bool can_process(double lat, double lon)
-	{
-		/* Lines, text, markings, and coverage areas are stored in a
-		mask that is combined with topology data when topographic
-		maps are generated by ss.  This function sets bits in
-		the mask based on the latitude and longitude of the area
-		pointed to. */
-
-		int x, y, indx;
-		char found;
-		bool rtn = false;
-
-		for (indx = 0, found = 0; indx < MAXPAGES && found == 0;) {
-			x = (int)rint(ppd * (lat - dem[indx].min_north));
-			y = mpi - (int)rint(yppd * (LonDiff(dem[indx].max_west, lon)));
-
-			if (x >= 0 && x <= mpi && y >= 0 && y <= mpi)
-				found = 1;
-			else
-				indx++;
-		}
-
-		if (found) {
-			/* As long as we only set this without resetting it we can
-			check outside a mutex first without worrying about race 
-			conditions. But we must lock the mutex before updating the 
-			value. */
-			if(!processedPoints[indx][x][y]) {
-				maskMutex.lock();
-				if(!processedPoints[indx][x][y]) {
-					rtn = true;
-					processedPoints[indx][x][y] = true;
-				}
-				maskMutex.unlock();
-			}
-
-		}
-		return rtn;
-	}
-
     /**
      * Calulate a propagation for a specific range
      * 
@@ -278,6 +198,11 @@ namespace {
             // Update print
             spdlog::info("[{: 3d}%] Processing {}/{} points", int(points_processed * 100 / total_points), points_processed, total_points);
         }
+
+        // The threads may still be reading their parameters, which the caller frees on return
+        for (auto& f : futures)
+            f.wait();
+        futures.clear();
     }
 }
 
@@ -350,6 +275,7 @@ void PlotLOSPath(struct site source, struct site destination, char mask_value)
     int x, iCounter;
     double cos_angle, cos_test_angle, cos_horizon_angle, cos_limit_angle, rx_alt2;
     double distance, rx_alt, tx_alt, limit_alt, distance2, tx_alt2, test_alt, test_alt2, limit_alt2;
+    double earth, raise;
 
     ReadPath(source, destination);
 
@@ -365,20 +291,24 @@ void PlotLOSPath(struct site source, struct site destination, char mask_value)
     bStop = false;
     iCounter = 0;
 
-    /* altitude limit of 32808 feets or 10000 meters */
-    limit_alt = earthradius + 32808.0;
+    /* The profile is in metres, so the geometry is too */
+    earth = METERS_PER_FOOT * earthradius;
+    raise = METERS_PER_FOOT * clutter;
+
+    /* altitude limit of 10000 meters */
+    limit_alt = earth + 10000.0;
     limit_alt2 = limit_alt * limit_alt;
 
-    tx_alt = earthradius + source.alt + path.elevation[0];
+    tx_alt = earth + METERS_PER_FOOT * source.alt + path.elevation[0];
     tx_alt2 = tx_alt * tx_alt;
 
     for (x = 0; (bStop == false) && (x < (path.length - 1)) && (path.distance[x] <= max_range); x++) {
 
         if (x > 0) {
-            distance = FEET_PER_MILE * path.distance[x];
+            distance = METERS_PER_MILE * path.distance[x];
             distance2 = distance * distance;
 
-            rx_alt = earthradius + destination.alt + path.elevation[x];
+            rx_alt = earth + METERS_PER_FOOT * destination.alt + path.elevation[x];
             rx_alt2 = rx_alt * rx_alt;
 
             /* Calculate the cosine of the elevation between
@@ -394,7 +324,7 @@ void PlotLOSPath(struct site source, struct site destination, char mask_value)
                 cos_angle = -1.0;
             }
 
-            test_alt = earthradius + (path.elevation[x] == 0.0 ? path.elevation[x] : path.elevation[x] + clutter);
+            test_alt = earth + (path.elevation[x] == 0.0 ? path.elevation[x] : path.elevation[x] + raise);
             test_alt2 = test_alt * test_alt;
 
             /* Calculate the cosine of the elevation between
@@ -411,7 +341,7 @@ void PlotLOSPath(struct site source, struct site destination, char mask_value)
            an obstruction exists.
            Mark this point only if it hasn't been already marked */
 
-        if ((cos_horizon_angle >= cos_angle) && ((GetMask(path.lat[x], path.lon[x]) & mask_value) == 0) && (can_process(path.lat[x], path.lon[x]))) {
+        if ((cos_horizon_angle >= cos_angle) && ((GetMask(path.lat[x], path.lon[x]) & mask_value) == 0) && ClaimCell(path.lat[x], path.lon[x])) {
             OrMask(path.lat[x], path.lon[x], mask_value);
         }
 
@@ -472,29 +402,27 @@ void PlotPropPath(
 	    xmtr_alt, dest_alt, xmtr_alt2, dest_alt2,
 	    cos_rcvr_angle, cos_test_angle = 0.0, test_alt,
 	    elevation = 0.0, distance = 0.0, four_thirds_earth,
-	    field_strength = 0.0, rxp, dBm, diffloss;
+	    field_strength = 0.0, rxp, dBm, diffloss, raise;
 	struct site temp;
 	float dkm;
 
 	ReadPath(source, destination);
 
-	four_thirds_earth = FOUR_THIRDS * EARTHRADIUS;
+	/* The profile is in metres, so the geometry is too */
+	four_thirds_earth = FOUR_THIRDS * EARTHRADIUS * METERS_PER_FOOT;
+	raise = clutter * METERS_PER_FOOT;
 
 	for (x = 1; x < path.length - 1; x++)
 		elev[x + 2] =
 		    (path.elevation[x] ==
-		     0.0 ? path.elevation[x] * METERS_PER_FOOT : (clutter +
-								  path.
-								  elevation[x])
-		     * METERS_PER_FOOT);
+		     0.0 ? path.elevation[x] : raise + path.elevation[x]);
 
 
 	/* Copy ending points without clutter */
 
-	elev[2] = path.elevation[0] * METERS_PER_FOOT;
+	elev[2] = path.elevation[0];
 
-	elev[path.length + 1] =
-	    path.elevation[path.length - 1] * METERS_PER_FOOT;
+	elev[path.length + 1] = path.elevation[path.length - 1];
 
 	/* Since the only energy the Longley-Rice model considers
 	   reaching the destination is based on what is scattered
@@ -512,17 +440,17 @@ void PlotPropPath(
 		/* Process this point only if it
 		   has not already been processed. */
 
-		if ( (GetMask(path.lat[y], path.lon[y]) & 248) !=
-			(mask_value << 3) && can_process(path.lat[y], path.lon[y])) {
+		if (ClaimCell(path.lat[y], path.lon[y])) {
 
 			char fd_buffer[64];
 			int buffer_offset = 0;
 
-			distance = FEET_PER_MILE * path.distance[y];
+			distance = METERS_PER_MILE * path.distance[y];
 			xmtr_alt =
-			    four_thirds_earth + source.alt + path.elevation[0];
+			    four_thirds_earth + source.alt * METERS_PER_FOOT +
+			    path.elevation[0];
 			dest_alt =
-			    four_thirds_earth + destination.alt +
+			    four_thirds_earth + destination.alt * METERS_PER_FOOT +
 			    path.elevation[y];
 			dest_alt2 = dest_alt * dest_alt;
 			xmtr_alt2 = xmtr_alt * xmtr_alt;
@@ -547,13 +475,13 @@ void PlotPropPath(
 
 				for (x = 2, block = 0; (x < y && block == 0);
 				     x++) {
-					distance = FEET_PER_MILE * path.distance[x];
+					distance = METERS_PER_MILE * path.distance[x];
 
 					test_alt =
 					    four_thirds_earth +
 					    (path.elevation[x] ==
 					     0.0 ? path.elevation[x] : path.
-					     elevation[x] + clutter);
+					     elevation[x] + raise);
 
 					/* Calculate the cosine of the elevation
 					   angle of the terrain (test point)
@@ -608,8 +536,8 @@ void PlotPropPath(
 			    METERS_PER_MILE * (path.distance[y] -
 					       path.distance[y - 1]);
 
-			if (path.elevation[y] < 1) {
-				path.elevation[y] = 1;
+			if (path.elevation[y] < METERS_PER_FOOT) {
+				path.elevation[y] = METERS_PER_FOOT;
 			}
 
 			dkm = (elev[1] * elev[0]) / 1000;	// km
@@ -633,15 +561,14 @@ void PlotPropPath(
                     //HATA 1, 2 & 3
                     loss =
                         HATApathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-                            (path.elevation[y] * METERS_PER_FOOT) +	 (destination.alt * METERS_PER_FOOT), dkm, pmenv);
+                            path.elevation[y] +	 (destination.alt * METERS_PER_FOOT), dkm, pmenv);
                     break;
                 
                 case ECC33:
                     // ECC33
                     loss =
                         ECC33pathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-                            (path.elevation[y] *
-                            METERS_PER_FOOT) +
+                            path.elevation[y] +
                             (destination.alt *
                             METERS_PER_FOOT), dkm,
                             pmenv);
@@ -651,8 +578,7 @@ void PlotPropPath(
                     // SUI
                     loss =
                         SUIpathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-                            (path.elevation[y] *
-                            METERS_PER_FOOT) +
+                            path.elevation[y] +
                             (destination.alt *
                             METERS_PER_FOOT), dkm, pmenv);
                     break;
@@ -661,8 +587,7 @@ void PlotPropPath(
                     // COST231-Hata
                     loss =
                         COST231pathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-                            (path.elevation[y] *
-                            METERS_PER_FOOT) +
+                            path.elevation[y] +
                                 (destination.alt *
                                 METERS_PER_FOOT), dkm,
                                 pmenv);
@@ -690,8 +615,7 @@ void PlotPropPath(
                     // Ericsson
                     loss =
                         EricssonpathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-                            (path.elevation[y] *
-                            METERS_PER_FOOT) +
+                            path.elevation[y] +
                                 (destination.alt *
                                 METERS_PER_FOOT), dkm,
                                 pmenv);
@@ -699,12 +623,12 @@ void PlotPropPath(
                 
                 case PLANE_EARTH:
                     // Plane earth
-                    loss =	PlaneEarthLoss(dkm, source.alt * METERS_PER_FOOT, (path.elevation[y] * METERS_PER_FOOT) + (destination.alt * METERS_PER_FOOT));
+                    loss =	PlaneEarthLoss(dkm, source.alt * METERS_PER_FOOT, path.elevation[y] + (destination.alt * METERS_PER_FOOT));
                     break;
                 
                 case ELGI_V_U:
                     // Egli VHF/UHF
-                    loss = EgliPathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT, (path.elevation[y] * METERS_PER_FOOT) + (destination.alt * METERS_PER_FOOT),dkm);
+                    loss = EgliPathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT, path.elevation[y] + (destination.alt * METERS_PER_FOOT),dkm);
                     break;
                 
                 case SOIL:
@@ -801,6 +725,7 @@ void PlotPropPath(
 
 					PutSignal(path.lat[y], path.lon[y],
 						  (unsigned char)ifs);
+					PutValue(path.lat[y], path.lon[y], dBm);
 
 				}
 
@@ -827,6 +752,7 @@ void PlotPropPath(
 
 					PutSignal(path.lat[y], path.lon[y],
 						  (unsigned char)ifs);
+					PutValue(path.lat[y], path.lon[y], field_strength);
 
 					if (fd != NULL)
 						buffer_offset += sprintf(fd_buffer+buffer_offset,
@@ -848,6 +774,7 @@ void PlotPropPath(
 
 				PutSignal(path.lat[y], path.lon[y],
 					  (unsigned char)ifs);
+				PutValue(path.lat[y], path.lon[y], loss);
 			}
 
 			if (fd != NULL) {
@@ -856,12 +783,6 @@ void PlotPropPath(
 						" *");
 				fprintf(fd, "%s\n", fd_buffer);
 			}
-
-			/* Mark this point as having been analyzed */
-
-			PutMask(path.lat[y], path.lon[y],
-				(GetMask(path.lat[y], path.lon[y]) & 7) +
-				(mask_value << 3));
 		}
 	}
 
@@ -888,9 +809,12 @@ void PlotLOSMap(struct site source, double altitude, char *plo_filename,
 	   of a topographic map when the WritePPM() function
 	   is later invoked. */
 
-	static __thread unsigned char mask_value = 1;
+	/* Each plot starts on an empty mask, see NewPlot() */
+	unsigned char mask_value = 1;
 	FILE *fd = NULL;
 
+	NewPlot();
+
 	if (plo_filename[0] != 0)
 		fd = fopen(plo_filename, "wb");
 
@@ -941,19 +865,6 @@ void PlotLOSMap(struct site source, double altitude, char *plo_filename,
 		finishThreads();
 
 	delete[] r;
-
-	switch (mask_value) {
-	case 1:
-		mask_value = 8;
-		break;
-
-	case 8:
-		mask_value = 16;
-		break;
-
-	case 16:
-		mask_value = 32;
-	}
 }
 
 /// @brief Plot propagation from a source using a bounding box and the specified plot parameters
@@ -972,10 +883,12 @@ void PlotPropagation(struct site source, bbox bounds,
 		            PropModel prop_model, int knifeedge, int haf, int pmenv, bool
 		            use_threads, uint8_t segments)
 {
-	static __thread unsigned char mask_value = 1;
+	unsigned char mask_value = 1;
 	FILE *fd = NULL;
 
     char plotType[32];
+
+	NewPlot();
 	
 	if (LR.erp == 0.0 && debug)
 		sprintf(plotType, "path loss");
@@ -1104,11 +1017,6 @@ void PlotPropagation(struct site source, bbox bounds,
     // Size our progress vector appropriately
     thread_progress = std::vector<progress_t>(segments);
     
-    // Init our vector for storing processing progress
-    if (!has_init_processed) {
-        init_processed();
-    }
-
     // Iterate over the final list of ranges
     for (size_t i = 0; i < ranges.size(); i++) {
         // Set common variables
@@ -1148,9 +1056,6 @@ void PlotPropagation(struct site source, bbox bounds,
 
     if (fd != NULL)
 		fclose(fd);
-
-	if (mask_value < 30)
-		mask_value++;
 }
 
 void PlotPropagationRadius(struct site source, double range, 
@@ -1173,9 +1078,11 @@ void PlotPropagationRadius(struct site source, double range,
         exit(1);
     }
 
-    static __thread unsigned char mask_value = 1;
+    unsigned char mask_value = 1;
 	FILE *fd = NULL;
 
+    NewPlot();
+
     // Get plot type string
     char plotType[32];
 	if (LR.erp == 0.0 && debug)
@@ -1274,11 +1181,6 @@ void PlotPropagationRadius(struct site source, double range,
     // Size our progress vector appropriately
     thread_progress = std::vector<progress_t>(segments);
 
-    // Init our vector for storing processing progress
-    if (!has_init_processed) {
-        init_processed();
-    }
-
     // Iterate over the final list of ranges
     for (size_t i = 0; i < radii.size(); i++) {
         // Set the segment id
@@ -1311,11 +1213,6 @@ void PlotPropagationRadius(struct site source, double range,
     {
         fclose(fd);
     }
-
-	if (mask_value < 30)
-    {
-        mask_value++;
-    }
 }
 
 void PlotPath(struct site source, struct site destination, char mask_value)
@@ -1332,19 +1229,24 @@ void PlotPath(struct site source, struct site destination, char mask_value)
 	char block;
 	int x, y;
 	register double cos_xmtr_angle, cos_test_angle, test_alt;
-	double distance, rx_alt, tx_alt;
+	double distance, rx_alt, tx_alt, earth, raise;
 
+	NewPlot();
 	ReadPath(source, destination);
 
+	/* The profile is in metres, so the geometry is too */
+	earth = METERS_PER_FOOT * earthradius;
+	raise = METERS_PER_FOOT * clutter;
+
 	for (y = 0; y < path.length; y++) {
 		/* Test this point only if it hasn't been already
 		   tested and found to be free of obstructions. */
 
 		if ((GetMask(path.lat[y], path.lon[y]) & mask_value) == 0) {
-			distance = FEET_PER_MILE * path.distance[y];
-			tx_alt = earthradius + source.alt + path.elevation[0];
+			distance = METERS_PER_MILE * path.distance[y];
+			tx_alt = earth + METERS_PER_FOOT * source.alt + path.elevation[0];
 			rx_alt =
-			    earthradius + destination.alt + path.elevation[y];
+			    earth + METERS_PER_FOOT * destination.alt + path.elevation[y];
 
 			/* Calculate the cosine of the elevation of the
 			   transmitter as seen at the temp rx point. */
@@ -1355,13 +1257,13 @@ void PlotPath(struct site source, struct site destination, char mask_value)
 
 			for (x = y, block = 0; x >= 0 && block == 0; x--) {
 				distance =
-				    FEET_PER_MILE * (path.distance[y] -
+				    METERS_PER_MILE * (path.distance[y] -
 					      path.distance[x]);
 				test_alt =
-				    earthradius + (path.elevation[x] ==
+				    earth + (path.elevation[x] ==
 						   0.0 ? path.
 						   elevation[x] : path.
-						   elevation[x] + clutter);
+						   elevation[x] + raise);
 
 				cos_test_angle =
 				    ((rx_alt * rx_alt) + (distance * distance) -
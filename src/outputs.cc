@@ -3,10 +3,20 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <bzlib.h>
 #include <zlib.h>
 
 #include <spdlog/spdlog.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "common.hh"
 #include "main.hh"
@@ -20,6 +30,812 @@
 #include "models/itwom3.0.hh"
 #include "models/sui.hh"
 #include "image.hh"
+#include "geotiff.hh"
+#include "kmz.hh"
+#include "outputs.hh"
+
+/*
+ * Map rendering. The four maps share one render core: each result cell is
+ * looked up in a 256 entry table, by its signal byte or, for LOS maps, by
+ * its transmitter mask bits, built once per map from the palette, and
+ * terrain is shaded from a table by elevation. Output rows are mapped to
+ * the pages they cross, and columns to page columns, up front, and bands
+ * of rows are rendered on every core, streamed to the file in order where
+ * the image format allows, or else straight into the canvas. The same
+ * lookups draw Web Mercator tiles (-xyz) from the plot.
+ */
+
+enum { RENDER_LOSS, RENDER_SIGNAL, RENDER_DBM, RENDER_LOS };
+
+#define RENDER_BAND	32	/* rows a thread renders at a time */
+#define TILE_SIZE	256	/* pixels across a Web Mercator tile */
+#define TILE_ZOOM_MAX	24
+#define VALUES_NODATA	-9999.0	/* exported where the plot found nothing */
+
+/* A page a row of the map crosses, and the page row there */
+typedef struct _crossing_t{
+	int indx, x0;
+} crossing_t;
+
+typedef struct _render_t{
+	int kind;
+	uint8_t paint[256][RGB_SIZE];	/* by signal byte, or LOS mask bits */
+	bool shaded[256];		/* shows the terrain instead */
+	uint8_t label[256][RGB_SIZE];	/* text labels over it */
+	uint8_t border[RGB_SIZE];	/* county boundaries */
+	uint8_t missing[RGB_SIZE];	/* off every page */
+	double one_over_gamma, conversion;
+	std::vector<uint8_t> grey;	/* by metres above min_elevation */
+	std::vector<std::vector<crossing_t>> rows;	/* pages each map row crosses */
+	std::vector<std::vector<int>> columns;	/* page column of each map column, by page */
+} render_t;
+
+/* A Web Mercator tile pyramid (-xyz), written beside each map if set */
+static std::string tile_dir;
+static int tile_zoom_min = -1, tile_zoom_max = -1;	/* -1 to fit the map */
+
+/* Maps written as KMZ (-kmz), the image kept in memory until then */
+static bool kmz_output = false;
+static char *kmz_image = NULL;
+static size_t kmz_bytes = 0;
+
+/* Unquantized results (-values), exported beside each map if set */
+static std::string value_base;
+static int value_formats = 0;
+
+/* LOS map colours, by the mask bits of transmitters 1 to 4 */
+static const struct {
+	int bits;
+	uint8_t rgb[RGB_SIZE];
+} los_colors[] = {
+	{1, {0, 255, 0}},	/* TX1: Green */
+	{8, {0, 255, 255}},	/* TX2: Cyan */
+	{9, {255, 255, 0}},	/* TX1 + TX2: Yellow */
+	{16, {147, 112, 219}},	/* TX3: Medium Violet */
+	{17, {255, 192, 203}},	/* TX1 + TX3: Pink */
+	{24, {255, 165, 0}},	/* TX2 + TX3: Orange */
+	{25, {0, 100, 0}},	/* TX1 + TX2 + TX3: Dark Green */
+	{32, {255, 130, 71}},	/* TX4: Sienna 1 */
+	{33, {173, 255, 47}},	/* TX1 + TX4: Green Yellow */
+	{40, {193, 255, 193}},	/* TX2 + TX4: Dark Sea Green 1 */
+	{41, {255, 235, 205}},	/* TX1 + TX2 + TX4: Blanched Almond */
+	{48, {0, 206, 209}},	/* TX3 + TX4: Dark Turquoise */
+	{49, {0, 250, 154}},	/* TX1 + TX3 + TX4: Medium Spring Green */
+	{56, {210, 180, 140}},	/* TX2 + TX3 + TX4: Tan */
+	{57, {238, 201, 0}}	/* TX1 + TX2 + TX3 + TX4: Gold2 */
+};
+
+static inline void set_rgb(uint8_t *px, unsigned red, unsigned green, unsigned blue)
+{
+	px[0] = red;
+	px[1] = green;
+	px[2] = blue;
+}
+
+/* The palette entry a signal byte falls in, region.levels if none. Path
+   loss levels run up from level[0], signal and power levels down. */
+static int render_match(int kind, int value)
+{
+	int z;
+
+	if (kind == RENDER_LOSS) {
+		if (value <= region.level[0])
+			return 0;
+		for (z = 1; z < region.levels; z++)
+			if (value >= region.level[z - 1] && value < region.level[z])
+				return z;
+	} else {
+		value -= kind == RENDER_DBM ? 200 : 100;
+		if (value >= region.level[0])
+			return 0;
+		for (z = 1; z < region.levels; z++)
+			if (value < region.level[z - 1] && value >= region.level[z])
+				return z;
+	}
+	return region.levels;
+}
+
+/*
+ * render_tables
+ * Fills in how a map of this kind paints each signal byte or LOS mask,
+ * from the palette loaded for it, and the grey terrain is shaded with.
+ */
+static void render_tables(render_t *r, int kind, unsigned char ngs)
+{
+	unsigned red, green, blue;
+	int value, match, e;
+	bool hidden;
+
+	r->kind = kind;
+	set_rgb(r->border, 0, 0, 0);
+	set_rgb(r->missing, 255, 255, 255);
+
+	for (value = 0; value < 256; value++) {
+		set_rgb(r->label[value], 255, 0, 0);
+		if (kind == RENDER_LOS) {
+			/* No terrain (ngs) shows as white */
+			r->shaded[value] = !ngs;
+			set_rgb(r->paint[value], 255, 255, 255);
+			continue;
+		}
+
+		match = render_match(kind, value);
+		red = green = blue = 0;
+		if (match < region.levels) {
+			red = region.color[match][0];
+			green = region.color[match][1];
+			blue = region.color[match][2];
+		}
+
+		/* Red labels invert over a red region, except over no loss or
+		   0 dBm */
+		if (red >= 180 && green <= 75 && blue <= 75 &&
+		    (kind == RENDER_LOSS ? value == 0 : kind != RENDER_DBM || value != 200))
+			set_rgb(r->label[value], 255 ^ red, 255 ^ green, 255 ^ blue);
+
+		/* Past the contour threshold, only terrain shows */
+		if (kind == RENDER_LOSS)
+			hidden = value == 0 || (contour_threshold != 0 && value > abs(contour_threshold));
+		else
+			hidden = contour_threshold != 0 &&
+				value - (kind == RENDER_DBM ? 200 : 100) < contour_threshold;
+
+		if (!hidden && (red != 0 || green != 0 || blue != 0)) {
+			r->shaded[value] = false;
+			set_rgb(r->paint[value], red, green, blue);
+		} else {
+			/* Uncoloured path loss shows terrain even with ngs */
+			r->shaded[value] = !ngs || (kind == RENDER_LOSS && !hidden);
+			set_rgb(r->paint[value], 255, 255, 255);
+		}
+	}
+
+	if (kind == RENDER_LOS) {
+		set_rgb(r->border, 128, 128, 255);	/* Light Cyan */
+		for (auto &los : los_colors) {
+			r->shaded[los.bits] = false;
+			memcpy(r->paint[los.bits], los.rgb, RGB_SIZE);
+		}
+	} else if (kind == RENDER_LOSS)
+		set_rgb(r->missing, 0, 0, 0);
+
+	r->one_over_gamma = 1.0 / GAMMA;
+	r->conversion = 255.0 / pow((double)(max_elevation - min_elevation), r->one_over_gamma);
+	r->grey.clear();
+	for (e = min_elevation; e <= max_elevation; e++)
+		r->grey.push_back((unsigned)(0.5 + pow((double)(e - min_elevation), r->one_over_gamma) * r->conversion));
+}
+
+/* Shades land grey by elevation, and sea level medium blue */
+static inline void render_terrain(const render_t *r, short elevation, uint8_t *px)
+{
+	unsigned terrain;
+
+	if (elevation == 0) {
+		set_rgb(px, 0, 0, 170);
+		return;
+	}
+	if (elevation >= min_elevation && elevation - min_elevation < (int)r->grey.size())
+		terrain = r->grey[elevation - min_elevation];
+	else
+		terrain = (unsigned)(0.5 + pow((double)(elevation - min_elevation), r->one_over_gamma) * r->conversion);
+	set_rgb(px, terrain, terrain, terrain);
+}
+
+/*
+ * render_grid
+ * Maps each row of the map, north - dpp*y, to the pages it crosses and
+ * each column, max_west - dpp*x, to its column on those pages.
+ */
+static void render_grid(render_t *r)
+{
+	r->rows.assign(height, std::vector<crossing_t>());
+	r->columns.assign(MAXPAGES, std::vector<int>());
+
+	/* The pages each row's latitude crosses, and their page row */
+	for (int y = 0; y < (int)height; y++) {
+		double lat = north - (dpp * (double)y);
+
+		for (int indx = 0; indx < MAXPAGES; indx++) {
+			int x0 = (int)rint(ppd * (lat - (double)dem[indx].min_north));
+
+			if (x0 >= 0 && x0 <= mpi)
+				r->rows[y].push_back({indx, x0});
+		}
+	}
+
+	/* The page column under each output column, on pages any row crosses */
+	for (int y = 0; y < (int)height; y++) {
+		for (auto &crossing : r->rows[y]) {
+			std::vector<int> &column = r->columns[crossing.indx];
+
+			if (!column.empty())
+				continue;
+			column.resize(width);
+			for (int x = 0; x < (int)width; x++) {
+				double lon = max_west - (dpp * (double)x);
+
+				if (lon < 0.0)
+					lon += 360.0;
+				column[x] = mpi - (int)rint(ppd * (LonDiff((double)dem[crossing.indx].max_west, lon)));
+			}
+		}
+	}
+}
+
+/* The first page, in page order, holding map pixel x, y and its column
+ * there, or NULL if none does */
+static inline const crossing_t *render_find(const render_t *r, int x, int y, int *y0)
+{
+	for (auto &crossing : r->rows[y]) {
+		*y0 = r->columns[crossing.indx][x];
+		if (*y0 >= 0 && *y0 <= mpi)
+			return &crossing;
+	}
+	return NULL;
+}
+
+/* Paints a page cell from the tables, or returns false if the terrain
+ * shows there instead */
+static inline bool render_paint(const render_t *r, const crossing_t *at, int y0, uint8_t *px)
+{
+	unsigned char mask = PageMask(at->indx, at->x0, y0);
+	int value = r->kind == RENDER_LOS ? mask & 57 : PageSignal(at->indx, at->x0, y0);
+
+	if (mask & 2)
+		memcpy(px, r->label[value], RGB_SIZE);
+	else if (mask & 4)
+		memcpy(px, r->border, RGB_SIZE);
+	else if (r->shaded[value])
+		return false;
+	else
+		memcpy(px, r->paint[value], RGB_SIZE);
+	return true;
+}
+
+/*
+ * render_map
+ * Renders the map over the top height rows of the image, north up and
+ * east right, rotated from dem[][]. A pixel shows the first page, in page
+ * order, whose cells it falls in. If the format can, the image is
+ * streamed to fd, bands written in order as they are finished while later
+ * ones render, and no canvas is kept. Returns 0, or the errno met adding
+ * rows.
+ */
+static int render_map(image_ctx_t *ctx, render_t *r, FILE *fd)
+{
+	render_grid(r);
+
+	auto render_row = [&](int y, uint8_t *px) {
+		for (int x = 0; x < (int)width; x++, px += RGB_SIZE) {
+			const crossing_t *at;
+			int y0;
+
+			if ((at = render_find(r, x, y, &y0)) == NULL)
+				memcpy(px, r->missing, RGB_SIZE);	/* We should never get here */
+			else if (!render_paint(r, at, y0, px))
+				render_terrain(r, PageTerrain(at->indx, at->x0, y0), px);
+		}
+	};
+
+	size_t nbands = (height + RENDER_BAND - 1) / RENDER_BAND;
+	size_t nthreads = std::min((size_t)MAX(std::thread::hardware_concurrency(), 1u), nbands);
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next(0);
+
+	if (fd != NULL)
+		image_stream(ctx, fd);	/* ENOSYS keeps the canvas */
+
+	if (image_row(ctx, 0) != NULL) {
+		/* Straight into the canvas, in any order */
+		auto worker = [&]() {
+			size_t b;
+
+			while ((b = next++) < nbands)
+				for (size_t y = b * RENDER_BAND; y < std::min((b + 1) * RENDER_BAND, (size_t)height); y++)
+					render_row(y, image_row(ctx, y));
+		};
+
+		for (size_t t = 1; t < nthreads; t++)
+			threads.push_back(std::thread(worker));
+		worker();
+		for (auto &th : threads)
+			th.join();
+		return 0;
+	}
+
+	/* Bands are rendered into a ring of slots, each handed on in order
+	   here as soon as it and those before it are done, and its slot
+	   reused. Workers wait for a slot rather than run ahead. Bands take
+	   a millisecond or so, so waits just yield. */
+	size_t nslots = 2 * nthreads, band_bytes = (size_t)RENDER_BAND * width * RGB_SIZE;
+	std::vector<uint8_t> slots(nslots * band_bytes);
+	std::unique_ptr<std::atomic<size_t>[]> done(new std::atomic<size_t>[nslots]);
+	std::atomic<size_t> added(0);
+	int success = 0;
+
+	for (size_t i = 0; i < nslots; i++)
+		done[i] = SIZE_MAX;
+
+	auto worker = [&]() {
+		size_t b;
+
+		while ((b = next++) < nbands) {
+			while (b >= added + nslots)
+				std::this_thread::yield();
+
+			uint8_t *band = &slots[(b % nslots) * band_bytes];
+			for (size_t y = b * RENDER_BAND; y < std::min((b + 1) * RENDER_BAND, (size_t)height); y++)
+				render_row(y, band + (y - b * RENDER_BAND) * width * RGB_SIZE);
+			done[b % nslots] = b;
+		}
+	};
+
+	for (size_t t = 0; t < nthreads; t++)
+		threads.push_back(std::thread(worker));
+	for (size_t b = 0; b < nbands; b++) {
+		while (done[b % nslots] != b)
+			std::this_thread::yield();
+
+		/* Once writing fails, the rest are only drained */
+		if (success == 0)
+			success = image_add_rows(ctx, &slots[(b % nslots) * band_bytes],
+					std::min((size_t)RENDER_BAND, height - b * RENDER_BAND));
+		added = b + 1;
+	}
+	for (auto &th : threads)
+		th.join();
+
+	return success;
+}
+
+/* The western edge of the map, degrees east */
+static double map_west(void)
+{
+	return fmod(540.0 - max_west - dpp / 2.0, 360.0) - 180.0;
+}
+
+/*
+ * SetKMZ
+ * Has maps written as a KMZ for Google Earth, their PNG laid over the box
+ * they cover, rather than as an image file.
+ */
+void SetKMZ(bool on)
+{
+	kmz_output = on;
+}
+
+/* Opens where the image of a map goes: mapfile, or with -kmz, memory it is
+ * kept in until map_close() puts it in the KMZ */
+static FILE *map_open(const char *mapfile)
+{
+	if (!kmz_output)
+		return fopen(mapfile, "wb");
+	return open_memstream(&kmz_image, &kmz_bytes);
+}
+
+/*
+ * map_close
+ * Closes the image of a map. With -kmz, writes it to mapfile.kmz instead,
+ * in place of the extension, with a KML ground overlay laying it over the
+ * rows and columns of the map. Returns 0, or an errno.
+ */
+static int map_close(FILE *fd, const char *mapfile)
+{
+	std::string name = mapfile, kmz;
+	size_t dot = name.rfind('.'), slash = name.rfind('/');
+	kmz_box_t box;
+	int success = 0;
+
+	if (fclose(fd) != 0)
+		success = errno;
+	if (!kmz_output)
+		return success;
+
+	kmz = name.substr(0, dot) + ".kmz";
+	name = name.substr(slash == std::string::npos ? 0 : slash + 1);
+	box.north = north + dpp / 2.0;
+	box.south = north - dpp * (height - 0.5);
+	box.west = map_west();
+	box.east = box.west + dpp * width;
+	if (box.east > 180.0)
+		box.east -= 360.0;
+
+	if (success == 0 && (fd = fopen(kmz.c_str(), "wb")) == NULL)
+		success = errno;
+	else if (success == 0) {
+		success = kmz_write(fd, name.substr(0, name.rfind('.')).c_str(), name.c_str(),
+				(const uint8_t *)kmz_image, kmz_bytes, &box);
+		if (fclose(fd) != 0 && success == 0)
+			success = errno;
+		if (success == 0)
+			spdlog::info("Wrote {}, {} overlaid on {:.6f}N {:.6f}E to {:.6f}N {:.6f}E", kmz, name,
+					box.south, box.west, box.north, box.east);
+	}
+
+	free(kmz_image);
+	kmz_image = NULL;
+	kmz_bytes = 0;
+	return success;
+}
+
+/*
+ * SetTilePyramid
+ * Has each map also written to dir as a Web Mercator tile pyramid,
+ * dir/z/x/y.png, from zoom_min to zoom_max, or zooms fitting the map
+ * where they are -1.
+ */
+void SetTilePyramid(const char *dir, int zoom_min, int zoom_max)
+{
+	tile_dir = dir;
+	tile_zoom_min = zoom_min;
+	tile_zoom_max = zoom_max;
+}
+
+typedef struct _xyz_t{
+	const render_t *r;
+	int zoom_min, zoom_max;
+	std::atomic<size_t> written;
+} xyz_t;
+
+/* The tile row holding latitude lat, of n */
+static long tile_row(double lat, long n)
+{
+	double rad = std::min(std::max(lat, -85.0511), 85.0511) * DEG2RAD;
+	long ty = (long)floor((1.0 - log(tan(rad) + 1.0 / cos(rad)) / PI) / 2.0 * n);
+
+	return std::min(std::max(ty, 0L), n - 1);
+}
+
+/* The tiles of zoom z the map reaches: columns x0 to x1, which run past
+ * the last and wrap if the map crosses 180 degrees, and rows y0 to y1 */
+static void tile_range(int z, long *x0, long *x1, long *y0, long *y1)
+{
+	long n = 1L << z;
+	double west = map_west();
+
+	*x0 = (long)floor((west + 180.0) / 360.0 * n);
+	*x1 = std::min((long)floor((west + dpp * width + 180.0) / 360.0 * n), *x0 + n - 1);
+	*y0 = tile_row(north + dpp / 2.0, n);
+	*y1 = tile_row(north - dpp * (height - 0.5), n);
+}
+
+/* True if tile tx, ty of zoom z holds any of the map */
+static bool tile_reached(int z, long tx, long ty)
+{
+	long x0, x1, y0, y1, n = 1L << z;
+
+	tile_range(z, &x0, &x1, &y0, &y1);
+	return ty >= y0 && ty <= y1 && ((tx - x0) % n + n) % n <= x1 - x0;
+}
+
+/* The tiles of zoom z the map reaches, as x, y */
+static std::vector<std::pair<long, long>> tile_list(int z)
+{
+	std::vector<std::pair<long, long>> tiles;
+	long x0, x1, y0, y1, n = 1L << z;
+
+	tile_range(z, &x0, &x1, &y0, &y1);
+	for (long ty = y0; ty <= y1; ty++)
+		for (long tx = x0; tx <= x1; tx++)
+			tiles.push_back({tx % n, ty});
+	return tiles;
+}
+
+/* Renders tile tx, ty of zoom z from the map, clear where it shows terrain,
+ * white or nothing, and returns whether any of it is not */
+static bool tile_render(const render_t *r, int z, long tx, long ty, uint8_t *tile)
+{
+	double n = (double)(1L << z) * TILE_SIZE;
+	int columns[TILE_SIZE];
+	bool covered = false;
+
+	/* The map column under each tile column, west positive */
+	for (int i = 0; i < TILE_SIZE; i++) {
+		double lon = 360.0 * ((tx * TILE_SIZE + i + 0.5) / n) - 180.0;
+
+		columns[i] = (int)rint((fmod(max_west + lon + 720.0 + dpp / 2.0, 360.0) - dpp / 2.0) / dpp);
+	}
+
+	memset(tile, 0, TILE_SIZE * TILE_SIZE * RGBA_SIZE);
+	for (int j = 0; j < TILE_SIZE; j++) {
+		double lat = atan(sinh(PI * (1.0 - 2.0 * (ty * TILE_SIZE + j + 0.5) / n))) / DEG2RAD;
+		int y = (int)rint((north - lat) / dpp);
+		uint8_t *px = tile + j * TILE_SIZE * RGBA_SIZE;
+
+		if (y < 0 || y >= (int)height)
+			continue;
+		for (int i = 0; i < TILE_SIZE; i++, px += RGBA_SIZE) {
+			const crossing_t *at;
+			int y0;
+
+			if (columns[i] < 0 || columns[i] >= (int)width || (at = render_find(r, columns[i], y, &y0)) == NULL)
+				continue;
+			if (render_paint(r, at, y0, px) && (px[0] & px[1] & px[2]) != 255) {
+				px[3] = 255;
+				covered = true;
+			} else
+				memset(px, 0, RGBA_SIZE);
+		}
+	}
+	return covered;
+}
+
+/* Shrinks a tile into quadrant qx, qy of the one over it, each 2x2 block
+ * to a pixel, its colour weighted by alpha */
+static void tile_shrink(const uint8_t *tile, uint8_t *parent, long qx, long qy)
+{
+	const size_t stride = TILE_SIZE * RGBA_SIZE;
+
+	for (int j = 0; j < TILE_SIZE / 2; j++) {
+		uint8_t *out = parent + (qy * TILE_SIZE / 2 + j) * stride + qx * (TILE_SIZE / 2) * RGBA_SIZE;
+		const uint8_t *in = tile + 2 * j * stride;
+
+		for (int i = 0; i < TILE_SIZE / 2; i++, in += 2 * RGBA_SIZE, out += RGBA_SIZE) {
+			const uint8_t *block[4] = {in, in + RGBA_SIZE, in + stride, in + stride + RGBA_SIZE};
+			unsigned sum[3] = {0, 0, 0}, alpha = 0;
+
+			for (const uint8_t *px : block) {
+				alpha += px[3];
+				for (int c = 0; c < 3; c++)
+					sum[c] += px[c] * px[3];
+			}
+			if (alpha == 0)
+				continue;
+			for (int c = 0; c < 3; c++)
+				out[c] = (sum[c] + alpha / 2) / alpha;
+			out[3] = (alpha + 2) / 4;
+		}
+	}
+}
+
+/* Writes tile tx, ty of zoom z as z/x/y.png under the tile directory */
+static int tile_write(xyz_t *p, int z, long tx, long ty, const uint8_t *tile)
+{
+	std::string path = tile_dir;
+	image_ctx_t ctx;
+	FILE *fd;
+	int success;
+
+	for (long part : {(long)z, tx}) {
+		path += "/" + std::to_string(part);
+		if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+			return errno;
+	}
+	path += "/" + std::to_string(ty) + ".png";
+
+	if ((fd = fopen(path.c_str(), "wb")) == NULL)
+		return errno;
+	if ((success = image_init(&ctx, TILE_SIZE, TILE_SIZE, IMAGE_RGBA, IMAGE_PNG)) == 0) {
+		image_stream(&ctx, fd);
+		if ((success = image_add_rows(&ctx, tile, TILE_SIZE)) == 0)
+			success = image_write(&ctx, fd);
+		image_free(&ctx);
+	}
+	if (fclose(fd) != 0 && success == 0)
+		success = errno;
+	p->written++;
+	return success;
+}
+
+/* Builds tile tx, ty of zoom z, rendered at the highest zoom or else shrunk
+ * from the four under it, writing those with coverage from the lowest zoom
+ * on. Returns whether it has any, the errno met writing in *success. */
+static bool tile_build(xyz_t *p, int z, long tx, long ty, uint8_t *tile, int *success)
+{
+	bool covered = false;
+
+	if (z == p->zoom_max)
+		covered = tile_render(p->r, z, tx, ty, tile);
+	else {
+		std::vector<uint8_t> under(TILE_SIZE * TILE_SIZE * RGBA_SIZE);
+
+		memset(tile, 0, under.size());
+		for (long q = 0; q < 4; q++) {
+			if (tile_reached(z + 1, 2 * tx + q % 2, 2 * ty + q / 2) &&
+			    tile_build(p, z + 1, 2 * tx + q % 2, 2 * ty + q / 2, under.data(), success)) {
+				tile_shrink(under.data(), tile, q % 2, q / 2);
+				covered = true;
+			}
+		}
+	}
+
+	if (covered && z >= p->zoom_min && *success == 0)
+		*success = tile_write(p, z, tx, ty, tile);
+	return covered;
+}
+
+/*
+ * render_xyz
+ * Writes the map as a Web Mercator tile pyramid, to be laid over a base
+ * map, only tiles with coverage written. The highest zoom is rendered from
+ * the map, in subtrees on every core from the first zoom with a few for
+ * each, and every lower one shrunk from the tiles under it. Returns 0, or
+ * the errno met writing a tile.
+ */
+static int render_xyz(const render_t *r)
+{
+	xyz_t p;
+	unsigned nthreads = MAX(std::thread::hardware_concurrency(), 1u);
+	int z, success = 0;
+
+	p.r = r;
+	p.written = 0;
+	p.zoom_max = tile_zoom_max;
+	p.zoom_min = tile_zoom_min;
+
+	/* Tile pixels about as wide as map pixels */
+	if (p.zoom_max < 0)
+		p.zoom_max = std::min(std::max((int)lrint(log2(360.0 / (dpp * TILE_SIZE))), 0), TILE_ZOOM_MAX);
+	if (p.zoom_min < 0)
+		p.zoom_min = std::max(p.zoom_max - 6, 0);
+	p.zoom_min = std::min(p.zoom_min, p.zoom_max);
+
+	if (mkdir(tile_dir.c_str(), 0755) != 0 && errno != EEXIST)
+		return errno;
+
+	std::vector<std::pair<long, long>> tiles;
+	for (z = p.zoom_min; ; z++) {
+		tiles = tile_list(z);
+		if (z == p.zoom_max || tiles.size() >= 4 * nthreads)
+			break;
+	}
+
+	/* The subtrees, keeping their tiles if lower zooms are to come */
+	std::vector<std::vector<uint8_t>> built(tiles.size());
+	std::vector<int> failed(nthreads, 0);
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next(0);
+
+	auto worker = [&](unsigned t) {
+		std::vector<uint8_t> tile(TILE_SIZE * TILE_SIZE * RGBA_SIZE);
+		size_t i;
+
+		while ((i = next++) < tiles.size())
+			if (tile_build(&p, z, tiles[i].first, tiles[i].second, tile.data(), &failed[t]) && z > p.zoom_min)
+				built[i] = tile;
+	};
+
+	for (unsigned t = 1; t < nthreads; t++)
+		threads.push_back(std::thread(worker, t));
+	worker(0);
+	for (auto &th : threads)
+		th.join();
+	for (int f : failed)
+		if (f != 0)
+			return f;
+
+	/* Lower zooms, each tile from those under it */
+	for (; z > p.zoom_min && success == 0; z--) {
+		std::map<std::pair<long, long>, std::vector<uint8_t>> parents;
+
+		for (size_t i = 0; i < tiles.size(); i++) {
+			if (built[i].empty())
+				continue;
+
+			std::vector<uint8_t> &parent = parents[{tiles[i].first / 2, tiles[i].second / 2}];
+			if (parent.empty())
+				parent.assign(built[i].size(), 0);
+			tile_shrink(built[i].data(), parent.data(), tiles[i].first % 2, tiles[i].second % 2);
+		}
+
+		tiles.clear();
+		built.clear();
+		for (auto &parent : parents) {
+			if (success == 0)
+				success = tile_write(&p, z - 1, parent.first.first, parent.first.second, parent.second.data());
+			tiles.push_back(parent.first);
+			built.push_back(std::move(parent.second));
+		}
+	}
+
+	spdlog::info("Wrote {} tiles, zoom {} to {}, to {}", p.written.load(), p.zoom_min, p.zoom_max, tile_dir);
+	return success;
+}
+
+/*
+ * SetValueExport
+ * Has each loss, signal or power map also export the unquantized results
+ * it was drawn from, as basename.tif and/or basename.f32 and .json, per
+ * formats (VALUES_*).
+ */
+void SetValueExport(const char *basename, int formats)
+{
+	value_base = basename;
+	value_formats = formats;
+}
+
+/*
+ * render_values
+ * Writes the loss, field strength or power at each pixel of the map, as
+ * the plot found it rather than quantized, VALUES_NODATA where it found
+ * none: a float32 GeoTIFF, and raw float32 rows with a JSON header
+ * saying how to read them. Returns 0, or the errno met writing.
+ */
+static int render_values(const render_t *r)
+{
+	std::vector<float> values((size_t)width * height);
+	size_t nbands = (height + RENDER_BAND - 1) / RENDER_BAND;
+	size_t nthreads = std::min((size_t)MAX(std::thread::hardware_concurrency(), 1u), nbands);
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next(0);
+	int success = 0;
+
+	auto worker = [&]() {
+		size_t b;
+
+		while ((b = next++) < nbands)
+			for (size_t y = b * RENDER_BAND; y < std::min((b + 1) * RENDER_BAND, (size_t)height); y++)
+				for (size_t x = 0; x < width; x++) {
+					const crossing_t *at;
+					float value = NAN;
+					int y0;
+
+					if ((at = render_find(r, x, y, &y0)) != NULL)
+						value = PageValue(at->indx, at->x0, y0);
+					values[y * width + x] = isnan(value) ? VALUES_NODATA : value;
+				}
+	};
+
+	for (size_t t = 1; t < nthreads; t++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (auto &th : threads)
+		th.join();
+
+	/* The top left corner of the first pixel, degrees east */
+	double west = map_west(), top = north + dpp / 2.0;
+	const char *quantity = r->kind == RENDER_LOSS ? "path loss" : r->kind == RENDER_DBM ? "received power" : "field strength";
+	const char *units = r->kind == RENDER_LOSS ? "dB" : r->kind == RENDER_DBM ? "dBm" : "dBuV/m";
+
+	if (value_formats & VALUES_TIFF) {
+		std::string name = value_base + ".tif";
+
+		if ((success = geotiff_write(name.c_str(), values.data(), width, height, west, top, dpp, VALUES_NODATA)) != 0)
+			return success;
+		spdlog::info("Wrote {} ({} x {} float32 {} in {})", name, width, height, quantity, units);
+	}
+
+	if (value_formats & VALUES_RAW) {
+		std::string name = value_base + ".f32", header = value_base + ".json";
+		size_t slash = name.rfind('/');
+		const uint16_t one = 1;
+		FILE *fd;
+
+		if ((fd = fopen(name.c_str(), "wb")) == NULL)
+			return errno;
+		if (fwrite(values.data(), sizeof(float), values.size(), fd) != values.size())
+			success = EIO;
+		if (fclose(fd) != 0 && success == 0)
+			success = errno;
+		if (success != 0)
+			return success;
+
+		if ((fd = fopen(header.c_str(), "w")) == NULL)
+			return errno;
+		fprintf(fd, "{\n"
+			"  \"file\": \"%s\",\n"
+			"  \"width\": %zu,\n"
+			"  \"height\": %zu,\n"
+			"  \"type\": \"float32\",\n"
+			"  \"byte_order\": \"%s\",\n"
+			"  \"crs\": \"EPSG:4326\",\n"
+			"  \"west\": %.10f,\n"
+			"  \"north\": %.10f,\n"
+			"  \"cellsize\": %.12g,\n"
+			"  \"nodata\": %g,\n"
+			"  \"quantity\": \"%s\",\n"
+			"  \"units\": \"%s\"\n"
+			"}\n",
+			name.c_str() + (slash == std::string::npos ? 0 : slash + 1), (size_t)width, (size_t)height,
+			*(const unsigned char *)&one ? "little" : "big", west, top, dpp, VALUES_NODATA, quantity, units);
+		if (fclose(fd) != 0)
+			return errno;
+		spdlog::info("Wrote {} ({} x {} float32 {} in {}) and {}", name, width, height, quantity, units, header);
+	}
+
+	return 0;
+}
 
 void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 		unsigned char ngs, struct site *xmtr, unsigned char txsites)
@@ -31,10 +847,8 @@ void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 	   points up and east points right in the image generated. */
 
 	char mapfile[255];
-	unsigned red, green, blue, terrain = 0;
-	unsigned char found, mask, cityorcounty;
-	int indx, x, y, z, x0 = 0, y0 = 0, loss, match;
-	double lat, lon, conversion, one_over_gamma, minwest;
+	double minwest;
+	render_t render;
 	FILE *fd;
 	image_ctx_t ctx;
 	int success;
@@ -44,11 +858,6 @@ void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 		exit(success);
 	}
 
-	one_over_gamma = 1.0 / GAMMA;
-	conversion =
-	    255.0 / pow((double)(max_elevation - min_elevation),
-			one_over_gamma);
-
 	if( (success = LoadLossColors(xmtr[0])) != 0 ){
 		spdlog::error("Error loading loss colors");
 		exit(success);  // Now a fatal error!
@@ -66,7 +875,7 @@ void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 			exit(1);
 		}
 
-		fd = fopen(mapfile,"wb");
+		fd = map_open(mapfile);
 
 	} else {
 
@@ -93,158 +902,18 @@ void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 	spdlog::debug("Writing \"{}\" ({} x {} pixmap image)...",
 			filename != NULL ? mapfile : "to stdout", width, (kml ? height : height + 30));
 
-	for (y = 0, lat = north; y < (int)height;
-	     y++, lat = north - (dpp * (double)y)) {
-		for (x = 0, lon = max_west; x < (int)width;
-		     x++, lon = max_west - (dpp * (double)x)) {
-			if (lon < 0.0)
-				lon += 360.0;
-
-			for (indx = 0, found = 0;
-			     indx < MAXPAGES && found == 0;) {
-				x0 = (int)rint(ppd *
-					       (lat -
-						(double)dem[indx].min_north));
-				y0 = mpi -
-				    (int)rint(ppd *
-					      (LonDiff
-					       ((double)dem[indx].max_west,
-						lon)));
-				 // fix for multi-tile lidar
-                              /*  if(width==10000 && (indx==1 || indx==3)){
-                                        if(y0 >= 3432){ //3535
-                                                y0=y0-3432;
-                                        }
-                                }*/
-
-
-				if (x0 >= 0 && x0 <= mpi && y0 >= 0
-				    && y0 <= mpi)
-					found = 1;
-				else
-					indx++;
-			}
-
-			if (found) {
-				mask = dem[indx].mask[x0][y0];
-				loss = (dem[indx].signal[x0][y0]);
-				cityorcounty = 0;
-
-				match = 255;
-
-				red = 0;
-				green = 0;
-				blue = 0;
-
-				if (loss <= region.level[0])
-					match = 0;
-				else {
-					for (z = 1;
-					     (z < region.levels
-					      && match == 255); z++) {
-						if (loss >= region.level[z - 1]
-						    && loss < region.level[z])
-							match = z;
-					}
-				}
-
-				if (match < region.levels) {
-					red = region.color[match][0];
-					green = region.color[match][1];
-					blue = region.color[match][2];
-				}
-
-				if (mask & 2) {
-					/* Text Labels: Red or otherwise */
-
-					if (red >= 180 && green <= 75
-					    && blue <= 75 && loss == 0)
-						ADD_PIXEL(&ctx, 255 ^ red,
-							255 ^ green,
-							255 ^ blue);
-					else
-						ADD_PIXEL(&ctx, 255, 0,
-							0);
-
-					cityorcounty = 1;
-				}
-
-				else if (mask & 4) {
-					/* County Boundaries: Black */
-
-					ADD_PIXEL(&ctx, 0, 0, 0);
-
-					cityorcounty = 1;
-				}
-
-				if (cityorcounty == 0) {
-					if (loss == 0
-					    || (contour_threshold != 0
-						&& loss >
-						abs(contour_threshold))) {
-						if (ngs)	/* No terrain */
-							ADD_PIXEL(&ctx, 
-								255, 255, 255);
-						else {
-							/* Display land or sea elevation */
-
-							if (dem[indx].
-							    data[x0][y0] == 0)
-								ADD_PIXEL(&ctx, 
-									0, 0,
-									170);
-							else {
-								terrain =
-								    (unsigned)
-								    (0.5 +
-								     pow((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-								ADD_PIXEL(&ctx, 
-									terrain,
-									terrain,
-									terrain);
-							}
-						}
-					}
-
-					else {
-						/* Plot path loss in color */
-
-						if (red != 0 || green != 0
-						    || blue != 0)
-							ADD_PIXEL(&ctx, 
-								red, green,
-								blue);
-
-						else {	/* terrain / sea-level */
-
-							if (dem[indx].
-							    data[x0][y0] == 0)
-								ADD_PIXEL(&ctx, 
-									0, 0,
-									170);
-							else {
-								/* Elevation: Greyscale */
-								terrain =
-								    (unsigned)
-								    (0.5 +
-								     pow((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-								ADD_PIXEL(&ctx, 
-									terrain,
-									terrain,
-									terrain);
-							}
-						}
-					}
-				}
-			}
-
-			else {
-				/* We should never get here, but if */
-				/* we do, display the region as black */
-
-				ADD_PIXEL(&ctx, 0, 0, 0);
-			}
-		}
+	render_tables(&render, RENDER_LOSS, ngs);
+	if ((success = render_map(&ctx, &render, fd)) != 0) {
+		spdlog::error("Error writing image");
+		exit(success);
+	}
+	if (value_formats != 0 && (success = render_values(&render)) != 0) {
+		spdlog::error("Error writing values to {}: {}", value_base, strerror(success));
+		exit(success);
+	}
+	if (!tile_dir.empty() && (success = render_xyz(&render)) != 0) {
+		spdlog::error("Error writing tiles to {}: {}", tile_dir, strerror(success));
+		exit(success);
 	}
 
 	if((success = image_write(&ctx,fd)) != 0){
@@ -254,9 +923,9 @@ void DoPathLoss(char *filename, unsigned char geo, unsigned char kml,
 
 	image_free(&ctx);
 
-	if( filename != NULL ) {
-		fclose(fd);
-		fd = NULL;
+	if( filename != NULL && (success = map_close(fd, mapfile)) != 0 ){
+		spdlog::error("Error writing {}: {}", mapfile, strerror(success));
+		exit(success);
 	}
 
 }
@@ -271,10 +940,8 @@ int DoSigStr(char *filename, unsigned char geo, unsigned char kml,
 	   points up and east points right in the image generated. */
 
 	char mapfile[255];
-	unsigned terrain, red, green, blue;
-	unsigned char found, mask, cityorcounty;
-	int indx, x, y, z = 1, x0 = 0, y0 = 0, signal, match;
-	double conversion, one_over_gamma, lat, lon, minwest;
+	double minwest;
+	render_t render;
 	FILE *fd;
 	image_ctx_t ctx;
 	int success;
@@ -284,11 +951,6 @@ int DoSigStr(char *filename, unsigned char geo, unsigned char kml,
 		exit(success);
 	}
 
-	one_over_gamma = 1.0 / GAMMA;
-	conversion =
-	    255.0 / pow((double)(max_elevation - min_elevation),
-			one_over_gamma);
-
 	if( (success = LoadSignalColors(xmtr[0])) != 0 ){
 		spdlog::error("Error loading signal colors");
 		//exit(success);
@@ -306,7 +968,7 @@ int DoSigStr(char *filename, unsigned char geo, unsigned char kml,
 			exit(1);
 		}
 
-		fd = fopen(mapfile,"wb");
+		fd = map_open(mapfile);
 
 	} else {
 
@@ -330,169 +992,18 @@ int DoSigStr(char *filename, unsigned char geo, unsigned char kml,
 	spdlog::debug("Writing \"{}\" ({} x {} pixmap image)...",
 			filename != NULL ? mapfile : "to stdout", width, (kml ? height : height + 30));
 
-	for (y = 0, lat = north; y < (int)height;
-	     y++, lat = north - (dpp * (double)y)) {
-		for (x = 0, lon = max_west; x < (int)width;
-		     x++, lon = max_west - (dpp * (double)x)) {
-			if (lon < 0.0)
-				lon += 360.0;
-
-			for (indx = 0, found = 0;
-			     indx < MAXPAGES && found == 0;) {
-				x0 = (int)rint(ppd *
-					       (lat -
-						(double)dem[indx].min_north));
-				y0 = mpi -
-				    (int)rint(ppd *
-					      (LonDiff
-					       ((double)dem[indx].max_west,
-						lon)));
-
-				 // fix for multi-tile lidar
-                           /*     if(width==10000 && (indx==1 || indx==3)){
-                                        if(y0 >= 3432){ //3535
-                                                y0=y0-3432;
-                                        }
-                                }
-				*/
-
-				if (x0 >= 0 && x0 <= mpi && y0 >= 0
-				    && y0 <= mpi)
-					found = 1;
-				else
-					indx++;
-			}
-
-			if (found) {
-				mask = dem[indx].mask[x0][y0];
-				signal = (dem[indx].signal[x0][y0]) - 100;
-				cityorcounty = 0;
-				match = 255;
-
-				red = 0;
-				green = 0;
-				blue = 0;
-
-				if (signal >= region.level[0])
-					match = 0;
-				else {
-					for (z = 1;
-					     (z < region.levels
-					      && match == 255); z++) {
-						if (signal < region.level[z - 1]
-						    && signal >=
-						    region.level[z])
-							match = z;
-					}
-				}
-
-				if (match < region.levels) {
-					red = region.color[match][0];
-					green = region.color[match][1];
-					blue = region.color[match][2];
-				}
-
-				if (mask & 2) {
-					/* Text Labels: Red or otherwise */
-
-					if (red >= 180 && green <= 75
-					    && blue <= 75)
-						ADD_PIXEL(&ctx, 255 ^ red,
-							255 ^ green,
-							255 ^ blue);
-					else
-						ADD_PIXEL(&ctx, 255, 0,
-							0);
-
-					cityorcounty = 1;
-				}
-
-				else if (mask & 4) {
-					/* County Boundaries: Black */
-
-					ADD_PIXEL(&ctx, 0, 0, 0);
-
-					cityorcounty = 1;
-				}
-
-				if (cityorcounty == 0) {
-					if (contour_threshold != 0
-					    && signal < contour_threshold) {
-						if (ngs)
-							ADD_PIXEL(&ctx, 
-								255, 255, 255);
-						else {
-							/* Display land or sea elevation */
-
-							if (dem[indx].
-							    data[x0][y0] == 0)
-								ADD_PIXEL(&ctx, 
-									0, 0,
-									170);
-							else {
-								terrain =
-								    (unsigned)
-								    (0.5 +
-								     pow((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-								ADD_PIXEL(&ctx, 
-									terrain,
-									terrain,
-									terrain);
-							}
-						}
-					}
-
-					else {
-						/* Plot field strength regions in color */
-
-						if (red != 0 || green != 0
-						    || blue != 0)
-							ADD_PIXEL(&ctx, 
-								red, green,
-								blue);
-
-						else {	/* terrain / sea-level */
-
-							if (ngs)
-								ADD_PIXEL(&ctx, 
-									255,
-									255,
-									255);
-							else {
-								if (dem[indx].
-								    data[x0][y0]
-								    == 0)
-									ADD_PIXEL(&ctx, 
-									     0,
-									     0,
-									     170);
-								else {
-									/* Elevation: Greyscale */
-									terrain
-									    =
-									    (unsigned)
-									    (0.5
-									     +
-									     pow
-									     ((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-									ADD_PIXEL(&ctx, 
-									     terrain,
-									     terrain,
-									     terrain);
-								}
-							}
-						}
-					}
-				}
-			}
-
-			else {
-				/* We should never get here, but if */
-				/* we do, display the region as black */
-
-				ADD_PIXEL(&ctx, 255, 255, 255);
-			}
-		}
+	render_tables(&render, RENDER_SIGNAL, ngs);
+	if ((success = render_map(&ctx, &render, fd)) != 0) {
+		spdlog::error("Error writing image");
+		exit(success);
+	}
+	if (value_formats != 0 && (success = render_values(&render)) != 0) {
+		spdlog::error("Error writing values to {}: {}", value_base, strerror(success));
+		exit(success);
+	}
+	if (!tile_dir.empty() && (success = render_xyz(&render)) != 0) {
+		spdlog::error("Error writing tiles to {}: {}", tile_dir, strerror(success));
+		exit(success);
 	}
 
 	if((success = image_write(&ctx,fd)) != 0){
@@ -502,9 +1013,9 @@ int DoSigStr(char *filename, unsigned char geo, unsigned char kml,
 
 	image_free(&ctx);
 
-	if( filename != NULL ) {
-		fclose(fd);
-		fd = NULL;
+	if( filename != NULL && (success = map_close(fd, mapfile)) != 0 ){
+		spdlog::error("Error writing {}: {}", mapfile, strerror(success));
+		exit(success);
 	}
 	return 0;
 }
@@ -519,10 +1030,8 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml,
 	   points up and east points right in the image generated. */
 
 	char mapfile[255];
-	unsigned terrain, red, green, blue;
-	unsigned char found, mask, cityorcounty;
-	int indx, x, y, z = 1, x0 = 0, y0 = 0, dBm, match;
-	double conversion, one_over_gamma, lat, lon, minwest;
+	double minwest;
+	render_t render;
 	FILE *fd;
 	image_ctx_t ctx;
 	int success;
@@ -532,11 +1041,6 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml,
 		exit(success);
 	}
 
-	one_over_gamma = 1.0 / GAMMA;
-	conversion =
-	    255.0 / pow((double)(max_elevation - min_elevation),
-			one_over_gamma);
-
 	if( (success = LoadDBMColors(xmtr[0])) != 0 ){
 		spdlog::error("Error loading DBM colors");
 		exit(success);  //Now a fatal error!
@@ -554,7 +1058,7 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml,
 			exit(1);
 		}
 
-		fd = fopen(mapfile,"wb");
+		fd = map_open(mapfile);
 
 	} else {
 
@@ -578,162 +1082,18 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml,
 	spdlog::debug("Writing \"{}\" ({} x {} pixmap image)...",
 			(filename != NULL ? mapfile : "to stdout"), width, (kml ? height : height));
 
-	// Draw image of x by y pixels
-	for (y = 0, lat = north; y < (int)height;
-	     y++, lat = north - (dpp * (double)y)) {
-		for (x = 0, lon = max_west; x < (int)width;
-		     x++, lon = max_west - (dpp * (double)x)) {
-			if (lon < 0.0)
-				lon += 360.0;
-
-			for (indx = 0, found = 0;
-			     indx < MAXPAGES && found == 0;) {
-
-				x0 = (int)rint((ppd *
-					      (lat -
-						(double)dem[indx].min_north))); 
-				y0 = mpi -
-				    (int)rint(ppd * 
-					      (LonDiff
-					       ((double)dem[indx].max_west,lon)));
-
-
-				if (x0 >= 0 && x0 <= mpi && y0 >= 0
-				    && y0 <= mpi)
-					found = 1;
-				else
-					indx++;
-
-
-			}
-
-			if (found) {
-				mask = dem[indx].mask[x0][y0];
-				dBm = (dem[indx].signal[x0][y0]) - 200;
-				cityorcounty = 0;
-				match = 255;
-
-				red = 0;
-				green = 0;
-				blue = 0;
-
-				if (dBm >= region.level[0])
-					match = 0;
-				else {
-					for (z = 1;
-					     (z < region.levels
-					      && match == 255); z++) {
-						if (dBm < region.level[z - 1]
-						    && dBm >= region.level[z])
-							match = z;
-					}
-				}
-
-				if (match < region.levels) {
-					red = region.color[match][0];
-					green = region.color[match][1];
-					blue = region.color[match][2];
-				}
-
-				if (mask & 2) {
-					/* Text Labels: Red or otherwise */
-
-					if (red >= 180 && green <= 75
-					    && blue <= 75 && dBm != 0)
-						ADD_PIXEL(&ctx, 255 ^ red,
-							255 ^ green,
-							255 ^ blue);
-					else
-						ADD_PIXEL(&ctx, 255, 0,
-							0);
-
-					cityorcounty = 1;
-				}
-
-				else if (mask & 4) {
-					/* County Boundaries: Black */
-					ADD_PIXEL(&ctx, 0, 0, 0);
-					cityorcounty = 1;
-				}
-
-				if (cityorcounty == 0) {
-					if (contour_threshold != 0
-					    && dBm < contour_threshold) {
-						if (ngs)	/* No terrain */
-							ADD_PIXEL(&ctx,
-								255, 255, 255);
-						else {
-							/* Display land or sea elevation */
-
-							if (dem[indx].
-							    data[x0][y0] == 0)
-								ADD_PIXEL(&ctx,
-									0, 0,
-									170);
-							else {
-								terrain =
-								    (unsigned)
-								    (0.5 +
-								     pow((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-								ADD_PIXEL(&ctx,
-									terrain,
-									terrain,
-									terrain);
-							}
-						}
-					}
-
-					else {
-						/* Plot signal power level regions in color */
-
-						if (red != 0 || green != 0
-						    || blue != 0)
-							ADD_PIXEL(&ctx,
-								red, green,
-								blue);
-
-						else {	/* terrain / sea-level */
-
-							if (ngs)
-								ADD_PIXEL(&ctx, 
-									255,
-									255,
-									255); // WHITE
-							else {
-								if (dem[indx].
-								    data[x0][y0]
-								    == 0)
-									ADD_PIXEL(&ctx, 
-									     0,
-									     0,
-									     170); // BLUE
-								else {
-									/* Elevation: Greyscale */
-									terrain
-									    =
-									    (unsigned)
-									    (0.5
-									     +
-									     pow
-									     ((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-									ADD_PIXEL(&ctx, 
-									     terrain,
-									     terrain,
-									     terrain);
-								}
-							}
-						}
-					}
-				}
-			}
-
-			else {
-				/* We should never get here, but if */
-				/* we do, display the region as black */
-
-				ADD_PIXEL(&ctx, 255, 255, 255);
-			}
-		}
+	render_tables(&render, RENDER_DBM, ngs);
+	if ((success = render_map(&ctx, &render, fd)) != 0) {
+		spdlog::error("Error writing image");
+		exit(success);
+	}
+	if (value_formats != 0 && (success = render_values(&render)) != 0) {
+		spdlog::error("Error writing values to {}: {}", value_base, strerror(success));
+		exit(success);
+	}
+	if (!tile_dir.empty() && (success = render_xyz(&render)) != 0) {
+		spdlog::error("Error writing tiles to {}: {}", tile_dir, strerror(success));
+		exit(success);
 	}
 
 	if((success = image_write(&ctx,fd)) != 0){
@@ -745,9 +1105,9 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml,
 
 	image_free(&ctx);
 
-	if( filename != NULL ) {
-		fclose(fd);
-		fd = NULL;
+	if( filename != NULL && (success = map_close(fd, mapfile)) != 0 ){
+		spdlog::error("Error writing {}: {}", mapfile, strerror(success));
+		exit(success);
 	}
 
 }
@@ -762,10 +1122,8 @@ void DoLOS(char *filename, unsigned char geo, unsigned char kml,
 	   points up and east points right in the image generated. */
 
 	char mapfile[255];
-	unsigned terrain;
-	unsigned char found, mask;
-	int indx, x, y, x0 = 0, y0 = 0;
-	double conversion, one_over_gamma, lat, lon, minwest;
+	double minwest;
+	render_t render;
 	FILE *fd;
 	image_ctx_t ctx;
 	int success;
@@ -775,11 +1133,6 @@ void DoLOS(char *filename, unsigned char geo, unsigned char kml,
 		exit(success);
 	}
 
-	one_over_gamma = 1.0 / GAMMA;
-	conversion =
-	    255.0 / pow((double)(max_elevation - min_elevation),
-			one_over_gamma);
-
 	if( filename != NULL ){
 
 		if (filename[0] == 0) {
@@ -792,7 +1145,7 @@ void DoLOS(char *filename, unsigned char geo, unsigned char kml,
 			exit(1);
 		}
 
-		fd = fopen(mapfile,"wb");
+		fd = map_open(mapfile);
 
 	} else {
 		
@@ -816,167 +1169,14 @@ void DoLOS(char *filename, unsigned char geo, unsigned char kml,
 	spdlog::debug("Writing \"{}\" ({} x {} pixmap image)...\n",
 			filename != NULL ? mapfile : "to stdout", width, (kml ? height : height + 30));
 
-	for (y = 0, lat = north; y < (int)height;
-	     y++, lat = north - (dpp * (double)y)) {
-		for (x = 0, lon = max_west; x < (int)width;
-		     x++, lon = max_west - (dpp * (double)x)) {
-			if (lon < 0.0)
-				lon += 360.0;
-
-			for (indx = 0, found = 0;
-			     indx < MAXPAGES && found == 0;) {
-				x0 = (int)rint(ppd *
-					       (lat -
-						(double)dem[indx].min_north));
-				y0 = mpi -
-				    (int)rint(ppd *
-					      (LonDiff
-					       ((double)dem[indx].max_west,
-						lon)));
-
-				if (x0 >= 0 && x0 <= mpi && y0 >= 0
-				    && y0 <= mpi)
-					found = 1;
-				else
-					indx++;
-			}
-
-			if (found) {
-				mask = dem[indx].mask[x0][y0];
-
-				if (mask & 2)
-					/* Text Labels: Red */
-					ADD_PIXEL(&ctx, 255, 0, 0);
-
-				else if (mask & 4)
-					/* County Boundaries: Light Cyan */
-					ADD_PIXEL(&ctx, 128, 128, 255);
-
-				else
-					switch (mask & 57) {
-					case 1:
-						/* TX1: Green */
-						ADD_PIXEL(&ctx, 0, 255,
-							0);
-						break;
-
-					case 8:
-						/* TX2: Cyan */
-						ADD_PIXEL(&ctx, 0, 255,
-							255);
-						break;
-
-					case 9:
-						/* TX1 + TX2: Yellow */
-						ADD_PIXEL(&ctx, 255, 255,
-							0);
-						break;
-
-					case 16:
-						/* TX3: Medium Violet */
-						ADD_PIXEL(&ctx, 147, 112,
-							219);
-						break;
-
-					case 17:
-						/* TX1 + TX3: Pink */
-						ADD_PIXEL(&ctx, 255, 192,
-							203);
-						break;
-
-					case 24:
-						/* TX2 + TX3: Orange */
-						ADD_PIXEL(&ctx, 255, 165,
-							0);
-						break;
-
-					case 25:
-						/* TX1 + TX2 + TX3: Dark Green */
-						ADD_PIXEL(&ctx, 0, 100,
-							0);
-						break;
-
-					case 32:
-						/* TX4: Sienna 1 */
-						ADD_PIXEL(&ctx, 255, 130,
-							71);
-						break;
-
-					case 33:
-						/* TX1 + TX4: Green Yellow */
-						ADD_PIXEL(&ctx, 173, 255,
-							47);
-						break;
-
-					case 40:
-						/* TX2 + TX4: Dark Sea Green 1 */
-						ADD_PIXEL(&ctx, 193, 255,
-							193);
-						break;
-
-					case 41:
-						/* TX1 + TX2 + TX4: Blanched Almond */
-						ADD_PIXEL(&ctx, 255, 235,
-							205);
-						break;
-
-					case 48:
-						/* TX3 + TX4: Dark Turquoise */
-						ADD_PIXEL(&ctx, 0, 206,
-							209);
-						break;
-
-					case 49:
-						/* TX1 + TX3 + TX4: Medium Spring Green */
-						ADD_PIXEL(&ctx, 0, 250,
-							154);
-						break;
-
-					case 56:
-						/* TX2 + TX3 + TX4: Tan */
-						ADD_PIXEL(&ctx, 210, 180,
-							140);
-						break;
-
-					case 57:
-						/* TX1 + TX2 + TX3 + TX4: Gold2 */
-						ADD_PIXEL(&ctx, 238, 201,
-							0);
-						break;
-
-					default:
-						if (ngs)	/* No terrain */
-							ADD_PIXEL(&ctx, 
-								255, 255, 255);
-						else {
-							/* Sea-level: Medium Blue */
-							if (dem[indx].
-							    data[x0][y0] == 0)
-								ADD_PIXEL(&ctx, 
-									0, 0,
-									170);
-							else {
-								/* Elevation: Greyscale */
-								terrain =
-								    (unsigned)
-								    (0.5 +
-								     pow((double)(dem[indx].data[x0][y0] - min_elevation), one_over_gamma) * conversion);
-								ADD_PIXEL(&ctx, 
-									terrain,
-									terrain,
-									terrain);
-							}
-						}
-					}
-			}
-
-			else {
-				/* We should never get here, but if */
-				/* we do, display the region as black */
-
-				ADD_PIXEL(&ctx, 255, 255, 255);
-			}
-		}
+	render_tables(&render, RENDER_LOS, ngs);
+	if ((success = render_map(&ctx, &render, fd)) != 0) {
+		spdlog::error("Error writing image");
+		exit(success);
+	}
+	if (!tile_dir.empty() && (success = render_xyz(&render)) != 0) {
+		spdlog::error("Error writing tiles to {}: {}", tile_dir, strerror(success));
+		exit(success);
 	}
 
 	if((success = image_write(&ctx,fd)) != 0){
@@ -986,9 +1186,9 @@ void DoLOS(char *filename, unsigned char geo, unsigned char kml,
 
 	image_free(&ctx);
 
-	if( filename != NULL) {
-		fclose(fd);
-		fd = NULL;
+	if( filename != NULL && (success = map_close(fd, mapfile)) != 0 ){
+		spdlog::error("Error writing {}: {}", mapfile, strerror(success));
+		exit(success);
 	}
 
 }
@@ -1018,7 +1218,8 @@ void PathReport(struct site source, struct site destination, char *name,
 	FILE *fd = NULL, *fd2 = NULL;
 
 	snprintf(report_name, 80, "%s.txt%c", name, 0);
-	four_thirds_earth = FOUR_THIRDS * EARTHRADIUS;
+	/* The profile is in metres, so the geometry is too */
+	four_thirds_earth = FOUR_THIRDS * EARTHRADIUS * METERS_PER_FOOT;
 
 	fd2 = fopen(report_name, "w");
 
@@ -1312,25 +1513,22 @@ void PathReport(struct site source, struct site destination, char *name,
 
 		for (x = 1; x < path.length - 1; x++)
 			elev[x + 2] =
-			    METERS_PER_FOOT * (path.elevation[x] ==
-					       0.0 ? path.
-					       elevation[x] : (clutter +
-							       path.
-							       elevation[x]));
+			    (path.elevation[x] ==
+			     0.0 ? path.elevation[x] : (METERS_PER_FOOT * clutter +
+							path.elevation[x]));
 
 		/* Copy ending points without clutter */
 
-		elev[2] = path.elevation[0] * METERS_PER_FOOT;
-		elev[path.length + 1] =
-		    path.elevation[path.length - 1] * METERS_PER_FOOT;
+		elev[2] = path.elevation[0];
+		elev[path.length + 1] = path.elevation[path.length - 1];
 
 		azimuth = rint(Azimuth(source, destination));
 
 		for (y = 2; y < (path.length - 1); y++) {	/* path.length-1 avoids LR error */
-			distance = FEET_PER_MILE * path.distance[y];
+			distance = METERS_PER_MILE * path.distance[y];
 
-			source_alt = four_thirds_earth + source.alt + path.elevation[0];
-			dest_alt = four_thirds_earth + destination.alt +
+			source_alt = four_thirds_earth + METERS_PER_FOOT * source.alt + path.elevation[0];
+			dest_alt = four_thirds_earth + METERS_PER_FOOT * destination.alt +
 			    path.elevation[y];
 			dest_alt2 = dest_alt * dest_alt;
 			source_alt2 = source_alt * source_alt;
@@ -1349,7 +1547,7 @@ void PathReport(struct site source, struct site destination, char *name,
 
 				for (x = 2, block = 0; x < y && block == 0; x++) {
 					distance =
-					    FEET_PER_MILE * (path.distance[y] -
+					    METERS_PER_MILE * (path.distance[y] -
 						      path.distance[x]);
 					test_alt =
 					    four_thirds_earth +
@@ -1423,27 +1621,27 @@ void PathReport(struct site source, struct site destination, char *name,
 				//HATA 1, 2 & 3
 				loss =
 				    HATApathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-						 (path.elevation[y] * METERS_PER_FOOT) +
+						 path.elevation[y] +
 						 (destination.alt * METERS_PER_FOOT), dkm, pmenv);
 				break;
 			case 4:
 				// COST231-HATA
 				loss =
 				    ECC33pathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-						  (path.elevation[y] * METERS_PER_FOOT) +
+						  path.elevation[y] +
 						  (destination.alt * METERS_PER_FOOT), dkm, pmenv);
 				break;
 			case 5:
 				// SUI
 				loss =
 				    SUIpathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-						(path.elevation[y] * METERS_PER_FOOT) +
+						path.elevation[y] +
 						(destination.alt * METERS_PER_FOOT), dkm, pmenv);
 				break;
 			case 6:
 				loss =
 				    COST231pathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-						    (path.elevation[y] * METERS_PER_FOOT) +
+						    path.elevation[y] +
 						    (destination.alt * METERS_PER_FOOT), dkm,pmenv);
 				break;
 			case 7:
@@ -1465,7 +1663,7 @@ void PathReport(struct site source, struct site destination, char *name,
 				// Ericsson
 				loss =
 				    EricssonpathLoss(LR.frq_mhz, source.alt * METERS_PER_FOOT,
-						     (path.elevation[y] * METERS_PER_FOOT) +
+						     path.elevation[y] +
 						     (destination.alt *
 						      METERS_PER_FOOT), dkm,
 						     pmenv);
@@ -13,6 +13,15 @@ void DoRxdPwr(char *filename, unsigned char geo, unsigned char kml, unsigned cha
 
 void DoLOS(char *filename, unsigned char geo, unsigned char kml, unsigned char ngs, struct site *xmtr, unsigned char txsites);
 
+/* Formats SetValueExport() writes */
+enum { VALUES_TIFF = 1, VALUES_RAW = 2 };
+
+void SetValueExport(const char *basename, int formats);
+
+void SetKMZ(bool on);
+
+void SetTilePyramid(const char *dir, int zoom_min, int zoom_max);
+
 void PathReport(struct site source, struct site destination, char *name, char graph_it, PropModel propmodel, int pmenv,
                 double rxGain);
 
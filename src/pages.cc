@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include "common.hh"
+#include "main.hh"
+#include "pages.hh"
+#include "blocks.hh"
+#include "layout.hh"
+
+/* Pages whose terrain is never evicted, as the paths of a plot cross up
+ * to four tiles where they meet */
+#define MIN_RESIDENT	4
+
+/* Tile states */
+enum {
+	TILE_PENDING = 0,
+	TILE_LOADED,
+	TILE_FAILED
+};
+
+typedef struct _page_tile_t{
+	std::string	name;
+	int	min_north, max_north;
+	int	min_west, max_west;	/* positive westing */
+	int	state;
+} page_tile_t;
+
+std::atomic<int> pages_filled(INT_MAX);
+std::atomic<uint64_t> pages_clock(0);
+page_slot_t *page_slots = NULL;
+
+static int slot_count = 0;
+static std::vector<page_tile_t> tiles;		/* nearest the transmitter first */
+static std::atomic<int> pending(0);
+static std::mutex load_mutex;
+static std::thread *prefetcher = NULL;
+static page_loader_t loader = NULL;
+static int first_error = 0;
+static size_t budget = 0;			/* bytes, 0 for no limit */
+static bool over_budget = false;
+static int reloading = -1;
+static bool packing = false;
+
+/* Bytes of terrain, and of the other layers, of a page, were all of them
+ * written */
+static size_t terrain_bytes(void){
+	return layout_cells() * sizeof(short);
+}
+
+static size_t layer_bytes(int indx){
+	return result_cells() * 2 + result_cells() / 8 + result_blocks() * result_blocks() * sizeof(uint32_t) +
+		(dem[indx].clutter != NULL ? layout_cells() : 0);
+}
+
+/* Bytes the allocated pages hold now */
+static size_t resident_bytes(void){
+	size_t bytes = 0;
+
+	for (int i = 0; i < MAXPAGES; i++) {
+		if (dem[i].data == NULL)
+			continue;
+		bytes += layer_bytes(i);
+		if (dem[i].blocks != NULL)
+			bytes += blocks_bytes(dem[i].blocks);
+		else if ((page_slots[i].gen & 1) == 0)
+			bytes += terrain_bytes();
+	}
+	return bytes;
+}
+
+/*
+ * Evicts the terrain of the least recently used pages, other than keep,
+ * until need more bytes fit in the budget. Returns 0 if they fit, or -1
+ * if they cannot, as evict is false or too few pages could go. Call with
+ * load_mutex held.
+ */
+static int make_room(int keep, size_t need, bool evict){
+	size_t bytes;
+
+	if (budget == 0)
+		return 0;
+
+	while ((bytes = resident_bytes()) + need > budget) {
+		int victim = -1, resident = 0;
+
+		for (int i = 0; evict && i < MAXPAGES; i++) {
+			if (dem[i].data == NULL || (page_slots[i].gen & 1) != 0)
+				continue;
+			resident++;
+			if (i == keep || page_slots[i].tile < 0 || page_slots[i].pinned || dem[i].blocks != NULL)
+				continue;
+			if (victim < 0 || page_slots[i].used < page_slots[victim].used)
+				victim = i;
+		}
+
+		if (resident < MIN_RESIDENT)
+			victim = -1;
+
+		if (victim < 0) {
+			if (evict && !over_budget) {
+				spdlog::warn("DEM pages need {:.1f} MB, over the {:.1f} MB memory budget", (bytes + need) / 1048576.0,
+						budget / 1048576.0);
+				over_budget = true;
+			}
+			return -1;
+		}
+
+		spdlog::debug("Evicting \"{}\" from page {}", tiles[page_slots[victim].tile].name, victim + 1);
+		page_slots[victim].gen.fetch_add(1);
+		drop_page(victim);
+	}
+	return 0;
+}
+
+/* Loads a pending tile. Call with load_mutex held */
+static void load_tile(page_tile_t *tile){
+	int success, indx;
+
+	make_room(-1, terrain_bytes() + 2 * result_cells(), true);
+
+	/* Pages are filled in order, so the tile lands in the first free one */
+	indx = pages_filled.load(std::memory_order_relaxed);
+
+	if ((success = loader(&tile->name[0])) < 0) {
+		spdlog::error("Error loading topo data for \"{}\": {}", tile->name, strerror(-success));
+		if (first_error == 0)
+			first_error = -success;
+		tile->state = TILE_FAILED;
+	} else
+		tile->state = TILE_LOADED;
+	pending--;
+
+	if (indx < MAXPAGES && dem[indx].max_north != -90) {
+		page_slots[indx].tile = tile - &tiles[0];
+		pages_touch(indx);
+		if (packing)
+			pack_page(indx);
+		else
+			tile_page(indx);
+	}
+
+	for (; indx < MAXPAGES && dem[indx].max_north != -90; indx++)
+		;
+	pages_filled.store(indx, std::memory_order_release);
+}
+
+/*
+ * pages_slots
+ * Sizes the page state to count dem[] pages, keeping that of the pages
+ * there already. Pages are added as unused and never evicted.
+ */
+void pages_slots(int count){
+	page_slot_t *slots = new page_slot_t[count];
+
+	for (int i = 0; i < count; i++) {
+		bool old = i < slot_count;
+
+		slots[i].gen = old ? page_slots[i].gen.load() : 0;
+		slots[i].used = old ? page_slots[i].used.load() : 0;
+		slots[i].tile = old ? page_slots[i].tile : -1;
+		slots[i].pinned = old ? page_slots[i].pinned : false;
+	}
+
+	delete [] page_slots;
+	page_slots = slots;
+	slot_count = count;
+}
+
+/*
+ * pages_budget
+ * Limits the memory DEM pages take to bytes, evicting terrain to stay
+ * within it, or lifts the limit if 0.
+ */
+void pages_budget(size_t bytes){
+	budget = bytes;
+}
+
+/*
+ * pages_pack
+ * Keeps the terrain of pages loaded from now on packed, see blocks.hh.
+ * Packed pages are small enough never to be evicted.
+ */
+void pages_pack(bool on){
+	packing = on;
+}
+
+/*
+ * pages_open
+ * Lists the tiles (named as LoadSDF() expects) a plot centred on lat/lon
+ * (positive westing) may need, to be loaded with load on demand, and adds
+ * pages for them where there are too few. Returns 0.
+ */
+int pages_open(const std::vector<std::string> &names, double lat, double lon, page_loader_t load){
+	std::lock_guard<std::mutex> lock(load_mutex);
+
+	tiles.clear();
+	for (auto &name : names) {
+		page_tile_t tile;
+
+		if (sscanf(name.c_str(), "%d_%d_%d_%d", &tile.min_north, &tile.max_north, &tile.min_west, &tile.max_west) != 4)
+			continue;
+		tile.name = name;
+		tile.state = TILE_PENDING;
+		tiles.push_back(tile);
+	}
+
+	/* Nearest first, by the distance of the tile centre in degrees with
+	 * longitude scaled to the latitude */
+	double scale = cos(lat * M_PI / 180);
+	auto distance = [&](const page_tile_t &t) {
+		double dlat = (t.min_north + t.max_north) / 2.0 - lat, dlon = ((t.min_west + t.max_west) / 2.0 - lon) * scale;
+		return dlat * dlat + dlon * dlon;
+	};
+	std::stable_sort(tiles.begin(), tiles.end(),
+			[&](const page_tile_t &a, const page_tile_t &b) { return distance(a) < distance(b); });
+
+	loader = load;
+	first_error = 0;
+	pending = tiles.size();
+
+	int indx;
+	for (indx = 0; indx < MAXPAGES && dem[indx].max_north != -90; indx++)
+		;
+	if (indx + (int)tiles.size() > MAXPAGES)
+		grow_dem(indx + tiles.size());
+	for (int i = 0; i < MAXPAGES; i++)
+		page_slots[i].tile = -1;
+	pages_filled.store(indx, std::memory_order_release);
+
+	spdlog::debug("Page directory holds {} tiles for {} pages", tiles.size(), MAXPAGES);
+
+	return 0;
+}
+
+/*
+ * pages_fault
+ * Loads the tiles not yet in memory holding lat/lon (positive westing),
+ * or lying within a sample of it. Returns 1 if any were loaded, here or
+ * by another thread since the caller saw filled pages, so the caller
+ * should look again, or 0.
+ */
+int pages_fault(double lat, double lon, int filled){
+	if (pending == 0)
+		return pages_filled.load(std::memory_order_acquire) > filled;
+
+	std::lock_guard<std::mutex> lock(load_mutex);
+	double margin = 1.0 / ippd;
+	int loaded = 0;
+
+	for (auto &tile : tiles) {
+		double dlon = fmod(lon - tile.min_west + 540.0, 360.0) - 180.0;
+
+		if (tile.state != TILE_PENDING || lat < tile.min_north - margin || lat > tile.max_north + margin ||
+				dlon < -margin || dlon > tile.max_west - tile.min_west + margin)
+			continue;
+
+		load_tile(&tile);
+		loaded = 1;
+	}
+
+	return loaded || pages_filled.load(std::memory_order_relaxed) > filled;
+}
+
+/*
+ * pages_prefetch
+ * Starts loading every tile still pending in the background, nearest
+ * first, while the plot runs. It stops at the memory budget, leaving the
+ * rest to be loaded when needed.
+ */
+void pages_prefetch(void){
+	if (prefetcher != NULL || pending == 0)
+		return;
+
+	prefetcher = new std::thread([]() {
+		for (size_t i = 0; i < tiles.size() && pending > 0; i++) {
+			std::lock_guard<std::mutex> lock(load_mutex);
+
+			if (tiles[i].state != TILE_PENDING)
+				continue;
+			if (make_room(-1, terrain_bytes() + 2 * result_cells(), false) != 0)
+				break;
+			load_tile(&tiles[i]);
+		}
+	});
+}
+
+/*
+ * pages_finish
+ * Waits for the prefetcher and loads whatever is still pending, so every
+ * tile has its page, eg. before the whole map is drawn. Returns 0 or the
+ * errno of the first tile that failed to load.
+ */
+int pages_finish(void){
+	if (prefetcher != NULL) {
+		prefetcher->join();
+		delete prefetcher;
+		prefetcher = NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(load_mutex);
+	for (auto &tile : tiles)
+		if (tile.state == TILE_PENDING)
+			load_tile(&tile);
+
+	return first_error;
+}
+
+/* Reads the terrain of an evicted page back. Call with load_mutex held */
+static unsigned reload_page_locked(int indx){
+	page_slot_t *slot = &page_slots[indx];
+	unsigned gen = slot->gen.load(std::memory_order_relaxed);
+	int success;
+
+	/* Another thread may have read it back while we waited */
+	if ((gen & 1) == 0)
+		return gen;
+
+	make_room(indx, terrain_bytes(), true);
+
+	spdlog::debug("Reloading \"{}\" into page {}", tiles[slot->tile].name, indx + 1);
+
+	/* The loaders fold the page into the plot bounds, which may have
+	 * been cropped since, so keep those as they are */
+	double bounds[4] = {min_north, max_north, min_west, max_west};
+	int elevation[2] = {min_elevation, max_elevation};
+
+	reloading = indx;
+	if ((success = loader(&tiles[slot->tile].name[0])) < 0) {
+		spdlog::error("Error reloading topo data for \"{}\": {}", tiles[slot->tile].name, strerror(-success));
+		if (first_error == 0)
+			first_error = -success;
+	}
+	reloading = -1;
+	tile_page(indx);
+
+	min_north = bounds[0];
+	max_north = bounds[1];
+	min_west = bounds[2];
+	max_west = bounds[3];
+	min_elevation = elevation[0];
+	max_elevation = elevation[1];
+
+	pages_touch(indx);
+	slot->gen.store(gen + 1, std::memory_order_release);
+
+	return gen + 1;
+}
+
+/*
+ * pages_reload
+ * Reads the terrain of an evicted page back from its tile, evicting others
+ * to make room. Returns the new generation of the page.
+ */
+unsigned pages_reload(int indx){
+	std::lock_guard<std::mutex> lock(load_mutex);
+
+	return reload_page_locked(indx);
+}
+
+/*
+ * pages_reloading
+ * The page pages_reload() is reading terrain into, for the loaders to
+ * fill, or -1.
+ */
+int pages_reloading(void){
+	return reloading;
+}
+
+/*
+ * pages_pin
+ * Reads back the terrain of a page if evicted, or unpacks it if packed, and
+ * keeps it in memory from now on, eg. once it has been changed in a way its
+ * tile cannot restore. Only safe while no other thread reads the page.
+ */
+void pages_pin(int indx){
+	std::lock_guard<std::mutex> lock(load_mutex);
+
+	unpack_page(indx);
+	reload_page_locked(indx);
+	page_slots[indx].pinned = true;
+}
@@ -0,0 +1,69 @@
+#ifndef _PAGES_HH_
+#define _PAGES_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+ * DEM page directory. Lists the tiles a plot needs and loads each into a
+ * dem[] page the first time a lookup lands on it, while an optional
+ * prefetch thread loads the others, nearest the transmitter first. Loads
+ * are serialised and fill pages in order, so the first pages_filled pages
+ * of dem[] have their bounds set and may be searched without locking.
+ *
+ * Given a memory budget, the terrain of the least recently used pages is
+ * evicted to make room for new ones and read back from its tile when next
+ * needed. Readers take the page generation with pages_need() before a read
+ * and check it with pages_valid() after, and retry if it changed. Mask,
+ * signal and clutter layers stay in memory, as they cannot be read back.
+ * Pages may instead keep their terrain packed, see blocks.hh.
+ */
+
+typedef struct _page_slot_t{
+	std::atomic<unsigned>	gen;	/* even while the terrain is in memory */
+	std::atomic<uint64_t>	used;	/* clock when last looked up */
+	int	tile;		/* in the directory, or -1 */
+	bool	pinned;		/* never evicted */
+} page_slot_t;
+
+/* Number of dem[] pages with bounds set, every page when no directory is open */
+extern std::atomic<int> pages_filled;
+extern std::atomic<uint64_t> pages_clock;
+extern page_slot_t *page_slots;
+
+/* Loads the named tile into the first free page. LoadSDF() semantics */
+typedef int (*page_loader_t)(char *name);
+
+void pages_slots(int count);
+void pages_budget(size_t bytes);
+void pages_pack(bool on);
+int pages_open(const std::vector<std::string> &names, double lat, double lon, page_loader_t load);
+int pages_fault(double lat, double lon, int filled);
+void pages_prefetch(void);
+int pages_finish(void);
+unsigned pages_reload(int indx);
+int pages_reloading(void);
+void pages_pin(int indx);
+
+/* Marks a page as just used, so it is the last to be evicted */
+static inline void pages_touch(int indx){
+	page_slots[indx].used.store(++pages_clock, std::memory_order_relaxed);
+}
+
+/* Reads back the terrain of a page if evicted. Returns its generation */
+static inline unsigned pages_need(int indx){
+	unsigned gen = page_slots[indx].gen.load(std::memory_order_acquire);
+
+	return gen & 1 ? pages_reload(indx) : gen;
+}
+
+/* True if the terrain read since pages_need() returned gen was not evicted meanwhile */
+static inline bool pages_valid(int indx, unsigned gen){
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return page_slots[indx].gen.load(std::memory_order_relaxed) == gen;
+}
+
+#endif
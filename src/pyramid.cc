@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "pyramid.hh"
+
+/* Byte order of the samples on disk */
+static inline short le16(short s){
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (short)__builtin_bswap16(s);
+#else
+	return s;
+#endif
+}
+
+/* Halves a level along each axis, dropping an odd last row or column */
+static void build_overview(const std::vector<short> &src, int w, int h, std::vector<short> &dst, int filter){
+	int nw = w / 2, nh = h / 2;
+
+	dst.resize((size_t)nw * nh);
+
+	for (int r = 0; r < nh; r++) {
+		const short *a = &src[(size_t)2 * r * w], *b = a + w;
+		short *d = &dst[(size_t)r * nw];
+
+		for (int c = 0; c < nw; c++, a += 2, b += 2) {
+			if (filter == PYR_DECIMATE) {
+				d[c] = b[0];
+			} else {
+				float v = 0;
+				int n = 0;
+				if (a[0] > 0) { v += a[0]; n++; }
+				if (a[1] > 0) { v += a[1]; n++; }
+				if (b[0] > 0) { v += b[0]; n++; }
+				if (b[1] > 0) { v += b[1]; n++; }
+				d[c] = n ? (short)lrintf(v / n) : 0;
+			}
+		}
+	}
+}
+
+static void level_layout(pyramid_t *pyr){
+	int w = pyr->header.width, h = pyr->header.height, b = pyr->header.block;
+
+	for (int l = 0; l < pyr->header.levels; l++) {
+		pyr->width[l] = w;
+		pyr->height[l] = h;
+		pyr->bx[l] = (w + b - 1) / b;
+		pyr->by[l] = (h + b - 1) / b;
+		w /= 2;
+		h /= 2;
+	}
+}
+
+/*
+ * pyramid_write
+ * Writes width x height samples (north to south, west to east) and their
+ * overviews to filename. Blocks holding a single value take no space.
+ * Returns 0 or an errno.
+ */
+int pyramid_write(const char *filename, const short *data, int width, int height, double max_north, double min_north,
+		double max_west, double min_west, int filter){
+	pyramid_t pyr;
+	std::vector<short> levels[PYR_LEVELS];
+	FILE *fd;
+
+	if (width <= 0 || height <= 0)
+		return EINVAL;
+
+	memset(&pyr.header, 0, sizeof(pyr.header));
+	memcpy(pyr.header.magic, PYR_MAGIC, sizeof(pyr.header.magic));
+	pyr.header.block = PYR_BLOCK;
+	pyr.header.width = width;
+	pyr.header.height = height;
+	pyr.header.filter = filter;
+	pyr.header.max_north = max_north;
+	pyr.header.min_north = min_north;
+	pyr.header.max_west = max_west;
+	pyr.header.min_west = min_west;
+
+	levels[0].assign(data, data + (size_t)width * height);
+	pyr.header.levels = 1;
+	while (pyr.header.levels < PYR_LEVELS && width >= 2 && height >= 2) {
+		build_overview(levels[pyr.header.levels - 1], width, height, levels[pyr.header.levels], filter);
+		width /= 2;
+		height /= 2;
+		pyr.header.levels++;
+	}
+	level_layout(&pyr);
+
+	if ((fd = fopen(filename, "wb")) == NULL)
+		return errno;
+
+	/* The block tables follow the header and are filled in last */
+	size_t entries = 0;
+	for (int l = 0; l < pyr.header.levels; l++) {
+		pyr.blocks[l].assign((size_t)pyr.bx[l] * pyr.by[l], pyr_block_t());
+		entries += pyr.blocks[l].size();
+	}
+	uint64_t offset = sizeof(pyr.header) + entries * sizeof(pyr_block_t);
+
+	if (fseek(fd, offset, SEEK_SET) != 0) {
+		fclose(fd);
+		return errno;
+	}
+
+	std::vector<short> block;
+	for (int l = 0; l < pyr.header.levels; l++) {
+		int b = pyr.header.block;
+
+		for (int j = 0; j < pyr.by[l]; j++) {
+			for (int i = 0; i < pyr.bx[l]; i++) {
+				pyr_block_t *e = &pyr.blocks[l][(size_t)j * pyr.bx[l] + i];
+				int r0 = j * b, c0 = i * b, rows = std::min(b, pyr.height[l] - r0), cols = std::min(b, pyr.width[l] - c0);
+				short lo = 32767, hi = -32768;
+
+				block.resize((size_t)rows * cols);
+				for (int r = 0; r < rows; r++) {
+					const short *src = &levels[l][(size_t)(r0 + r) * pyr.width[l] + c0];
+					for (int c = 0; c < cols; c++) {
+						lo = std::min(lo, src[c]);
+						hi = std::max(hi, src[c]);
+						block[(size_t)r * cols + c] = le16(src[c]);
+					}
+				}
+
+				e->min_el = lo;
+				e->max_el = hi;
+				if (lo == hi)
+					continue;
+
+				e->offset = offset;
+				if (fwrite(block.data(), sizeof(short), block.size(), fd) != block.size()) {
+					fclose(fd);
+					return EIO;
+				}
+				offset += block.size() * sizeof(short);
+			}
+		}
+	}
+
+	if (fseek(fd, 0, SEEK_SET) != 0 || fwrite(&pyr.header, sizeof(pyr.header), 1, fd) != 1) {
+		fclose(fd);
+		return EIO;
+	}
+	for (int l = 0; l < pyr.header.levels; l++) {
+		if (fwrite(pyr.blocks[l].data(), sizeof(pyr_block_t), pyr.blocks[l].size(), fd) != pyr.blocks[l].size()) {
+			fclose(fd);
+			return EIO;
+		}
+	}
+
+	return fclose(fd) == 0 ? 0 : errno;
+}
+
+/*
+ * pyramid_open
+ * Reads the header and block tables of a pyramid. Returns 0 or an errno.
+ */
+int pyramid_open(pyramid_t *pyr, const char *filename){
+	off_t pos;
+
+	if ((pyr->fd = open(filename, O_RDONLY)) < 0)
+		return errno;
+
+	if (pread(pyr->fd, &pyr->header, sizeof(pyr->header), 0) != sizeof(pyr->header) ||
+			memcmp(pyr->header.magic, PYR_MAGIC, sizeof(pyr->header.magic)) != 0 ||
+			pyr->header.levels < 1 || pyr->header.levels > PYR_LEVELS || pyr->header.block <= 0 ||
+			pyr->header.width <= 0 || pyr->header.height <= 0) {
+		pyramid_close(pyr);
+		return EINVAL;
+	}
+	level_layout(pyr);
+
+	pos = sizeof(pyr->header);
+	for (int l = 0; l < pyr->header.levels; l++) {
+		size_t bytes = (size_t)pyr->bx[l] * pyr->by[l] * sizeof(pyr_block_t);
+
+		pyr->blocks[l].resize((size_t)pyr->bx[l] * pyr->by[l]);
+		if (pread(pyr->fd, pyr->blocks[l].data(), bytes, pos) != (ssize_t)bytes) {
+			pyramid_close(pyr);
+			return EIO;
+		}
+		pos += bytes;
+	}
+
+	return 0;
+}
+
+/*
+ * pyramid_read
+ * Copies a rows x cols window of a level, starting at row/col, into out.
+ * Only the blocks the window touches are read, spread over `threads`
+ * threads. Returns 0 or an errno.
+ */
+int pyramid_read(pyramid_t *pyr, int level, int row, int col, int rows, int cols, short *out, int threads){
+	if (level < 0 || level >= pyr->header.levels || row < 0 || col < 0 || rows <= 0 || cols <= 0 ||
+			row + rows > pyr->height[level] || col + cols > pyr->width[level])
+		return EINVAL;
+
+	int b = pyr->header.block;
+	int i0 = col / b, i1 = (col + cols - 1) / b, j0 = row / b, j1 = (row + rows - 1) / b;
+	int nblocks = (i1 - i0 + 1) * (j1 - j0 + 1);
+	std::atomic<int> next(0), error(0);
+
+	auto worker = [&]() {
+		std::vector<short> block;
+		int n;
+
+		while ((n = next++) < nblocks && error == 0) {
+			int i = i0 + n % (i1 - i0 + 1), j = j0 + n / (i1 - i0 + 1);
+			const pyr_block_t &e = pyr->blocks[level][(size_t)j * pyr->bx[level] + i];
+			int bw = std::min(b, pyr->width[level] - i * b), bh = std::min(b, pyr->height[level] - j * b);
+
+			/* The part of the block inside the window */
+			int r0 = std::max(row, j * b), r1 = std::min(row + rows, j * b + bh);
+			int c0 = std::max(col, i * b), c1 = std::min(col + cols, i * b + bw);
+
+			if (e.offset == 0) {
+				for (int r = r0; r < r1; r++)
+					std::fill_n(&out[(size_t)(r - row) * cols + c0 - col], c1 - c0, e.min_el);
+				continue;
+			}
+
+			block.resize((size_t)bw * bh);
+			ssize_t bytes = block.size() * sizeof(short);
+			if (pread(pyr->fd, block.data(), bytes, e.offset) != bytes) {
+				error = EIO;
+				break;
+			}
+
+			for (int r = r0; r < r1; r++) {
+				const short *src = &block[(size_t)(r - j * b) * bw + c0 - i * b];
+				short *dst = &out[(size_t)(r - row) * cols + c0 - col];
+				for (int c = 0; c < c1 - c0; c++)
+					dst[c] = le16(src[c]);
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads && t < nblocks; t++)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (auto &th : workers)
+		th.join();
+
+	return error;
+}
+
+void pyramid_close(pyramid_t *pyr){
+	if (pyr->fd >= 0)
+		close(pyr->fd);
+	pyr->fd = -1;
+}
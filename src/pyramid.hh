@@ -0,0 +1,61 @@
+#ifndef _PYRAMID_HH_
+#define _PYRAMID_HH_
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * DEM pyramid (.sdp). A raster cut into fixed size blocks, each with its
+ * own min/max, followed by 2x, 4x and 8x overview levels built the same
+ * way. Every level runs north to south and west to east, samples are
+ * little-endian 16 bit. Loaders read only the level and blocks they need.
+ */
+
+#define PYR_MAGIC	"SSPYR01"
+#define PYR_LEVELS	4
+#define PYR_BLOCK	256
+
+/* How overviews are made from the level below */
+enum {
+	PYR_DECIMATE = 0,	/* south west sample of each 2x2, as the SDF loaders subsample */
+	PYR_MEAN = 1		/* mean of the non void samples of each 2x2, as tile_rescale() */
+};
+
+typedef struct _pyr_header_t{
+	char	magic[8];
+	int	levels;
+	int	block;
+	int	width;		/* of level 0 */
+	int	height;
+	int	filter;
+	int	reserved;
+	double	max_north;	/* degrees, positive westing */
+	double	min_north;
+	double	max_west;
+	double	min_west;
+} pyr_header_t;
+
+typedef struct _pyr_block_t{
+	uint64_t	offset;	/* 0 when every sample equals min_el */
+	short	min_el;
+	short	max_el;
+	int	reserved;
+} pyr_block_t;
+
+typedef struct _pyramid_t{
+	int	fd;
+	pyr_header_t	header;
+	int	width[PYR_LEVELS];
+	int	height[PYR_LEVELS];
+	int	bx[PYR_LEVELS];		/* blocks across and down */
+	int	by[PYR_LEVELS];
+	std::vector<pyr_block_t>	blocks[PYR_LEVELS];
+} pyramid_t;
+
+int pyramid_write(const char *filename, const short *data, int width, int height, double max_north, double min_north,
+		double max_west, double min_west, int filter);
+int pyramid_open(pyramid_t *pyr, const char *filename);
+int pyramid_read(pyramid_t *pyr, int level, int row, int col, int rows, int cols, short *out, int threads);
+void pyramid_close(pyramid_t *pyr);
+
+#endif
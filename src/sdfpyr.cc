@@ -0,0 +1,191 @@
+/*
+ * sdfpyr: converts DEM tiles into DEM pyramids (.sdp) for signalserver.
+ *
+ * SDF (.sdf) and binary SDF (.sdb) tiles become <lat>_<lat>_<lon>_<lon>.sdp,
+ * which -sdf picks up at any resolution. Their overviews keep one sample
+ * in four, as the SDF loaders do, so plots match those from the SDF files.
+ * LIDAR grids (.asc) become <name>.sdp for -lid, with averaged overviews
+ * that -resample reads instead of shrinking the full grid.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pyramid.hh"
+#include "tiles.hh"
+
+/* Used by the tile loaders */
+int debug = 0, IPPD = 1200;
+double westoffset = 180, eastoffset = -180, delta = 0;
+
+static std::string out_path;
+
+static std::string output_name(const char *filename, const char *stem)
+{
+	std::string base = filename;
+	size_t slash = base.rfind('/');
+
+	if (stem != NULL) return out_path + stem + ".sdp";
+
+	if (slash != std::string::npos) base = base.substr(slash + 1);
+	return out_path + base.substr(0, base.rfind('.')) + ".sdp";
+}
+
+/* Reads an .sdf or .sdb tile north to south, west to east */
+static int load_sdf(const char *filename, std::vector<short> &grid, int *size, int bounds[4])
+{
+	FILE *fd;
+	const char *ext = strrchr(filename, '.');
+
+	if ((fd = fopen(filename, "rb")) == NULL) return errno;
+
+	std::vector<short> samples;
+
+	if (strcmp(ext, ".sdb") == 0) {
+		struct {
+			char magic[4];
+			int ippd, max_west, min_north, min_west, max_north;
+		} header;
+
+		if (fread(&header, sizeof(header), 1, fd) != 1 || memcmp(header.magic, "SDB1", 4) != 0 || header.ippd <= 0) {
+			fclose(fd);
+			return EINVAL;
+		}
+		*size = header.ippd;
+		bounds[0] = header.max_west;
+		bounds[1] = header.min_north;
+		bounds[2] = header.min_west;
+		bounds[3] = header.max_north;
+		samples.resize((size_t)*size * *size);
+		if (fread(samples.data(), sizeof(short), samples.size(), fd) != samples.size()) {
+			fclose(fd);
+			return EIO;
+		}
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		for (auto &s : samples) s = (short)__builtin_bswap16(s);
+#endif
+	}
+	else {
+		int value;
+
+		if (fscanf(fd, "%d %d %d %d", &bounds[0], &bounds[1], &bounds[2], &bounds[3]) != 4) {
+			fclose(fd);
+			return EINVAL;
+		}
+		while (fscanf(fd, "%d", &value) == 1) samples.push_back(value);
+
+		for (*size = 1; (size_t)*size * *size < samples.size(); (*size)++)
+			;
+		if ((size_t)*size * *size != samples.size()) {
+			fclose(fd);
+			return EINVAL;
+		}
+	}
+
+	fclose(fd);
+
+	/* SDF samples run south to north and east to west */
+	grid.resize(samples.size());
+	for (int x = 0; x < *size; x++)
+		for (int y = 0; y < *size; y++) grid[(size_t)(*size - 1 - x) * *size + *size - 1 - y] = samples[(size_t)x * *size + y];
+
+	return 0;
+}
+
+static int convert(const char *filename)
+{
+	const char *ext = strrchr(filename, '.');
+	std::string output;
+	int success;
+
+	if (ext != NULL && (strcmp(ext, ".sdf") == 0 || strcmp(ext, ".sdb") == 0)) {
+		std::vector<short> grid;
+		int size = 0, bounds[4];
+		char stem[64];
+
+		if ((success = load_sdf(filename, grid, &size, bounds)) != 0) return success;
+
+		snprintf(stem, sizeof(stem), "%d_%d_%d_%d", bounds[1], bounds[3], bounds[2], bounds[0]);
+		output = output_name(filename, stem);
+		success = pyramid_write(output.c_str(), grid.data(), size, size, bounds[3], bounds[1], bounds[0], bounds[2],
+														PYR_DECIMATE);
+	}
+	else if (ext != NULL && strcmp(ext, ".asc") == 0) {
+		tile_t tile;
+
+		if ((success = tile_load_lidar(&tile, (char *)filename)) != 0) return success;
+
+		output = output_name(filename, NULL);
+		success = pyramid_write(output.c_str(), tile.data, tile.width, tile.height, tile.max_north, tile.min_north,
+														tile.max_west, tile.min_west, PYR_MEAN);
+		tile_destroy(&tile);
+		free(tile.filename);
+	}
+	else
+		return EINVAL;
+
+	if (success == 0) spdlog::info("{} -> {}", filename, output);
+
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char *> inputs;
+	int threads = 0;
+
+	for (int x = 1; x < argc; x++) {
+		if (strcmp(argv[x], "-o") == 0 && x + 1 < argc) {
+			out_path = argv[++x];
+			if (out_path.back() != '/') out_path += '/';
+		}
+		else if (strcmp(argv[x], "-j") == 0 && x + 1 < argc)
+			threads = atoi(argv[++x]);
+		else
+			inputs.push_back(argv[x]);
+	}
+
+	if (inputs.empty()) {
+		fprintf(stderr,
+						"\nsdfpyr: Converts DEM tiles into DEM pyramids (.sdp) with 2x, 4x and 8x overviews\n\n"
+						"\t-o directory to write the pyramids to (default = current directory)\n"
+						"\t-j number of tiles to convert at once (default = all cores)\n\n"
+						"Inputs may be SDF (.sdf), binary SDF (.sdb) or LIDAR (.asc) tiles.\n\n"
+						"Examples: sdfpyr -o /data/sdp /data/sdf/*.sdf\n"
+						"          sdfpyr cornwall_2m.asc\n\n");
+		return 1;
+	}
+
+	if (threads <= 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	std::atomic<size_t> next(0);
+	std::atomic<int> failed(0);
+
+	auto worker = [&]() {
+		size_t i;
+		int success;
+
+		while ((i = next++) < inputs.size()) {
+			if ((success = convert(inputs[i])) != 0) {
+				spdlog::error("Failed to convert \"{}\": {}", inputs[i], strerror(success));
+				failed++;
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads && (size_t)t < inputs.size(); t++) workers.push_back(std::thread(worker));
+	worker();
+	for (auto &th : workers) th.join();
+
+	return failed ? 1 : 0;
+}
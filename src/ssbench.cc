@@ -0,0 +1,394 @@
+/*
+ * ssbench: measures the cost of reading DEM terrain packed into blocks
+ * (see blocks.hh, -pack) against reading it unpacked, and of reading it
+ * along paths in the row and tiled page layouts (see layout.hh, -tiled).
+ *
+ * Level 0 of a DEM pyramid (.sdp) is read into a page sized grid, packed,
+ * and read back both ways, by random lookups and by ray walks out from
+ * the centre, as the propagation models read terrain. The page is then
+ * laid out each way and walked by rays N/S, E/W and diagonally, counting
+ * the cache and TLB misses per sample of a simulated L1 and dTLB, and of
+ * the CPU where perf events are allowed.
+ *
+ * Last, profiles are read from the page along rays out from the centre,
+ * as ReadPath() gathers them and the models read them back, kept in feet
+ * as doubles as they once were and in metres as floats as they are now,
+ * and the largest difference between the two in elevations handed to the
+ * models and in the angle to the first obstruction is reported.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "blocks.hh"
+#include "layout.hh"
+#include "pyramid.hh"
+
+/* Used by page_cell() */
+int IPPD = 1200;
+bool tiled_layout = false;
+
+static volatile long sink;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+/* Sums the samples at the points given, so the reads cannot be skipped */
+static long sum_raw(short *const *data, const std::vector<int> &xs, const std::vector<int> &ys)
+{
+	long sum = 0;
+
+	for (size_t i = 0; i < xs.size(); i++) sum += data[xs[i]][ys[i]];
+	return sum;
+}
+
+static long sum_packed(const dem_blocks_t *b, const std::vector<int> &xs, const std::vector<int> &ys)
+{
+	long sum = 0;
+
+	for (size_t i = 0; i < xs.size(); i++) sum += blocks_get(b, xs[i], ys[i]);
+	return sum;
+}
+
+/* Times both ways of reading the points, best of a few runs */
+static int compare(const char *name, short *const *data, const dem_blocks_t *b, const std::vector<int> &xs,
+		const std::vector<int> &ys)
+{
+	double raw = INFINITY, packed = INFINITY;
+	long raw_sum = 0, packed_sum = 0;
+
+	for (int run = 0; run < 3; run++) {
+		bench_clock::time_point start = bench_clock::now();
+
+		raw_sum = sum_raw(data, xs, ys);
+		raw = fmin(raw, elapsed_ns(start) / xs.size());
+
+		start = bench_clock::now();
+		packed_sum = sum_packed(b, xs, ys);
+		packed = fmin(packed, elapsed_ns(start) / xs.size());
+	}
+
+	printf("%-8s %10zu reads  raw %6.2f ns  packed %6.2f ns  overhead %+6.1f%%\n", name, xs.size(), raw, packed,
+			(packed / raw - 1) * 100);
+
+	if (raw_sum != packed_sum) {
+		fprintf(stderr, "ssbench: packed terrain differs from raw\n");
+		return EINVAL;
+	}
+	return 0;
+}
+
+/* Sample spacing of the profiles, about an arc second */
+#define PROFILE_STEP	30.0	/* metres */
+
+/* Gathers a profile and reads it back as PlotPropPath() did, in feet, and
+ * returns the angle in degrees from 30 feet over its start to 30 feet
+ * over its end, or to the first obstruction */
+static double profile_feet(const short *grid, const int *cells, int n, double *feet, double *miles, double *elev)
+{
+	double four_thirds_earth = FOUR_THIRDS * EARTHRADIUS, tx, rx, distance, cos_rcvr, cos_test = 1.0, test_alt;
+	int x;
+
+	for (x = 0; x < n; x++) {
+		feet[x] = 3.28084 * grid[cells[x]];
+		miles[x] = x * PROFILE_STEP / METERS_PER_MILE;
+	}
+	for (x = 0; x < n; x++) elev[x + 2] = feet[x] * METERS_PER_FOOT;
+
+	tx = four_thirds_earth + 30.0 + feet[0];
+	rx = four_thirds_earth + 30.0 + feet[n - 1];
+	distance = FEET_PER_MILE * miles[n - 1];
+	cos_rcvr = (tx * tx + distance * distance - rx * rx) / (2.0 * tx * distance);
+	for (x = 2; x < n - 1; x++) {
+		distance = FEET_PER_MILE * miles[x];
+		test_alt = four_thirds_earth + feet[x];
+		cos_test = (tx * tx + distance * distance - test_alt * test_alt) / (2.0 * tx * distance);
+		if (cos_rcvr >= cos_test) return acos(fmin(cos_test, 1.0)) / DEG2RAD - 90.0;
+	}
+	return acos(fmin(cos_rcvr, 1.0)) / DEG2RAD - 90.0;
+}
+
+/* The same, in metres, as PlotPropPath() does now */
+static double profile_metres(const short *grid, const int *cells, int n, float *metres, double *miles, double *elev)
+{
+	double four_thirds_earth = FOUR_THIRDS * EARTHRADIUS * METERS_PER_FOOT, tx, rx, distance, cos_rcvr,
+	       cos_test = 1.0, test_alt;
+	int x;
+
+	for (x = 0; x < n; x++) {
+		metres[x] = grid[cells[x]];
+		miles[x] = x * PROFILE_STEP / METERS_PER_MILE;
+	}
+	for (x = 0; x < n; x++) elev[x + 2] = metres[x];
+
+	tx = four_thirds_earth + 30.0 * METERS_PER_FOOT + metres[0];
+	rx = four_thirds_earth + 30.0 * METERS_PER_FOOT + metres[n - 1];
+	distance = METERS_PER_MILE * miles[n - 1];
+	cos_rcvr = (tx * tx + distance * distance - rx * rx) / (2.0 * tx * distance);
+	for (x = 2; x < n - 1; x++) {
+		distance = METERS_PER_MILE * miles[x];
+		test_alt = four_thirds_earth + metres[x];
+		cos_test = (tx * tx + distance * distance - test_alt * test_alt) / (2.0 * tx * distance);
+		if (cos_rcvr >= cos_test) return acos(fmin(cos_test, 1.0)) / DEG2RAD - 90.0;
+	}
+	return acos(fmin(cos_rcvr, 1.0)) / DEG2RAD - 90.0;
+}
+
+/* Times both ways of reading profiles of n samples, the cells of each in
+ * turn, best of a few runs, and compares what they hand the models */
+static void compare_profiles(const std::vector<short> &grid, const std::vector<int> &cells, int n)
+{
+	size_t profiles = cells.size() / n;
+	std::vector<double> feet(n), miles(n), old_elev(n + 2), new_elev(n + 2);
+	std::vector<float> metres(n);
+	double old_ns = INFINITY, new_ns = INFINITY, elev_diff = 0, angle_diff = 0, sum = 0;
+
+	for (int run = 0; run < 3; run++) {
+		bench_clock::time_point start = bench_clock::now();
+
+		for (size_t p = 0; p < profiles; p++)
+			sum += profile_feet(grid.data(), &cells[p * n], n, feet.data(), miles.data(), old_elev.data());
+		old_ns = fmin(old_ns, elapsed_ns(start) / (profiles * n));
+
+		start = bench_clock::now();
+		for (size_t p = 0; p < profiles; p++)
+			sum += profile_metres(grid.data(), &cells[p * n], n, metres.data(), miles.data(), new_elev.data());
+		new_ns = fmin(new_ns, elapsed_ns(start) / (profiles * n));
+	}
+
+	for (size_t p = 0; p < profiles; p++) {
+		double angle = profile_feet(grid.data(), &cells[p * n], n, feet.data(), miles.data(), old_elev.data());
+
+		angle -= profile_metres(grid.data(), &cells[p * n], n, metres.data(), miles.data(), new_elev.data());
+		angle_diff = fmax(angle_diff, fabs(angle));
+		for (int x = 2; x < n + 2; x++) elev_diff = fmax(elev_diff, fabs(old_elev[x] - new_elev[x]));
+	}
+
+	/* Per sample, a profile keeps a latitude, longitude and distance as
+	 * doubles besides the elevation */
+	printf("profiles %zu x %d samples  feet/double %6.2f ns  metres/float %6.2f ns  %zu -> %zu bytes/sample\n",
+			profiles, n, old_ns, new_ns, 3 * sizeof(double) + sizeof(double), 3 * sizeof(double) + sizeof(float));
+	printf("  largest difference: elevation %.3g m  obstruction angle %.3g degrees\n", elev_diff, angle_diff);
+	sink = (long)sum;
+}
+
+/* A set associative cache, least recently used out, counting misses */
+class sim_cache {
+	int sets, ways, shift;
+	std::vector<uintptr_t> tags;	/* per set, most recently used first */
+
+public:
+	long misses = 0;
+
+	sim_cache(int sets, int ways, int shift) : sets(sets), ways(ways), shift(shift), tags((size_t)sets * ways, 0) {}
+
+	void access(const void *addr)
+	{
+		uintptr_t tag = ((uintptr_t)addr >> shift) + 1;
+		uintptr_t *set = &tags[(tag % sets) * ways];
+		int i;
+
+		for (i = 0; i < ways - 1 && set[i] != tag; i++)
+			;
+		if (set[i] != tag) misses++;
+		for (; i > 0; i--) set[i] = set[i - 1];
+		set[0] = tag;
+	}
+};
+
+/* Opens a CPU counter of cache misses, or returns -1 */
+static int open_misses(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Walks parallel rays across the page in steps of (dx, dy), each next to the last */
+static void walk_rays(int size, int dx, int dy, std::vector<int> &xs, std::vector<int> &ys)
+{
+	xs.clear();
+	ys.clear();
+	for (int o = dx && dy ? 1 - size : 0; o < size; o++) {
+		int x = dx ? 0 : o, y = dx ? o : 0;
+
+		for (; x < size && y < size; x += dx, y += dy)
+			if (x >= 0 && y >= 0) {
+				xs.push_back(x);
+				ys.push_back(y);
+			}
+	}
+}
+
+/* Times reading the page along the rays in the current layout */
+static void walk_layout(const char *name, const std::vector<short> &grid, int size, const std::vector<int> &xs,
+		const std::vector<int> &ys, int counter)
+{
+	std::vector<short> page(layout_cells());
+	sim_cache l1(64, 8, 6), tlb(16, 4, 12);
+	long sum = 0, misses = -1;
+	double ns = INFINITY;
+
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++)
+			page[page_cell(x, y)] = grid[(size_t)x * size + y];
+
+	for (size_t i = 0; i < xs.size(); i++) {
+		const short *cell = &page[page_cell(xs[i], ys[i])];
+
+		l1.access(cell);
+		tlb.access(cell);
+	}
+
+	for (int run = 0; run < 3; run++) {
+		bench_clock::time_point start = bench_clock::now();
+
+		if (counter >= 0) {
+			ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		for (size_t i = 0; i < xs.size(); i++) sum += page[page_cell(xs[i], ys[i])];
+		if (counter >= 0) {
+			long count;
+
+			ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counter, &count, sizeof(count)) == sizeof(count) && (misses < 0 || count < misses))
+				misses = count;
+		}
+		ns = fmin(ns, elapsed_ns(start) / xs.size());
+	}
+
+	printf("  %-6s %-9s %6.2f ns  L1 %.3f  dTLB %.3f", tiled_layout ? "tiled" : "rows", name, ns,
+			(double)l1.misses / xs.size(), (double)tlb.misses / xs.size());
+	if (misses >= 0)
+		printf("  CPU L1 %.3f", (double)misses / xs.size());
+	printf(" misses/sample\n");
+	sink = sum;
+}
+
+int main(int argc, char *argv[])
+{
+	pyramid_t pyr;
+	int result, size;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: ssbench <file.sdp> [reads]\n");
+		return EINVAL;
+	}
+	size_t reads = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000000;
+
+	if ((result = pyramid_open(&pyr, argv[1])) != 0) {
+		fprintf(stderr, "ssbench: cannot open %s: %s\n", argv[1], strerror(result));
+		return result;
+	}
+
+	/* A square page, as the loaders fill */
+	size = pyr.width[0] < pyr.height[0] ? pyr.width[0] : pyr.height[0];
+	std::vector<short> grid((size_t)size * size);
+	std::vector<short *> rows(size);
+
+	result = pyramid_read(&pyr, 0, 0, 0, size, size, grid.data(), 1);
+	pyramid_close(&pyr);
+	if (result != 0) {
+		fprintf(stderr, "ssbench: cannot read %s: %s\n", argv[1], strerror(result));
+		return result;
+	}
+	for (int x = 0; x < size; x++) rows[x] = &grid[(size_t)x * size];
+
+	dem_blocks_t b;
+	bench_clock::time_point start = bench_clock::now();
+
+	blocks_pack(&b, rows.data(), size);
+	double pack = elapsed_ns(start);
+
+	size_t raw_bytes = grid.size() * sizeof(short), packed_bytes = blocks_bytes(&b);
+
+	printf("%s: %d x %d samples\n", argv[1], size, size);
+	printf("raw %.1f MB  packed %.1f MB  ratio %.2f  %.2f bits/sample  packed in %.1f ms\n", raw_bytes / 1048576.0,
+			packed_bytes / 1048576.0, (double)raw_bytes / packed_bytes, packed_bytes * 8.0 / grid.size(),
+			pack / 1e6);
+
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> pick(0, size - 1);
+	std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+	std::vector<int> xs, ys;
+
+	/* Random lookups */
+	xs.resize(reads);
+	ys.resize(reads);
+	for (size_t i = 0; i < reads; i++) {
+		xs[i] = pick(rng);
+		ys[i] = pick(rng);
+	}
+	if ((result = compare("random", rows.data(), &b, xs, ys)) != 0) return result;
+
+	/* Rays from the centre to the edge one sample at a time, in turn, as
+	 * a plot walks its paths */
+	xs.clear();
+	ys.clear();
+	while (xs.size() < reads) {
+		double a = angle(rng), dx = cos(a), dy = sin(a), x = size / 2.0, y = size / 2.0;
+
+		for (; x >= 0 && x < size && y >= 0 && y < size; x += dx, y += dy) {
+			xs.push_back((int)x);
+			ys.push_back((int)y);
+		}
+	}
+	if ((result = compare("rays", rows.data(), &b, xs, ys)) != 0) return result;
+
+	/* Layouts, with rays running side by side as those of a plot do
+	 * near the transmitter */
+	int counter = open_misses();
+	const struct {
+		const char *name;
+		int dx, dy;
+	} rays[] = {{"N/S", 1, 0}, {"E/W", 0, 1}, {"diagonal", 1, 1}};
+
+	IPPD = size;
+	printf("layouts, %s\n", counter >= 0 ? "simulated and CPU misses" : "simulated misses (no perf events)");
+	for (auto &ray : rays) {
+		walk_rays(size, ray.dx, ray.dy, xs, ys);
+		for (int tiled = 0; tiled < 2; tiled++) {
+			tiled_layout = tiled;
+			walk_layout(ray.name, grid, size, xs, ys, counter);
+		}
+	}
+	if (counter >= 0) close(counter);
+
+	/* Profiles from the centre to the edge */
+	int n = size / 2;
+	std::vector<int> cells;
+
+	while (cells.size() + n <= reads) {
+		double a = angle(rng), dx = cos(a), dy = sin(a);
+
+		for (int i = 0; i < n; i++)
+			cells.push_back((int)(size / 2.0 + i * dx) * size + (int)(size / 2.0 + i * dy));
+	}
+	compare_profiles(grid, cells, n);
+
+	return 0;
+}
@@ -3,10 +3,27 @@
 #include <errno.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include "tiles.hh"
+#include "pyramid.hh"
+#include "mem.hh"
 #include "common.hh"
 
 #define MAX_LINE 50000
+#define MIN(x,y)((x)<(y)?(x):(y))
+
+/*
+ * tile_alloc
+ * Allocates zeroed samples for a tile. They are mapped like DEM pages, so
+ * out of core they are spilled to disk too. Returns NULL if there is not
+ * enough memory.
+ */
+short *tile_alloc(size_t samples){
+	return (short *)mem_map(samples * sizeof(short));
+}
 
 /* Computes the distance between two long/lat points */
 double haversine_formula(double th1, double ph1, double th2, double ph2)
@@ -86,7 +103,7 @@ int tile_load_lidar(tile_t *tile, char *filename){
 
 	/* Read the actual tile data */
 	/* Allocate the array for the lidar data */
-	if ( (tile->data = (short*) calloc(tile->width * tile->height, sizeof(short))) == NULL ) {
+	if ( (tile->data = tile_alloc((size_t)tile->width * tile->height)) == NULL ) {
 		fclose(fd);
 		free(tile->filename);
 		return ENOMEM;
@@ -136,19 +153,153 @@ int tile_load_lidar(tile_t *tile, char *filename){
 	return 0;
 }
 
+/*
+ * tile_load_pyramid
+ * Loads one level of a DEM pyramid (.sdp) as a tile, so a coarse plot
+ * reads a quarter, a sixteenth or a sixty-fourth of the samples. The
+ * level is clamped to the levels the file has. Resolutions are those of
+ * level 0 scaled by the level, so tiles of different levels line up.
+ */
+int tile_load_pyramid(tile_t *tile, char *filename, int level){
+	pyramid_t pyr;
+	int success;
+
+	/* Clear the tile data */
+	memset(tile, 0x00, sizeof(tile_t));
+
+	if ((success = pyramid_open(&pyr, filename)) != 0)
+		return success;
+
+	level = MAX(0, MIN(level, pyr.header.levels - 1));
+
+	tile->filename = strdup(filename);
+	tile->level = level;
+	tile->width = pyr.width[level];
+	tile->height = pyr.height[level];
+	tile->max_north = pyr.header.max_north;
+	tile->min_north = pyr.header.min_north;
+	tile->max_west = pyr.header.max_west;
+	tile->min_west = pyr.header.min_west;
+	tile->cellsize = (tile->max_north - tile->min_north) / tile->height;
+
+	/* Keep the WGS84 extent up to date, as tile_load_lidar() does */
+	double xll = tile->max_west > 180 ? 360 - tile->max_west : -tile->max_west;
+	double xur = tile->min_west > 180 ? 360 - tile->min_west : -tile->min_west;
+	if (xur > eastoffset)
+		eastoffset = xur;
+	if (xll < westoffset)
+		westoffset = xll;
+
+	if ( (tile->data = tile_alloc((size_t)tile->width * tile->height)) == NULL ) {
+		pyramid_close(&pyr);
+		free(tile->filename);
+		return ENOMEM;
+	}
+
+	/* Elevation limits are those of the full resolution data, from zero
+	 * as tile_load_lidar() gives them, which the level 0 block table has */
+	for (auto &b : pyr.blocks[0]) {
+		if (b.max_el > tile->max_el)
+			tile->max_el = b.max_el;
+		if (b.min_el < tile->min_el)
+			tile->min_el = b.min_el;
+	}
+
+	success = pyramid_read(&pyr, level, 0, 0, tile->height, tile->width, tile->data, MAX(std::thread::hardware_concurrency(), 1u));
+	pyramid_close(&pyr);
+
+	if (success != 0) {
+		tile_destroy(tile);
+		free(tile->filename);
+		return success;
+	}
+
+	double current_res_km = haversine_formula(tile->max_north, tile->max_west, tile->max_north, tile->min_west);
+	tile->precise_resolution = (current_res_km/MAX(pyr.header.width,pyr.header.height)*1000);
+
+	// Round to nearest 0.5, then scale to the level
+	tile->resolution = tile->precise_resolution < 0.5f ? 0.5f : ceil((tile->precise_resolution * 2)+0.5) / 2;
+	tile->precise_resolution *= 1 << level;
+	tile->resolution *= 1 << level;
+
+	// Positive westing
+	tile->width_deg = tile->max_west - tile->min_west >= 0 ? tile->max_west - tile->min_west : tile->max_west + (360 - tile->min_west);
+	tile->height_deg = tile->max_north - tile->min_north;
+
+	tile->ppdx = tile->width / tile->width_deg;
+	tile->ppdy = tile->height / tile->height_deg;
+
+	if (debug)
+		fprintf(stderr,"Pyramid %s level %d: %dx%d (PPD %dx%d, Res %f (%.2f))\n", filename, level, tile->width, tile->height, tile->ppdx, tile->ppdy, tile->precise_resolution, tile->resolution);
+
+	return 0;
+}
+
+/*
+ * Resampling taps. For every destination pixel along one axis this holds
+ * the source pixels that contribute to it and their weights: the covered
+ * area when shrinking (box filter) or the two nearest neighbours when
+ * growing (bilinear). Factors do not need to be whole numbers.
+ */
+typedef struct _taps_t{
+	std::vector<int>	start;	/* dst i uses idx/weight[start[i] .. start[i+1]) */
+	std::vector<int>	idx;
+	std::vector<float>	weight;
+	int	first(int i) const { return idx[start[i]]; }
+	int	last(int i) const { return idx[start[i + 1] - 1]; }
+} taps_t;
+
+static void build_taps(taps_t &t, int src, int dst){
+	double ratio = (double)src / dst;
+
+	t.start.resize(dst + 1);
+	t.idx.clear();
+	t.weight.clear();
+
+	for (int i = 0; i < dst; i++) {
+		t.start[i] = t.idx.size();
+		if (dst < src) {
+			/* Box: average everything the destination pixel covers */
+			double a = i * ratio, b = MIN((i + 1) * ratio, (double)src);
+			for (int k = (int)a; k < b; k++) {
+				double w = MIN(b, (double)k + 1) - MAX(a, (double)k);
+				if (w > 0) {
+					t.idx.push_back(k);
+					t.weight.push_back(w);
+				}
+			}
+		} else {
+			/* Bilinear between the two nearest pixel centres */
+			double u = (i + 0.5) * ratio - 0.5;
+			if (u < 0) u = 0;
+			if (u > src - 1) u = src - 1;
+			int k = (int)u;
+			double f = u - k;
+			t.idx.push_back(k);
+			t.weight.push_back(1 - f);
+			if (f > 0 && k + 1 < src) {
+				t.idx.push_back(k + 1);
+				t.weight.push_back(f);
+			}
+		}
+	}
+	t.start[dst] = t.idx.size();
+}
+
+#define RESCALE_BAND 32
+
 /*
  * tile_rescale
  * This is used to resample tile data. It is particularly designed for
  * use with LIDAR tiles where the resolution can be anything up to 2m.
- * This function is capable of merging neighbouring pixel values
- * The scaling factor is the distance to merge pixels.
- * NOTE: This means that new resolutions can only increment in multiples of the original
- * (ie 2m LIDAR can be 4/6/8/... and 20m can be 40/60)
+ * The scaling factor is the ratio of new to old pixels along each axis
+ * and can be any positive value: shrinking averages the covered pixels,
+ * growing interpolates bilinearly. Voids (0) are left out of the average.
+ * The work is split into bands of rows over `threads` threads.
  */
-int tile_rescale(tile_t *tile, float scale){
+int tile_rescale(tile_t *tile, float scale, int threads){
 	short *new_data;
-	size_t skip_count = 1;
-	size_t copy_count = 1;
+	taps_t tx, ty;
 
 	if (scale == 1) {
 		return 0;	
@@ -157,53 +308,92 @@ int tile_rescale(tile_t *tile, float scale){
 	size_t new_height = tile->height * scale;
 	size_t new_width = tile->width * scale;
 
+	if (new_height == 0 || new_width == 0)
+		return EINVAL;
+
 	/* Allocate the array for the lidar data */
-	if ( (new_data = (short*) calloc(new_height * new_width, sizeof(short))) == NULL ) {
+	if ( (new_data = tile_alloc(new_height * new_width)) == NULL ) {
 		return ENOMEM;
 	}
 
-	tile->max_el = -32768;
-	tile->min_el = 32768;
-
-	/* Making the tile data smaller */
-	if (scale < 1) {
-		skip_count = 1 / scale;
-	} else {
-		copy_count = (size_t) scale;
-	}
-
 	if (debug) {
-		fprintf(stderr,"Resampling tile %s [%.1f]:\n\tOld %dx%d. New %zux%zu\n\tScale %f Skip %zu Copy %zu\n", tile->filename, tile->resolution, tile->width, tile->height, new_width, new_height, scale, skip_count, copy_count);
+		fprintf(stderr,"Resampling tile %s [%.1f]:\n\tOld %dx%d. New %zux%zu\n\tScale %f (%s)\n", tile->filename, tile->resolution, tile->width, tile->height, new_width, new_height, scale, scale < 1 ? "box" : "bilinear");
 		fflush(stderr);
 	}
-	/* Nearest neighbour normalization. For each subsample of the original, simply
-	 * assign the value in the top left to the new pixel 
-	 * SOURCE: X / Y
-	 * DEST:   I / J */
-
-	for (size_t y = 0, j = 0; y < (unsigned)tile->height && j < new_height; y += skip_count, j += copy_count) {
-
-		for (size_t x = 0, i = 0; x < (unsigned)tile->width && i < new_width; x += skip_count, i += copy_count) {
-		
-			/* These are for scaling up the data */
-			for (size_t copy_y = 0; copy_y < copy_count; copy_y++) {
-				for (size_t copy_x = 0; copy_x < copy_count; copy_x++) {
-					size_t new_j = j + copy_y;
-					size_t new_i = i + copy_x;
-					/* Do the copy */
-					new_data[ new_j * new_width + new_i ] = tile->data[y * tile->width + x];
+
+	build_taps(tx, tile->width, new_width);
+	build_taps(ty, tile->height, new_height);
+
+	size_t nbands = (new_height + RESCALE_BAND - 1) / RESCALE_BAND;
+	std::atomic<size_t> next(0);
+	std::vector<short> band_max(nbands, 0), band_min(nbands, 0);
+
+	auto worker = [&]() {
+		/* Horizontally filtered source rows for one band, as weighted value and weight sums */
+		std::vector<float> hv, hw, acc_v(new_width), acc_w(new_width);
+		size_t b;
+
+		while ((b = next++) < nbands) {
+			size_t j0 = b * RESCALE_BAND, j1 = MIN(j0 + RESCALE_BAND, new_height);
+			int y0 = ty.first(j0), y1 = ty.last(j1 - 1);
+			short bmax = -32768, bmin = 32767;
+
+			hv.resize((y1 - y0 + 1) * new_width);
+			hw.resize((y1 - y0 + 1) * new_width);
+
+			for (int y = y0; y <= y1; y++) {
+				const short *src = &tile->data[(size_t)y * tile->width];
+				float *rv = &hv[(y - y0) * new_width], *rw = &hw[(y - y0) * new_width];
+				for (size_t i = 0; i < new_width; i++) {
+					float v = 0, w = 0;
+					for (int t = tx.start[i]; t < tx.start[i + 1]; t++) {
+						short s = src[tx.idx[t]];
+						if (s > 0) {
+							v += tx.weight[t] * s;
+							w += tx.weight[t];
+						}
+					}
+					rv[i] = v;
+					rw[i] = w;
 				}
 			}
-			/* Update local min / max values */
-			if (tile->data[y * tile->width + x] > tile->max_el)
-				tile->max_el = tile->data[y * tile->width + x];
-			if (tile->data[y * tile->width + x] < tile->min_el)
-				tile->min_el = tile->data[y * tile->width + x];
+
+			for (size_t j = j0; j < j1; j++) {
+				float *av = acc_v.data(), *aw = acc_w.data();
+				memset(av, 0, new_width * sizeof(float));
+				memset(aw, 0, new_width * sizeof(float));
+				for (int t = ty.start[j]; t < ty.start[j + 1]; t++) {
+					const float wt = ty.weight[t];
+					const float *rv = &hv[(ty.idx[t] - y0) * new_width], *rw = &hw[(ty.idx[t] - y0) * new_width];
+					for (size_t i = 0; i < new_width; i++) {
+						av[i] += wt * rv[i];
+						aw[i] += wt * rw[i];
+					}
+				}
+				short *dst = &new_data[j * new_width];
+				for (size_t i = 0; i < new_width; i++) {
+					dst[i] = aw[i] > 0 ? (short)lrintf(av[i] / aw[i]) : 0;
+					if (dst[i] > bmax) bmax = dst[i];
+					if (dst[i] < bmin) bmin = dst[i];
+				}
+			}
+			band_max[b] = bmax;
+			band_min[b] = bmin;
 		}
-	}
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads && (size_t)t < nbands; t++)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (auto &th : workers)
+		th.join();
+
+	tile->max_el = *std::max_element(band_max.begin(), band_max.end());
+	tile->min_el = *std::min_element(band_min.begin(), band_min.end());
 
 	/* Update the date in the tile */
-	free(tile->data);
+	mem_unmap(tile->data, (size_t)tile->width * tile->height * sizeof(short));
 	tile->data = new_data;
 
 	/* Update the height and width values */
@@ -232,7 +422,7 @@ int tile_resize(tile_t* tile, int resolution){
 	float scaling_factor = resolution / current_res;
 	if (debug)
 		fprintf(stderr, "Resampling: Current %dm Desired %dm Scale %.1f\n", current_res, resolution, scaling_factor);
-	return tile_rescale(tile, scaling_factor);
+	return tile_rescale(tile, scaling_factor, MAX(std::thread::hardware_concurrency(), 1u));
 }
 
 /*
@@ -241,6 +431,6 @@ int tile_resize(tile_t* tile, int resolution){
  */
 void tile_destroy(tile_t* tile){
 	if (tile->data != NULL)
-		free(tile->data);
+		mem_unmap(tile->data, (size_t)tile->width * tile->height * sizeof(short));
 }
 
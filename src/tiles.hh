@@ -1,6 +1,8 @@
 #ifndef _TILES_HH_
 #define _TILES_HH_
 
+#include <stddef.h>
+
 typedef struct _tile_t{
 	char	*filename;
 	union{
@@ -39,10 +41,14 @@ typedef struct _tile_t{
 	double	height_deg;
 	int		ppdx;
 	int		ppdy;
+	int		level;	/* pyramid overview level, 0 for full resolution */
 } tile_t, *ptile_t;
 
+double haversine_formula(double, double, double, double);
 int tile_load_lidar(tile_t*, char *);
-int tile_rescale(tile_t *, float);
+int tile_load_pyramid(tile_t*, char *, int);
+int tile_rescale(tile_t *, float, int);
+short *tile_alloc(size_t);
 void tile_destroy(tile_t *);
 
 #endif
\ No newline at end of file
@@ -8,7 +8,6 @@
 #
 ################################################################################
 
-for file in *.hgt
-do
-	srtm2sdf -d /dev/null $file
-done
+# Converts every tile in the current directory, one per CPU core
+
+srtm2sdf -d /dev/null .
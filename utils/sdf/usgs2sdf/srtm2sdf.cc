@@ -4,31 +4,69 @@
  **     detect and handle voids found in the SRTM data,      **
  **     SRTM-3 data in .BIL and .HGT format, and high        **
  **     resolution SRTM-1 one arc-second topography data.    **
- **************************************************************/ 
+ **************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <bzlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define BZBUFFER 65536
 
-char	sdf_filename[30], sdf_path[255], replacement_flag, opened=0,
-	hgt=0, bil=0;
+/* Binary SDF (.sdb): this header followed by ippd x ippd little-endian
+   16 bit samples, in the same order as the values of a text SDF */
 
-int	srtm[3601][3601], usgs[1201][1201], max_north, max_west, n,
-	min_north, min_west, merge=0, min_elevation, bzerror, ippd, mpi;
+#define SDB_MAGIC "SDB1"
 
-int ReadSRTM(char *filename)
+struct sdb_header
 {
-	int x, y, infile, byte=0, bytes_read;
-	unsigned char error, buffer[2];
+	char	magic[4];
+	int	ippd, max_west, min_north, min_west, max_north;
+};
+
+/* Everything needed to convert one tile. Batch mode converts several
+   tiles at once, one of these per worker. */
+
+struct tile
+{
+	char	sdf_filename[30], replacement_flag, hgt, bil, merge;
+	int	max_north, max_west, min_north, min_west;
+	std::vector<short> srtm;	/* (ippd+1) x (ippd+1) samples, north to south */
+	std::vector<short> usgs;	/* 1201 x 1201 samples from usgs2sdf SDF files */
+};
+
+#define SRTM(t,y,x) ((t)->srtm[(y)*(ippd+1)+(x)])
+#define USGS(t,y,x) ((t)->usgs[(y)*1201+(x)])
+
+char	sdf_path[255], out_path[255], opened=0, binary=0;
+
+int	n, min_elevation, bzerror, ippd, mpi;
+
+/* The SDF readers used for merging share static buffers */
+std::mutex usgs_lock, print_lock;
+
+int ReadSRTM(struct tile *t, char *filename)
+{
+	int x, y, infile, byte=0;
+	unsigned char error, *buffer;
 	char north[3], west[4], *base=NULL, blw_filename[255];
-	double cell_size, deg_north, deg_west;
+	double cell_size, deg_north=0.0, deg_west=0.0;
+	ssize_t size, bytes_read;
 	FILE *fd=NULL;
 
+	t->hgt=0;
+	t->bil=0;
+
 	if (strstr(filename, ".zip")!=NULL)
 	{
 		fprintf(stderr, "*** Error: \"%s\" must be uncompressed\n",filename);
@@ -50,10 +88,10 @@ int ReadSRTM(char *filename)
 	}
 
 	if (strstr(filename, ".hgt")!=NULL)
-		hgt=1;
+		t->hgt=1;
 
 	if (strstr(filename, ".bil")!=NULL)
-		bil=1;
+		t->bil=1;
 
 	base=strrchr(filename, '/');
 
@@ -62,7 +100,7 @@ int ReadSRTM(char *filename)
 	else
 		base+=1;
 
-	if (hgt)
+	if (t->hgt)
 	{
 		/* We obtain coordinates from the base of the .HGT filename */
 
@@ -81,25 +119,25 @@ int ReadSRTM(char *filename)
 			return -1;
 		}
 
-		max_west=atoi(west);
+		t->max_west=atoi(west);
 
 		if (base[3]=='E')
-			max_west=360-max_west;
+			t->max_west=360-t->max_west;
 
-		min_west=max_west-1;
+		t->min_west=t->max_west-1;
 
-		if (max_west==360)
-			max_west=0;
+		if (t->max_west==360)
+			t->max_west=0;
 
 		if (base[0]=='N')
-			min_north=atoi(north);
+			t->min_north=atoi(north);
 		else
-			min_north=-atoi(north);
+			t->min_north=-atoi(north);
 
-		max_north=min_north+1;
+		t->max_north=t->min_north+1;
 	}
 
-	if (bil)
+	if (t->bil)
 	{
 		/* We obtain .BIL file coordinates
 		   from the corresponding .BLW file */
@@ -121,8 +159,9 @@ int ReadSRTM(char *filename)
 
 				if ((cell_size<0.0008) || (cell_size>0.0009))
 				{
-					printf("\n*** .BIL file's cell size is incompatible with SPLAT!!\n");
-					exit(1);
+					fprintf(stderr, "*** Error: \"%s\" .BIL file's cell size is incompatible with SPLAT!!\n", filename);
+					fclose(fd);
+					return -1;
 				}
 
 				n=fscanf(fd,"%lf",&deg_west);
@@ -136,77 +175,95 @@ int ReadSRTM(char *filename)
 				fclose(fd);
 			}
 
-			min_north=(int)(deg_north);
-			max_north=min_north+1;
+			t->min_north=(int)(deg_north);
+			t->max_north=t->min_north+1;
 
 			if (deg_west<0.0)
 				deg_west=-deg_west;
 			else
 				deg_west=360.0-deg_west;
 
-			min_west=(int)(deg_west);
+			t->min_west=(int)(deg_west);
 
-			if (min_west==360)
-				min_west=0;
+			if (t->min_west==360)
+				t->min_west=0;
 
-			max_west=min_west+1;
+			t->max_west=t->min_west+1;
 		}
 	}
 
 	infile=open(filename, O_RDONLY);
 
-	if (infile==0)
+	if (infile<0)
 	{
 		fprintf(stderr, "*** Error: Cannot open \"%s\"\n", filename);
 		return -1;
 	}
 
-	n=read(infile,&buffer,2);
+	/* Read the whole tile in one go */
+
+	size=(ssize_t)(ippd+1)*(ippd+1)*2;
+	buffer=(unsigned char *)malloc(size);
 
-	if ((buffer[0]=='P') && (buffer[1]=='K'))
+	if (buffer==NULL)
 	{
-		fprintf(stderr, "*** Error: \"%s\" still appears to be compressed!\n",filename);
+		fprintf(stderr, "*** Error: Out of memory reading \"%s\"\n", filename);
 		close(infile);
 		return -1;
 	}
 
-	lseek(infile,0L,SEEK_SET);
+	for (bytes_read=0; bytes_read<size; )
+	{
+		ssize_t r=read(infile, buffer+bytes_read, size-bytes_read);
+
+		if (r<=0)
+			break;
+
+		bytes_read+=r;
+	}
+
+	close(infile);
+
+	if (bytes_read>=2 && (buffer[0]=='P') && (buffer[1]=='K'))
+	{
+		fprintf(stderr, "*** Error: \"%s\" still appears to be compressed!\n",filename);
+		free(buffer);
+		return -1;
+	}
 
 	if (ippd==3600)
-		sprintf(sdf_filename, "%d_%d_%d_%d-hd.sdf", min_north, max_north, min_west, max_west);
+		snprintf(t->sdf_filename, sizeof(t->sdf_filename), "%d_%d_%d_%d-hd.%s", t->min_north, t->max_north, t->min_west, t->max_west, binary ? "sdb" : "sdf");
 	else
-		sprintf(sdf_filename, "%d_%d_%d_%d.sdf", min_north, max_north, min_west, max_west);
+		snprintf(t->sdf_filename, sizeof(t->sdf_filename), "%d_%d_%d_%d.%s", t->min_north, t->max_north, t->min_west, t->max_west, binary ? "sdb" : "sdf");
 
 	error=0;
-	replacement_flag=0;
-
-	printf("Reading %s... ", filename);
-	fflush(stdout);
+	t->replacement_flag=0;
+	t->srtm.assign((ippd+1)*(ippd+1), 0);
 
 	for (x=0; (x<=ippd && error==0); x++)
 		for (y=0; (y<=ippd && error==0); y++)
 		{
-			bytes_read=read(infile,&buffer,2);
+			ssize_t i=((ssize_t)x*(ippd+1)+y)*2;
 
-			if (bytes_read==2)
+			if (i+2<=bytes_read)
 			{
-				if (bil)
+				if (t->bil)
 				{
 					/* "little-endian" structure */
 
-					byte=buffer[0]+(buffer[1]<<8);
+					byte=buffer[i]+(buffer[i+1]<<8);
 
-					if (buffer[1]&128)
+					if (buffer[i+1]&128)
 						byte-=0x10000;
 				}
 
-				if (hgt)
+				if (t->hgt)
 				{
 					/* "big-endian" structure */
 
-					byte=buffer[1]+(buffer[0]<<8);
+					byte=buffer[i+1]+(buffer[i]<<8);
 
-					if (buffer[0]&128)
+					if (buffer[i]&128)
 						byte-=0x10000;
 				}
 
@@ -219,31 +276,31 @@ int ReadSRTM(char *filename)
 					byte=32767;
 
 				if (byte<=min_elevation)
-					replacement_flag=1;
+					t->replacement_flag=1;
 
-				srtm[x][y]=byte;
+				SRTM(t,x,y)=byte;
 			}
 
 			else
 				error=1;
 		}
 
+	free(buffer);
+
 	if (error)
 	{
-		fprintf(stderr,"\n*** Error: Premature EOF detected while reading \"%s\"!  :-(\n",filename);
+		fprintf(stderr,"*** Error: Premature EOF detected while reading \"%s\"!  :-(\n",filename);
 	}
 
-	close(infile);
-
 	return 0;
 }
 
-int LoadSDF_SDF(char *name)
+int LoadSDF_SDF(struct tile *t, char *name)
 {
 	/* This function reads uncompressed
 	   SPLAT Data Files (.sdf) into memory. */
 
-	int x, y, dummy;
+	int x, y, dummy, value;
 	char sdf_file[255], path_plus_name[512];
 	FILE *infile;
 
@@ -269,12 +326,12 @@ int LoadSDF_SDF(char *name)
 	n=fscanf(infile,"%d", &dummy);
 	n=fscanf(infile,"%d", &dummy);
 
-	printf("\nReading %s... ",path_plus_name);
-	fflush(stdout);
-
 	for (x=0; x<1200; x++)
 		for (y=0; y<1200; y++)
-			n=fscanf(infile,"%d",&usgs[x][y]);
+		{
+			n=fscanf(infile,"%d",&value);
+			USGS(t,x,y)=value;
+		}
 
 	fclose(infile);
 
@@ -340,12 +397,12 @@ char *BZfgets(BZFILE *bzfd, unsigned length)
 	return (output);
 }
 
-int LoadSDF_BZ(char *name)
+int LoadSDF_BZ(struct tile *t, char *name)
 {
 	/* This function reads .bz2 compressed
 	   SPLAT Data Files into memory. */
 
-	int x, y, dummy;
+	int x, y, dummy, value;
 	char sdf_file[255], path_plus_name[255];
 	FILE *fd;
 	BZFILE *bzfd;
@@ -371,17 +428,17 @@ int LoadSDF_BZ(char *name)
 
 	if (fd!=NULL && bzerror==BZ_OK)
 	{
-		printf("\nReading %s... ",path_plus_name);
-		fflush(stdout);
-
 		sscanf(BZfgets(bzfd,255),"%d",&dummy);
 		sscanf(BZfgets(bzfd,255),"%d",&dummy);
 		sscanf(BZfgets(bzfd,255),"%d",&dummy);
 		sscanf(BZfgets(bzfd,255),"%d",&dummy);
-	
+
 		for (x=0; x<1200; x++)
 			for (y=0; y<1200; y++)
-				sscanf(BZfgets(bzfd,20),"%d",&usgs[x][y]);
+			{
+				sscanf(BZfgets(bzfd,20),"%d",&value);
+				USGS(t,x,y)=value;
+			}
 
 		fclose(fd);
 
@@ -394,7 +451,7 @@ int LoadSDF_BZ(char *name)
 		return 0;
 }
 
-char LoadSDF(char *name)
+char LoadSDF(struct tile *t, char *name)
 {
 	/* This function loads the requested SDF file from the filesystem.
 	   First, it tries to invoke the LoadSDF_SDF() function to load an
@@ -406,43 +463,49 @@ char LoadSDF(char *name)
 
 	/* Try to load an uncompressed SDF first. */
 
-	return_value=LoadSDF_SDF(name);
+	return_value=LoadSDF_SDF(t,name);
 
 	/* If that fails, try loading a compressed SDF. */
 
 	if (return_value==0 || return_value==-1)
-		return_value=LoadSDF_BZ(name);
+		return_value=LoadSDF_BZ(t,name);
 
 	return return_value;
 }
 
-int ReadUSGS()
+int ReadUSGS(struct tile *t)
 {
-	char usgs_filename[15];
+	char usgs_filename[48];
 
 	/* usgs_filename is a minimal filename ("40:41:74:75").
 	   Full path and extentions are added later though
 	   subsequent function calls. */
 
-	sprintf(usgs_filename, "%d_%d_%d_%d", min_north, max_north, min_west, max_west);
+	snprintf(usgs_filename, sizeof(usgs_filename), "%d_%d_%d_%d", t->min_north, t->max_north, t->min_west, t->max_west);
+
+	std::lock_guard<std::mutex> lock(usgs_lock);
+
+	t->usgs.assign(1201*1201, 0);
 
-	return (LoadSDF(usgs_filename));
+	return (LoadSDF(t,usgs_filename));
 }
 
-void average_terrain(int y, int x, int z)
+void average_terrain(struct tile *t, int y, int x, int z)
 {
 	long accum;
 	int temp=0, count, bad_value;
 	double average;
 
-	bad_value=srtm[y][x];
+	(void)z;
+
+	bad_value=SRTM(t,y,x);
 
 	accum=0L;
 	count=0;
 
 	if (y>=2)
 	{
-		temp=srtm[y-1][x];
+		temp=SRTM(t,y-1,x);
 
 		if (temp>bad_value)
 		{
@@ -453,7 +516,7 @@ void average_terrain(int y, int x, int z)
 
 	if (y<=mpi)
 	{
-		temp=srtm[y+1][x];
+		temp=SRTM(t,y+1,x);
 
 		if (temp>bad_value)
 		{
@@ -464,7 +527,7 @@ void average_terrain(int y, int x, int z)
 
 	if ((y>=2) && (x<=(mpi-1)))
 	{
-		temp=srtm[y-1][x+1];
+		temp=SRTM(t,y-1,x+1);
 
 		if (temp>bad_value)
 		{
@@ -475,7 +538,7 @@ void average_terrain(int y, int x, int z)
 
 	if (x<=(mpi-1))
 	{
-		temp=srtm[y][x+1];
+		temp=SRTM(t,y,x+1);
 
 		if (temp>bad_value)
 		{
@@ -486,7 +549,7 @@ void average_terrain(int y, int x, int z)
 
 	if ((x<=(mpi-1)) && (y<=mpi))
 	{
-		temp=srtm[y+1][x+1];
+		temp=SRTM(t,y+1,x+1);
 
 		if (temp>bad_value)
 		{
@@ -495,9 +558,9 @@ void average_terrain(int y, int x, int z)
 		}
 	}
 
-	if ((x>=1) && (y>=2)) 
+	if ((x>=1) && (y>=2))
 	{
-		temp=srtm[y-1][x-1];
+		temp=SRTM(t,y-1,x-1);
 
 		if (temp>bad_value)
 		{
@@ -508,7 +571,7 @@ void average_terrain(int y, int x, int z)
 
 	if (x>=1)
 	{
-		temp=srtm[y][x-1];
+		temp=SRTM(t,y,x-1);
 
 		if (temp>bad_value)
 		{
@@ -519,7 +582,7 @@ void average_terrain(int y, int x, int z)
 
 	if ((y<=mpi) && (x>=1))
 	{
-		temp=srtm[y+1][x-1];
+		temp=SRTM(t,y+1,x-1);
 
 		if (temp>bad_value)
 		{
@@ -535,12 +598,69 @@ void average_terrain(int y, int x, int z)
 	}
 
 	if (temp>min_elevation)
-		srtm[y][x]=temp;
+		SRTM(t,y,x)=temp;
 	else
-		srtm[y][x]=min_elevation;
+		SRTM(t,y,x)=min_elevation;
 }
 
-void WriteSDF(char *filename)
+int SDFValue(struct tile *t, int y, int x, int *last_good_byte)
+{
+	/* Returns the SDF sample for SRTM row y, column x, replacing
+	   voids from the USGS data or by averaging their neighbours.
+	   Samples must be requested in file order, as averaging
+	   writes back into the SRTM grid. */
+
+	int byte=SRTM(t,y,x);
+
+	if (byte>min_elevation)
+		*last_good_byte=byte;
+
+	if (byte<min_elevation)
+	{
+		if (t->merge)
+		{
+			if (ippd==3600)
+				return USGS(t,1200-(y/3),1199-(x/3));
+			else
+				return USGS(t,1200-y,1199-x);
+		}
+
+		else
+		{
+			average_terrain(t,y,x,*last_good_byte);
+			return SRTM(t,y,x);
+		}
+	}
+
+	return byte;
+}
+
+static char *append_int(char *p, int value)
+{
+	/* Formats value followed by a newline at p, like "%d\n" */
+
+	char digits[12];
+	int i=0;
+	unsigned v=value<0 ? -(unsigned)value : value;
+
+	if (value<0)
+		*p++='-';
+
+	do
+	{
+		digits[i++]='0'+v%10;
+		v/=10;
+	} while (v);
+
+	while (i)
+		*p++=digits[--i];
+
+	*p++='\n';
+
+	return p;
+}
+
+int WriteSDF(struct tile *t, char *filename)
 {
 	/* Like the HGT files, the extreme southwest corner
 	 * provides the point of reference for the SDF file.
@@ -551,56 +671,143 @@ void WriteSDF(char *filename)
 	 * overlapping edge redundancy present in the HGT
 	 * and earlier USGS files is not necessary, nor
 	 * is it present in SDF files.
+	 *
+	 * The whole file is formatted in memory and written
+	 * with a single call.
 	 */
 
-	int x, y, byte, last_good_byte=0;
+	int x, y, last_good_byte=0;
 	FILE *outfile;
+	std::vector<char> text((size_t)ippd*ippd*7+64);
+	char *p=text.data();
 
-	printf("\nWriting %s... ", filename);
-	fflush(stdout);
+	p+=sprintf(p, "%d\n%d\n%d\n%d\n", t->max_west, t->min_north, t->min_west, t->max_north);
+
+	for (y=ippd; y>=1; y--)		/* Omit the northern most edge */
+		for (x=mpi; x>=0; x--) /* Omit the eastern most edge  */
+			p=append_int(p, SDFValue(t,y,x,&last_good_byte));
 
 	outfile=fopen(filename,"wb");
 
-	fprintf(outfile, "%d\n%d\n%d\n%d\n", max_west, min_north, min_west, max_north);
+	if (outfile==NULL)
+	{
+		fprintf(stderr, "*** Error: Cannot create \"%s\"\n", filename);
+		return -1;
+	}
 
-	for (y=ippd; y>=1; y--)		/* Omit the northern most edge */
-		for (x=mpi; x>=0; x--) /* Omit the eastern most edge  */
-		{
-			byte=srtm[y][x];
+	fwrite(text.data(), 1, p-text.data(), outfile);
 
-			if (byte>min_elevation)
-				last_good_byte=byte;
+	return fclose(outfile)==0 ? 0 : -1;
+}
 
-			if (byte<min_elevation)
-			{
-				if (merge)
-				{
-					if (ippd==3600)
-						fprintf(outfile,"%d\n",usgs[1200-(y/3)][1199-(x/3)]);
-					else
-						fprintf(outfile,"%d\n",usgs[1200-y][1199-x]);
-				}
+int WriteSDB(struct tile *t, char *filename)
+{
+	/* Writes the same samples as WriteSDF() as a binary SDF (.sdb),
+	   which Signal-Server reads straight into its DEM pages. */
 
-				else
-				{
-					average_terrain(y,x,last_good_byte);
-					fprintf(outfile,"%d\n",srtm[y][x]);
-				}
-			}
-			else
-				fprintf(outfile,"%d\n",byte);
+	int x, y, last_good_byte=0;
+	struct sdb_header header;
+	FILE *outfile;
+	std::vector<unsigned char> samples((size_t)ippd*ippd*2);
+	unsigned char *p=samples.data();
+
+	memcpy(header.magic, SDB_MAGIC, 4);
+	header.ippd=ippd;
+	header.max_west=t->max_west;
+	header.min_north=t->min_north;
+	header.min_west=t->min_west;
+	header.max_north=t->max_north;
+
+	for (y=ippd; y>=1; y--)
+		for (x=mpi; x>=0; x--)
+		{
+			int value=SDFValue(t,y,x,&last_good_byte);
+
+			*p++=value&0xff;
+			*p++=(value>>8)&0xff;
 		}
 
-	printf("Done!\n");
+	outfile=fopen(filename,"wb");
+
+	if (outfile==NULL)
+	{
+		fprintf(stderr, "*** Error: Cannot create \"%s\"\n", filename);
+		return -1;
+	}
+
+	fwrite(&header, sizeof(header), 1, outfile);
+	fwrite(samples.data(), 1, samples.size(), outfile);
+
+	return fclose(outfile)==0 ? 0 : -1;
+}
+
+int Convert(struct tile *t, char *filename)
+{
+	/* Converts one SRTM file into an SDF (or SDB) file in out_path */
+
+	char path_plus_name[512];
+
+	if (ReadSRTM(t,filename)!=0)
+		return -1;
+
+	t->merge=0;
+
+	if (t->replacement_flag && sdf_path[0])
+		t->merge=ReadUSGS(t);
+
+	snprintf(path_plus_name, sizeof(path_plus_name), "%s%s", out_path, t->sdf_filename);
+
+	if ((binary ? WriteSDB(t,path_plus_name) : WriteSDF(t,path_plus_name))!=0)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(print_lock);
+	printf("%s -> %s\n", filename, path_plus_name);
+	fflush(stdout);
+
+	return 0;
+}
+
+void AddInput(std::vector<std::string> &inputs, const char *name)
+{
+	/* Queues a file, or every .hgt and .bil file in a directory */
+
+	struct stat st;
+	struct dirent *entry;
+	DIR *dir;
+	std::vector<std::string> found;
 
-	fclose(outfile);
+	if (stat(name, &st)!=0 || !S_ISDIR(st.st_mode))
+	{
+		inputs.push_back(name);
+		return;
+	}
+
+	if ((dir=opendir(name))==NULL)
+	{
+		fprintf(stderr, "*** Error: Cannot read directory \"%s\"\n", name);
+		return;
+	}
+
+	while ((entry=readdir(dir))!=NULL)
+	{
+		size_t len=strlen(entry->d_name);
+
+		if (len>4 && (strcmp(entry->d_name+len-4, ".hgt")==0 || strcmp(entry->d_name+len-4, ".bil")==0))
+			found.push_back(std::string(name)+"/"+entry->d_name);
+	}
+
+	closedir(dir);
+
+	std::sort(found.begin(), found.end());
+	inputs.insert(inputs.end(), found.begin(), found.end());
 }
 
 int main(int argc, char *argv[])
 {
-	int x, y, z=0;
+	int x, y, z=0, threads=0;
 	char *env=NULL, string[255], *s=NULL;
 	FILE *fd;
+	std::vector<std::string> inputs;
 
 	if (strstr(argv[0], "srtm2sdf-hd")!=NULL)
 	{
@@ -627,10 +834,16 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "\tAvailable Options...\n\n");
 		fprintf(stderr, "\t-d directory path of usgs2sdf derived SDF files\n\t    (overrides path in ~/.splat_path file)\n\n");
 		fprintf(stderr, "\t-n elevation limit (in meters) below which SRTM data is\n\t    replaced by USGS-derived .sdf data (default = 0 meters)\n\n");
+		fprintf(stderr, "\t-o directory to write the converted files to\n\t    (default = current directory)\n\n");
+		fprintf(stderr, "\t-l file listing the SRTM files to convert, one per line\n\t    (- reads the list from stdin)\n\n");
+		fprintf(stderr, "\t-j number of tiles to convert at once\n\t    (default = all cores when converting more than one tile)\n\n");
+		fprintf(stderr, "\t-b write binary SDF files (.sdb) instead of text SDF files\n\n");
+		fprintf(stderr, "\tAny number of SRTM files or directories of them may be given.\n\n");
 		fprintf(stderr, "Examples: %s N40W074.hgt\n",string);
 		fprintf(stderr, "          %s -d /cdrom/sdf N40W074.hgt\n",string);
 		fprintf(stderr, "          %s -d /dev/null N40W074.hgt  (prevents data replacement)\n",string);
-		fprintf(stderr, "          %s -n -5 N40W074.hgt\n\n",string);
+		fprintf(stderr, "          %s -n -5 N40W074.hgt\n",string);
+		fprintf(stderr, "          %s -d /dev/null -j 8 -o sdf/ hgt/\n\n",string);
 
 		return 1;
 	}
@@ -639,17 +852,20 @@ int main(int argc, char *argv[])
 
 	min_elevation=0;
 
-	for (x=1, z=0; x<=y; x++)
+	for (x=1; x<=y; x++)
 	{
 		if (strcmp(argv[x],"-d")==0)
 		{
 			z=x+1;
 
 			if (z<=y && argv[z][0] && argv[z][0]!='-')
+			{
 				strncpy(sdf_path,argv[z],253);
+				x=z;
+			}
 		}
 
-		if (strcmp(argv[x],"-n")==0)
+		else if (strcmp(argv[x],"-n")==0)
 		{
 			z=x+1;
 
@@ -659,8 +875,69 @@ int main(int argc, char *argv[])
 
 				if (min_elevation<-32767)
 					min_elevation=0;
-			}			 
+
+				x=z;
+			}
+		}
+
+		else if (strcmp(argv[x],"-o")==0)
+		{
+			z=x+1;
+
+			if (z<=y && argv[z][0] && argv[z][0]!='-')
+			{
+				strncpy(out_path,argv[z],253);
+				x=z;
+			}
 		}
+
+		else if (strcmp(argv[x],"-j")==0)
+		{
+			z=x+1;
+
+			if (z<=y && argv[z][0])
+			{
+				sscanf(argv[z],"%d",&threads);
+				x=z;
+			}
+		}
+
+		else if (strcmp(argv[x],"-l")==0)
+		{
+			z=x+1;
+
+			if (z<=y && argv[z][0])
+			{
+				char line[512];
+
+				fd=strcmp(argv[z],"-")==0 ? stdin : fopen(argv[z],"r");
+
+				if (fd==NULL)
+				{
+					fprintf(stderr, "*** Error: Cannot read list \"%s\"\n", argv[z]);
+					return 1;
+				}
+
+				while (fgets(line,sizeof(line),fd)!=NULL)
+				{
+					line[strcspn(line,"\r\n")]=0;
+
+					if (line[0])
+						AddInput(inputs,line);
+				}
+
+				if (fd!=stdin)
+					fclose(fd);
+
+				x=z;
+			}
+		}
+
+		else if (strcmp(argv[x],"-b")==0)
+			binary=1;
+
+		else
+			AddInput(inputs,argv[x]);
 	}
 
 	/* If no SDF path was specified on the command line (-d), check
@@ -672,7 +949,7 @@ int main(int argc, char *argv[])
 	{
 		env=getenv("HOME");
 
-		sprintf(string,"%s/.splat_path",env);
+		snprintf(string,sizeof(string),"%s/.splat_path",env);
 
 		fd=fopen(string,"r");
 
@@ -691,7 +968,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	/* Ensure a trailing '/' is present in sdf_path */
+	(void)s;
+
+	/* Ensure a trailing '/' is present in sdf_path and out_path */
 
 	if (sdf_path[0])
 	{
@@ -704,14 +983,46 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (ReadSRTM(argv[z+1])==0)
+	if (out_path[0])
 	{
-		if (replacement_flag && sdf_path[0])
-			merge=ReadUSGS();
+		x=strlen(out_path);
 
-		WriteSDF(sdf_filename);
+		if (out_path[x-1]!='/')
+		{
+			out_path[x]='/';
+			out_path[x+1]=0;
+		}
 	}
 
-	return 0;
-}
+	if (threads<=0)
+		threads=inputs.size()>1 ? std::max(std::thread::hardware_concurrency(), 1u) : 1;
 
+	threads=std::min((size_t)threads, std::max(inputs.size(), (size_t)1));
+
+	/* Each worker takes the next tile off the list until none are left */
+
+	std::atomic<size_t> next(0);
+	std::atomic<int> failed(0);
+
+	auto worker=[&]()
+	{
+		struct tile t;
+		size_t i;
+
+		while ((i=next++)<inputs.size())
+			if (Convert(&t,&inputs[i][0])!=0)
+				failed++;
+	};
+
+	std::vector<std::thread> pool;
+
+	for (x=1; x<threads; x++)
+		pool.push_back(std::thread(worker));
+
+	worker();
+
+	for (auto &th : pool)
+		th.join();
+
+	return failed ? 1 : 0;
+}